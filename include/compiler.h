@@ -6,6 +6,7 @@
 #define INTERNAL_HIDDEN __attribute__((visibility("hidden")))
 #define ASSUME_ALIGNED __attribute__((assume_aligned(8)))
 #define CONST __attribute__((const))
+#define NO_INLINE __attribute__((noinline))
 
 /* This isn't standard in C as [[nodiscard]] until C23 */
 #define NO_DISCARD __attribute__((warn_unused_result))
@@ -45,6 +46,13 @@
 #define USE_NEON 0
 #endif
 
+#if __AVX2__
+#include <immintrin.h>
+#define USE_AVX2 1
+#else
+#define USE_AVX2 0
+#endif
+
 #if defined(__SANITIZE_ADDRESS__)
 static_assert(ENABLE_ASAN == 1, "ENABLE_ASAN should be 1 to enable asan instead");
 #endif
@@ -10,6 +10,22 @@
  * modifying these values as many of them are core to
  * how the underlying memory allocator functions */
 
+/* ZONE_CACHE_SZ, CHUNK_QUARANTINE_SZ, ZONE_ALLOC_RETIRE,
+ * the BIG_ZONE_* limits, ADAPTIVE_ZONES_WINDOW and
+ * default zones below are only
+ * defaults. They can be overridden at startup with the
+ * ISO_ALLOC_CONF environment variable without a rebuild,
+ * see iso_alloc_conf.h and README.md */
+
+/* A configuration generated from heap profiler output
+ * by utils/generate_target_config.py. It replaces the
+ * default zones, SMALLEST_CHUNK_SZ, ZONE_CACHE_SZ,
+ * CHUNK_QUARANTINE_SZ and SMALL_MEM_STARTUP values
+ * below. See PROFILER.md */
+#if TARGET_CONFIG
+#include "iso_alloc_target_config.h"
+#endif
+
 /* This controls what % of chunks are canaries in a
  * zone. For example, if a zone holds 128 byte chunks
  * then it has (ZONE_USER_SIZE / 128) = 32768 total
@@ -38,7 +54,13 @@
 #define INTERNAL_UZ_NAME "internal isoalloc user zone"
 #define PRIVATE_UZ_NAME "private isoalloc user zone"
 #define MEM_TAG_NAME "isoalloc zone mem tags"
+#define ZONE_REGION_NAME "isoalloc zone region"
+#define ARENA_SPAN_NAME "isoalloc arena span"
+#define ARENA_MD_NAME "isoalloc arena metadata"
+#define ZONE_SCAN_NAME "isoalloc zone scan snapshot"
+#define LEAK_SCAN_NAME "isoalloc leak scan"
 #define PREALLOC_BITMAPS "isoalloc small bitmaps"
+#define PROFILER_TABLE_NAME "isoalloc profiler backtraces"
 #endif
 
 /* If you're using the UAF_PTR_PAGE functionality and
@@ -48,6 +70,22 @@
 #define UAF_PTR_PAGE_ODDS 1000000
 #endif
 
+/* With INCREMENTAL_VERIFY a slice of the heap is verified
+ * every VERIFY_INTERVAL small allocations and frees. A slice
+ * runs for 1/VERIFY_TIME_DIVISOR of the time since the last
+ * one ended, up to VERIFY_SLICE_MAX_NS, which keeps the
+ * overhead under 1%. A slice is skipped until it would get
+ * VERIFY_SLICE_MIN_NS. The clock is read after every
+ * VERIFY_BUDGET bitmap qwords, canaries and free bit slot
+ * cache entries that are checked */
+#if INCREMENTAL_VERIFY
+#define VERIFY_INTERVAL 1024
+#define VERIFY_BUDGET 32
+#define VERIFY_TIME_DIVISOR 128
+#define VERIFY_SLICE_MIN_NS 2000
+#define VERIFY_SLICE_MAX_NS 100000
+#endif
+
 /* Zones can be retired after a certain number of
  * allocations. This is computed as the total count
  * of chunks the zone can hold multiplied by this
@@ -70,10 +108,23 @@
 #endif
 
 /* Size of the zone cache documented in PERFORMANCE.md */
+#ifndef ZONE_CACHE_SZ
 #define ZONE_CACHE_SZ 8
+#endif
 
 /* Size of the chunk quarantine cache documented in PERFORMANCE.md */
+#ifndef CHUNK_QUARANTINE_SZ
 #define CHUNK_QUARANTINE_SZ 64
+#endif
+
+/* With ADAPTIVE_ZONES enabled the default zones are
+ * reviewed after this many small allocations. A size
+ * is hot if it was requested for more than 1 in
+ * (1 << ADAPTIVE_ZONES_HOT_SHIFT) of them */
+#if ADAPTIVE_ZONES
+#define ADAPTIVE_ZONES_WINDOW 65536
+#define ADAPTIVE_ZONES_HOT_SHIFT 4
+#endif
 
 /* This is the maximum number of zones iso_alloc can
  * create. This is a completely arbitrary number but
@@ -84,6 +135,22 @@
  * more information on this value. Max is 65535 */
 #define MAX_ZONES 8192
 
+/* With ZONE_REGION every zone lives in its own slot of
+ * one reserved region. A slot is twice ZONE_USER_SIZE,
+ * the user pages and memory tags sit at the top of it
+ * and the rest stays PROT_NONE. One extra slot is
+ * reserved past the end for the last guard page */
+#if ZONE_REGION
+#define ZONE_REGION_SPAN_SHIFT 23
+#define ZONE_REGION_SPAN (1UL << ZONE_REGION_SPAN_SHIFT)
+#define ZONE_REGION_SLOTS MAX_ZONES
+#define ZONE_REGION_SIZE (ZONE_REGION_SPAN * ZONE_REGION_SLOTS)
+#define ZONE_REGION_SLOT_FREE 0xffff
+/* A destroyed zone's slot stays retired until no scan
+ * can still be reading it, see _zone_scan_unmap */
+#define ZONE_REGION_SLOT_RETIRED 0xfffe
+#endif
+
 /* Anything above this size will need to go through the
  * big zone path. Maximum value here is 131072 due to how
  * we construct the zone bitmap. You can think of this
@@ -106,6 +173,20 @@
  * not added to the free list after being used N times */
 #define BIG_ZONE_ALLOC_RETIRE 16
 
+/* Arenas bump allocate through spans of memory that
+ * start at ARENA_SPAN_SZ and double each time a new one
+ * is mapped, up to ARENA_SPAN_SZ_MAX. A request that is
+ * larger than the next span gets a span of its own */
+#define ARENA_SPAN_SZ 65536
+#define ARENA_SPAN_SZ_MAX 67108864
+
+/* Leak detection and zone verification scan a snapshot of
+ * the zone bitmaps without holding the root lock. One worker
+ * thread is started for every ZONE_SCAN_ZONES_PER_WORKER
+ * zones, up to ZONE_SCAN_WORKERS */
+#define ZONE_SCAN_WORKERS 8
+#define ZONE_SCAN_ZONES_PER_WORKER 64
+
 /* We allocate zones at startup for common sizes.
  * Each of these default zones is 4mb (ZONE_USER_SIZE)
  * so ZONE_8192 would hold less chunks than ZONE_128 */
@@ -139,7 +220,9 @@
  * You also need to define SMALLEST_CHUNK_SZ which should
  * correspond to the smallest value in your default_zones
  * array. It's value should never be less than 16 */
-#if SMALL_MEM_STARTUP
+#if TARGET_CONFIG
+/* default_zones is defined by iso_alloc_target_config.h */
+#elif SMALL_MEM_STARTUP
 /* ZONE_USER_SIZE * sizeof(default_zones) = ~16 mb */
 /* SZ_ALIGNMENT = 32 */
 #define SMALLEST_CHUNK_SZ SZ_ALIGNMENT
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +36,90 @@ static_assert(sizeof(size_t) == 8, "IsoAlloc requires 64 bit size_t");
 #endif
 
 typedef void iso_alloc_zone_handle;
+typedef void iso_alloc_arena_handle;
+
+/* One bucket per power of 2 chunk size starting at
+ * 16 bytes and ending at 131072 (max SMALL_SIZE_MAX) */
+#define ISO_ALLOC_STATS_SIZE_CLASSES 14
+
+typedef struct {
+    /* Bytes currently handed out from small zone chunks */
+    uint64_t allocated_bytes;
+    /* Resident set size of the process (Linux only) */
+    uint64_t resident_bytes;
+    /* Bytes of user pages mapped for zones and in use big zones */
+    uint64_t mapped_bytes;
+    /* In use chunks per power of 2 size class, index 0 is 16 bytes */
+    uint64_t active_chunks[ISO_ALLOC_STATS_SIZE_CLASSES];
+    /* Lifetime number of small zone allocations and frees */
+    uint64_t allocations;
+    uint64_t frees;
+    /* Number of zones currently in use */
+    uint64_t zones;
+    /* Lifetime number of zones created, including replacements */
+    uint64_t zone_creations;
+    /* Lifetime number of zones retired and replaced */
+    uint64_t zone_retirements;
+    /* Big zone allocations currently in use and their size */
+    uint64_t big_allocations;
+    uint64_t big_allocated_bytes;
+    /* Lifetime number of big zones unmapped after BIG_ZONE_ALLOC_RETIRE uses */
+    uint64_t big_zone_retirements;
+    /* Number of chunks waiting in the chunk quarantine */
+    uint64_t quarantine_depth;
+} iso_alloc_stats_t;
+
+/* Allocator paths that latency is recorded for when
+ * ALLOC_LATENCY is enabled. These index the paths
+ * array in iso_alloc_latency_t */
+#define ISO_ALLOC_LATENCY_CACHE_HIT 0
+#define ISO_ALLOC_LATENCY_SLOW_SCAN 1
+#define ISO_ALLOC_LATENCY_NEW_ZONE 2
+#define ISO_ALLOC_LATENCY_BIG_REUSE 3
+#define ISO_ALLOC_LATENCY_BIG_MMAP 4
+#define ISO_ALLOC_LATENCY_FREE 5
+#define ISO_ALLOC_LATENCY_PATHS 6
+
+typedef struct {
+    /* Number of operations recorded for this path */
+    uint64_t count;
+    /* Percentiles and maximum latency in nanoseconds. Percentiles
+     * are the upper bound of the histogram bucket they fall in */
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} iso_alloc_latency_path_t;
+
+typedef struct {
+    iso_alloc_latency_path_t paths[ISO_ALLOC_LATENCY_PATHS];
+} iso_alloc_latency_t;
+
+/* Allocator locks that are profiled when LOCK_PROFILER
+ * is enabled. These index the locks array in
+ * iso_alloc_lock_profile_t */
+#define ISO_ALLOC_LOCK_ROOT 0
+#define ISO_ALLOC_LOCK_BIG_ZONE_FREE 1
+#define ISO_ALLOC_LOCK_BIG_ZONE_USED 2
+#define ISO_ALLOC_LOCK_SANITY_CACHE 3
+#define ISO_ALLOC_LOCKS 4
+
+typedef struct {
+    /* Lifetime number of times the lock was acquired */
+    uint64_t acquisitions;
+    /* Number of acquisitions that had to wait for another thread */
+    uint64_t contended;
+    /* Total and longest time spent waiting in nanoseconds */
+    uint64_t total_wait_ns;
+    uint64_t max_wait_ns;
+    /* The function that held the lock during the longest wait */
+    const char *max_wait_holder;
+} iso_alloc_lock_stats_t;
+
+typedef struct {
+    iso_alloc_lock_stats_t locks[ISO_ALLOC_LOCKS];
+} iso_alloc_lock_profile_t;
 
 #if CPP_SUPPORT
 extern "C" {
@@ -66,7 +151,13 @@ EXTERNAL_API NO_DISCARD void *iso_alloc_tag_ptr(void *p, iso_alloc_zone_handle *
 EXTERNAL_API NO_DISCARD void *iso_alloc_untag_ptr(void *p, iso_alloc_zone_handle *zone);
 EXTERNAL_API NO_DISCARD iso_alloc_zone_handle *iso_alloc_new_zone(size_t size);
 EXTERNAL_API NO_DISCARD size_t iso_zone_chunk_count(iso_alloc_zone_handle *zone);
+EXTERNAL_API NO_DISCARD bool iso_zone_owns_ptr(iso_alloc_zone_handle *zone, void *p);
 EXTERNAL_API void iso_alloc_destroy_zone(iso_alloc_zone_handle *zone);
+EXTERNAL_API void iso_alloc_zone_reset(iso_alloc_zone_handle *zone, bool release_pages);
+EXTERNAL_API NO_DISCARD iso_alloc_arena_handle *iso_alloc_new_arena(size_t span_size);
+EXTERNAL_API NO_DISCARD MALLOC_ATTR void *iso_alloc_from_arena(iso_alloc_arena_handle *arena, size_t size, size_t alignment);
+EXTERNAL_API void iso_alloc_arena_reset(iso_alloc_arena_handle *arena);
+EXTERNAL_API void iso_alloc_destroy_arena(iso_alloc_arena_handle *arena);
 EXTERNAL_API void iso_alloc_protect_root(void);
 EXTERNAL_API void iso_alloc_unprotect_root(void);
 EXTERNAL_API uint64_t iso_alloc_detect_zone_leaks(iso_alloc_zone_handle *zone);
@@ -77,6 +168,10 @@ EXTERNAL_API void iso_verify_zones(void);
 EXTERNAL_API void iso_verify_zone(iso_alloc_zone_handle *zone);
 EXTERNAL_API int32_t iso_alloc_name_zone(iso_alloc_zone_handle *zone, char *name);
 EXTERNAL_API void iso_flush_caches(void);
+EXTERNAL_API void iso_alloc_get_stats(iso_alloc_stats_t *stats);
+EXTERNAL_API void iso_alloc_get_latency(iso_alloc_latency_t *latency);
+EXTERNAL_API void iso_alloc_dump_latency(int32_t fd);
+EXTERNAL_API void iso_alloc_get_lock_profile(iso_alloc_lock_profile_t *profile);
 
 #if HEAP_PROFILER
 #define BACKTRACE_DEPTH 8
@@ -88,8 +183,11 @@ typedef struct {
     size_t lower_bound_size;
     /* The largest allocation size requested by this call path */
     size_t upper_bound_size;
-    /* A 16 bit hash of the back trace */
-    uint16_t backtrace_hash;
+    /* Estimated bytes allocated by this call path, extrapolated
+     * from the byte based samples the profiler took */
+    uint64_t estimated_bytes;
+    /* A 64 bit hash of the back trace */
+    uint64_t backtrace_hash;
     /* Call count */
     size_t call_count;
 } iso_alloc_traces_t;
@@ -97,15 +195,16 @@ typedef struct {
 typedef struct {
     /* The address of the last 8 callers as referenced by stack frames */
     uint64_t callers[BACKTRACE_DEPTH];
-    /* A 16 bit hash of the back trace */
-    uint16_t backtrace_hash;
+    /* A 64 bit hash of the back trace */
+    uint64_t backtrace_hash;
     /* Call count */
     size_t call_count;
 } iso_free_traces_t;
 
-EXTERNAL_API size_t iso_get_alloc_traces(iso_alloc_traces_t *traces_out);
-EXTERNAL_API size_t iso_get_free_traces(iso_free_traces_t *traces_out);
+EXTERNAL_API size_t iso_get_alloc_traces(iso_alloc_traces_t *traces_out, size_t count);
+EXTERNAL_API size_t iso_get_free_traces(iso_free_traces_t *traces_out, size_t count);
 EXTERNAL_API void iso_alloc_reset_traces(void);
+EXTERNAL_API void iso_alloc_write_profile(void);
 #endif
 
 #if EXPERIMENTAL
@@ -0,0 +1,294 @@
+// iso_alloc.hpp - A secure memory allocator
+// Copyright 2023 - chris.rohlf@gmail.com
+
+// Header only C++ allocators backed by IsoAlloc private zones.
+// iso::allocator<T> can be handed to any standard container and
+// iso::zone_memory_resource can back any std::pmr container. Each
+// arena owns its own private zones so the objects of one container
+// are isolated from everything else on the heap, and releasing the
+// arena destroys those zones in one call. Requests too large for a
+// private zone, or made once no more zones can be created, are served
+// by iso_alloc and isolated only by size like any other allocation.
+//
+// With ABORT_ON_NULL enabled running out of zones aborts instead
+// of falling back to iso_alloc.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define ISO_ALLOC_PMR 1
+#endif
+
+#if CPP_SUPPORT
+#include "iso_alloc.h"
+#else
+extern "C" {
+#include "iso_alloc.h"
+}
+#endif
+
+namespace iso {
+
+// Requests are rounded up to a power of 2 chunk size and served
+// from a zone of that size, the same size classes as the default
+// zones. Anything larger goes to iso_alloc
+constexpr size_t smallest_zone_chunk_sz = 32;
+constexpr size_t largest_zone_chunk_sz = 8192;
+constexpr size_t zone_size_classes = 9;
+
+// A private zone of one chunk size. The zone is created on first
+// use and grows on its own as it fills up, so a pool only has to
+// hold the handle. The mutex is only taken to create or release it
+class zone_pool {
+  public:
+    zone_pool() : _zone(nullptr), _chunk_size(0) {}
+
+    zone_pool(const zone_pool &) = delete;
+    zone_pool &operator=(const zone_pool &) = delete;
+
+    ~zone_pool() {
+        release();
+    }
+
+    void set_chunk_size(size_t size) {
+        _chunk_size = size;
+    }
+
+    void *allocate() {
+        iso_alloc_zone_handle *zone = _zone.load(std::memory_order_acquire);
+
+        if(zone == nullptr) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            zone = _zone.load(std::memory_order_relaxed);
+
+            if(zone == nullptr) {
+                zone = iso_alloc_new_zone(_chunk_size);
+
+                if(zone == nullptr) {
+                    return nullptr;
+                }
+
+                _zone.store(zone, std::memory_order_release);
+            }
+        }
+
+        return iso_alloc_from_zone(zone);
+    }
+
+    // Returns false if p did not come from this pool
+    bool deallocate(void *p) {
+        iso_alloc_zone_handle *zone = _zone.load(std::memory_order_acquire);
+
+        if(zone == nullptr || iso_zone_owns_ptr(zone, p) == false) {
+            return false;
+        }
+
+        iso_free_from_zone(p, zone);
+        return true;
+    }
+
+    // Destroys the zone. Any chunk still
+    // allocated from it is freed along with it
+    void release() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        iso_alloc_zone_handle *zone = _zone.exchange(nullptr, std::memory_order_acq_rel);
+
+        if(zone != nullptr) {
+            iso_alloc_destroy_zone(zone);
+        }
+    }
+
+  private:
+    std::atomic<iso_alloc_zone_handle *> _zone;
+    size_t _chunk_size;
+    std::mutex _mutex;
+};
+
+// One zone_pool per size class. Zones are created the first
+// time a size class is used so an idle arena costs nothing
+class zone_arena {
+  public:
+    zone_arena() {
+        for(size_t i = 0; i < zone_size_classes; i++) {
+            _pools[i].set_chunk_size(smallest_zone_chunk_sz << i);
+        }
+    }
+
+    zone_arena(const zone_arena &) = delete;
+    zone_arena &operator=(const zone_arena &) = delete;
+
+    // Allocations with a stricter alignment than their size are
+    // rounded up to it. Zones of a power of 2 chunk size up to a
+    // page return chunks aligned to that size
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        // Chunks are never aligned beyond a page
+        if(alignment > 4096) {
+            return nullptr;
+        }
+
+        size_t cls = size_class(size > alignment ? size : alignment);
+
+        if(cls != zone_size_classes) {
+            void *p = _pools[cls].allocate();
+
+            if(p != nullptr) {
+                return p;
+            }
+        }
+
+        // iso_alloc makes no promise beyond this
+        if(alignment > alignof(std::max_align_t)) {
+            return nullptr;
+        }
+
+        return iso_alloc(size);
+    }
+
+    void deallocate(void *p, size_t size, size_t alignment = alignof(std::max_align_t)) {
+        if(p == nullptr) {
+            return;
+        }
+
+        size_t cls = size_class(size > alignment ? size : alignment);
+
+        if(cls != zone_size_classes && _pools[cls].deallocate(p) == true) {
+            return;
+        }
+
+        iso_free(p);
+    }
+
+    // Destroys every zone this arena created. Chunks that
+    // came from iso_alloc are not tracked and not released
+    void release() {
+        for(size_t i = 0; i < zone_size_classes; i++) {
+            _pools[i].release();
+        }
+    }
+
+  private:
+    static size_t size_class(size_t size) {
+        if(size > largest_zone_chunk_sz) {
+            return zone_size_classes;
+        }
+
+        size_t cls = 0;
+
+        while((smallest_zone_chunk_sz << cls) < size) {
+            cls++;
+        }
+
+        return cls;
+    }
+
+    zone_pool _pools[zone_size_classes];
+};
+
+// The arena used by default constructed allocators. It is never
+// destroyed so containers with static storage can outlive it
+inline std::shared_ptr<zone_arena> default_arena() {
+    static std::shared_ptr<zone_arena> arena(new zone_arena(), [](zone_arena *) {});
+    return arena;
+}
+
+// A standard allocator that places objects in private zones. Copies
+// and rebound copies share an arena and compare equal, allocators
+// with different arenas can't free each others memory
+template <typename T>
+class allocator {
+  public:
+    using value_type = T;
+
+    allocator() : _arena(default_arena()) {}
+
+    explicit allocator(std::shared_ptr<zone_arena> arena) : _arena(std::move(arena)) {}
+
+    template <typename U>
+    allocator(const allocator<U> &other) noexcept : _arena(other.arena()) {}
+
+    T *allocate(size_t n) {
+        if(n > (SIZE_MAX / sizeof(T))) {
+            throw std::bad_array_new_length();
+        }
+
+        void *p = _arena->allocate(n * sizeof(T), alignof(T));
+
+        if(p == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        _arena->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    const std::shared_ptr<zone_arena> &arena() const noexcept {
+        return _arena;
+    }
+
+  private:
+    std::shared_ptr<zone_arena> _arena;
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept {
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept {
+    return !(a == b);
+}
+
+#if ISO_ALLOC_PMR
+// A memory resource with its own set of private zones. Like
+// std::pmr::monotonic_buffer_resource, release() frees everything
+// allocated from it at once, including memory containers still
+// point to. The destructor calls release()
+class zone_memory_resource : public std::pmr::memory_resource {
+  public:
+    zone_memory_resource() = default;
+
+    zone_memory_resource(const zone_memory_resource &) = delete;
+    zone_memory_resource &operator=(const zone_memory_resource &) = delete;
+
+    ~zone_memory_resource() override {
+        release();
+    }
+
+    void release() {
+        _arena.release();
+    }
+
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        void *p = _arena.allocate(bytes, alignment);
+
+        if(p == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        return p;
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        _arena.deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    zone_arena _arena;
+};
+#endif
+
+} // namespace iso
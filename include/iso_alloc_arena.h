@@ -0,0 +1,73 @@
+/* iso_alloc_arena.h - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#pragma once
+
+#include "compiler.h"
+
+/* Alignment of arena allocations made without one */
+#define ARENA_ALIGNMENT 16
+
+/* The arena metadata lives in a single page of its own
+ * so the span table is sized to fill what's left of it */
+#define ARENA_MAX_SPANS 240
+
+/* A span is a run of pages from mmap_guarded_rw_pages,
+ * so every span has a guard page above and below it */
+typedef struct {
+    /* Masked with the arena mask */
+    uintptr_t start;
+    size_t size;
+} iso_alloc_arena_span_t;
+
+/* Arenas never track individual allocations. A cursor is
+ * bumped through the current span and everything is freed
+ * at once by a reset or destroy. The metadata is mapped
+ * separately from the spans, between its own guard pages,
+ * and every pointer in it is masked */
+typedef struct {
+    uint64_t mask;
+    /* Masked pointers to the next free byte and
+     * the end of the current span */
+    uintptr_t cursor;
+    uintptr_t end;
+    /* Size of the next span, doubles up to ARENA_SPAN_SZ_MAX */
+    size_t next_span_sz;
+    uint32_t span_count;
+    uint32_t current_span;
+#if THREAD_SUPPORT
+#if USE_SPINLOCK
+    atomic_flag lock;
+#else
+    pthread_mutex_t lock;
+#endif
+#endif
+    iso_alloc_arena_span_t spans[ARENA_MAX_SPANS];
+} __attribute__((aligned(sizeof(int64_t)))) iso_alloc_arena_t;
+
+static_assert(sizeof(iso_alloc_arena_t) <= 4096, "iso_alloc_arena_t must fit in a single page");
+
+#if THREAD_SUPPORT
+#if USE_SPINLOCK
+#define LOCK_ARENA(arena)                          \
+    do {                                           \
+    } while(atomic_flag_test_and_set(&arena->lock));
+
+#define UNLOCK_ARENA(arena) \
+    atomic_flag_clear(&arena->lock);
+#else
+#define LOCK_ARENA(arena) \
+    pthread_mutex_lock(&arena->lock);
+
+#define UNLOCK_ARENA(arena) \
+    pthread_mutex_unlock(&arena->lock);
+#endif
+#else
+#define LOCK_ARENA(arena)
+#define UNLOCK_ARENA(arena)
+#endif
+
+INTERNAL_HIDDEN iso_alloc_arena_t *_iso_new_arena(size_t span_size);
+INTERNAL_HIDDEN void *_iso_arena_alloc(iso_alloc_arena_t *arena, size_t size, size_t alignment);
+INTERNAL_HIDDEN void _iso_arena_reset(iso_alloc_arena_t *arena);
+INTERNAL_HIDDEN void _iso_arena_destroy(iso_alloc_arena_t *arena);
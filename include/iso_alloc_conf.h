@@ -0,0 +1,50 @@
+/* iso_alloc_conf.h - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#pragma once
+
+#include "compiler.h"
+
+/* A comma separated list of key=value pairs read once at
+ * startup, e.g. ISO_ALLOC_CONF=zone_cache_sz=16,default_zones=64:256
+ * Every key is optional and defaults to its value in conf.h.
+ * See README.md for the full list of keys */
+#define CONF_ENV_STR "ISO_ALLOC_CONF"
+
+/* The longest key or value the parser will accept */
+#define CONF_TOKEN_MAX 64
+
+/* The thread local zone cache is a fixed size array so
+ * zone_cache_sz can't be raised beyond this at runtime */
+#define ZONE_CACHE_SZ_MAX 32
+
+/* Upper bounds on the remaining runtime values. These only
+ * exist to catch typos, not to enforce any security property */
+#define CHUNK_QUARANTINE_SZ_MAX 65536
+#define ZONE_ALLOC_RETIRE_MAX 1024
+#define BIG_ZONE_MAX_FREE_LIST_MAX 4096
+#define BIG_ZONE_ALLOC_RETIRE_MAX 4096
+#define DEFAULT_ZONES_MAX 64
+#define ADAPTIVE_ZONES_WINDOW_MIN 1024
+
+/* Tunables that affect performance and memory usage but not
+ * the security properties of the allocator. Options such as
+ * canaries, chunk sanitization, UAF_PTR_PAGE and memory tagging
+ * stay compile time only so an environment variable can never
+ * weaken a hardened build */
+typedef struct {
+    uint32_t zone_cache_sz;
+    uint32_t chunk_quarantine_sz;
+    uint32_t zone_alloc_retire;
+    uint32_t big_zone_waste;
+    uint32_t big_zone_max_free_list;
+    uint32_t big_zone_alloc_retire;
+    uint32_t sanity_sample_odds;
+    uint32_t profiler_sample_bytes;
+    uint32_t profiler_odds;
+    uint32_t adaptive_zones_window;
+    uint32_t default_zone_count;
+    uint64_t default_zones[DEFAULT_ZONES_MAX];
+} __attribute__((aligned(sizeof(int64_t)))) iso_alloc_conf_t;
+
+INTERNAL_HIDDEN void _iso_alloc_initialize_conf(iso_alloc_conf_t *conf);
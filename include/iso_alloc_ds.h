@@ -42,6 +42,9 @@ typedef struct {
     free_bit_slot_t free_bit_slots_index;  /* Tracks how many entries in the cache are filled */
     bool is_full;                          /* Flags whether this zone is full to avoid bit slot searches */
     bool internal;                         /* Zones can be managed by iso_alloc or private */
+#if ADAPTIVE_ZONES
+    bool released; /* User pages were returned to the kernel, replaced on next use */
+#endif
 #if MEMORY_TAGGING
     bool tagged; /* Zone supports memory tagging */
 #endif
@@ -56,10 +59,17 @@ typedef struct {
     uint32_t alloc_count;   /* Total number of lifetime allocations */
     uint16_t index;         /* Zone index */
     uint16_t next_sz_index; /* What is the index of the next zone of this size */
+    uint16_t next_private_index; /* Next zone of a growable private zone, 0 if none */
     /* Large cold array: only accessed when refilling the free list */
     bit_slot_t free_bit_slots[ZONE_FREE_LIST_SZ]; /* A cache of bit slots that point to freed chunks */
 } __attribute__((packed, aligned(sizeof(int64_t)))) iso_alloc_zone_t;
 
+/* A zone mapping waiting for scans to finish with it */
+typedef struct {
+    void *start;
+    size_t size;
+} zone_unmap_t;
+
 /* Meta data for big allocations are allocated near the
  * user pages themselves but separated via guard pages.
  * This meta data is stored at a random offset from the
@@ -107,6 +117,59 @@ typedef struct {
     uint32_t bucket;
 } __attribute__((packed, aligned(sizeof(int64_t)))) iso_alloc_bitmap_t;
 
+#if ALLOC_STATS
+/* Statistics counters are striped across a fixed number
+ * of slots. Each thread is assigned a slot the first time
+ * it updates a counter and it is the only writer in the
+ * common case. Readers sum all slots. Counters that can
+ * go down are stored as wrapping deltas, the sum across
+ * all slots is always the correct value */
+#define STATS_SLOTS 64
+
+typedef struct {
+    uint64_t allocated_bytes;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t zone_creations;
+    uint64_t zone_retirements;
+    uint64_t big_allocations;
+    uint64_t big_allocated_bytes;
+    uint64_t big_zone_retirements;
+    uint64_t active_chunks[ISO_ALLOC_STATS_SIZE_CLASSES];
+} __attribute__((aligned(64))) iso_alloc_stats_slot_t;
+#endif
+
+#if ALLOC_LATENCY
+/* Latency histograms are log-linear. Values below
+ * LATENCY_SUB_BUCKETS nanoseconds get their own bucket,
+ * every power of 2 above that is split into
+ * LATENCY_SUB_BUCKETS linear buckets. 256 buckets
+ * covers latencies up to ~8 seconds, anything slower
+ * is recorded in the last bucket */
+#define LATENCY_SLOTS 16
+#define LATENCY_SUB_BUCKET_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS 256
+
+typedef struct {
+    uint64_t buckets[ISO_ALLOC_LATENCY_PATHS][LATENCY_BUCKETS];
+    uint64_t max[ISO_ALLOC_LATENCY_PATHS];
+} __attribute__((aligned(64))) iso_alloc_latency_slot_t;
+#endif
+
+#if LOCK_PROFILER
+/* Every field is written while holding the lock it
+ * describes, except holder which waiters read racily */
+typedef struct {
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t total_wait_ns;
+    uint64_t max_wait_ns;
+    const char *holder;
+    const char *max_wait_holder;
+} __attribute__((aligned(64))) iso_alloc_lock_prof_t;
+#endif
+
 /* There is only one iso_alloc root per-process.
  * It contains an array of zone structures. Each
  * Zone represents a number of contiguous pages
@@ -120,6 +183,10 @@ typedef struct {
      * more common with a higher RSS and more mappings. */
     chunk_lookup_table_t *chunk_lookup_table;
     uintptr_t *chunk_quarantine;
+    /* Index plus one of the zone that owns each quarantined
+     * chunk when the free path already found it, 0 if the
+     * zone is looked up when the quarantine is flushed */
+    uint16_t *chunk_quarantine_zones;
     iso_alloc_big_zone_t *big_zone_free;
     iso_alloc_big_zone_t *big_zone_used;
 #if NO_ZERO_ALLOCATIONS
@@ -145,6 +212,33 @@ typedef struct {
     uint64_t big_zone_next_mask;
     uint64_t big_zone_canary_secret;
     uint64_t seed;
+    /* Runtime tunables, see iso_alloc_conf.h */
+    iso_alloc_conf_t conf;
+#if ZONE_REGION
+    /* Every zone is mapped into a slot of this region,
+     * zone_region_slots maps a slot to its zone index */
+    void *zone_region;
+    uint16_t zone_region_slots[ZONE_REGION_SLOTS];
+#endif
+#if ADAPTIVE_ZONES
+    /* Small allocation requests by size since the default
+     * zones were last reviewed, one counter per SZ_ALIGNMENT */
+    uint32_t adaptive_sizes[(MAX_DEFAULT_ZONE_SZ / SZ_ALIGNMENT) + 1];
+    uint32_t adaptive_allocs;
+    /* alloc_count of each default zone at the last review */
+    uint32_t adaptive_zone_allocs[DEFAULT_ZONES_MAX];
+    /* Set once a default zone is replaced with one of a
+     * different size, they are no longer sorted by size */
+    bool default_zones_replaced;
+#endif
+#if ALLOC_STATS
+    iso_alloc_stats_slot_t *stats_slots;
+    uint32_t stats_next_slot;
+#endif
+#if ALLOC_LATENCY
+    iso_alloc_latency_slot_t *latency_slots;
+    uint32_t latency_next_slot;
+#endif
     size_t chunk_quarantine_count;
     size_t zones_size;
 #if THREAD_SUPPORT
@@ -160,6 +254,24 @@ typedef struct {
     int32_t big_zone_free_count;
     int32_t big_zone_used_count;
     uint16_t zones_used;
+    /* Scans reading zone pages without the root lock. User
+     * pages of a zone destroyed while one is in flight are
+     * unmapped when the last scan finishes */
+    uint32_t zone_scans;
+    uint32_t deferred_unmap_count;
+    uint32_t deferred_unmap_capacity;
+    zone_unmap_t *deferred_unmaps;
+    /* Bumped whenever a zone's pages are reset, released or
+     * destroyed so a scan can tell its snapshot is stale */
+    uint32_t zone_generations[MAX_ZONES];
+#if INCREMENTAL_VERIFY
+    /* Where the incremental verifier resumes and
+     * when its last slice ended */
+    uint64_t verify_last_ns;
+    uint32_t verify_calls;
+    uint16_t verify_zone;
+    uint16_t verify_bitmap_idx;
+#endif
 #if ARM_MTE
     bool arm_mte_enabled;
 #endif
@@ -48,6 +48,7 @@ assert(sizeof(size_t) >= 64)
 
 #if THREAD_SUPPORT
 #include <pthread.h>
+#include <sched.h>
 #ifdef __cplusplus
 #include <atomic>
     using namespace std;
@@ -60,12 +61,20 @@ assert(sizeof(size_t) >= 64)
 #include <fcntl.h>
 #endif
 
+/* Defined before the headers below, conf.h and
+ * iso_alloc_ds.h size things by it */
+#define SZ_ALIGNMENT 32
+
 #include "conf.h"
 #include "iso_alloc.h"
 #include "iso_alloc_sanity.h"
 #include "iso_alloc_util.h"
+#include "iso_alloc_conf.h"
 #include "iso_alloc_ds.h"
+#include "iso_alloc_stats.h"
 #include "iso_alloc_profiler.h"
+#include "iso_alloc_trace.h"
+#include "iso_alloc_arena.h"
 #include "compiler.h"
 
 #ifndef MADV_DONTNEED
@@ -171,11 +180,18 @@ assert(sizeof(size_t) >= 64)
 
 #define USED_BIT_VECTOR 0x5555555555555555
 
+/* A bitmap qword whose only set bits mark its first chunk
+ * as a canary. None of its chunks have been handed out yet
+ * so the canary hasn't been written to the user pages */
+#define CANARY_UNWRITTEN_QWORD 0x3
+
+/* Operations _iso_alloc_scan_zones can run on every zone */
+#define ZONE_SCAN_LEAKS 1
+#define ZONE_SCAN_VERIFY 2
+
 /* All chunks are 8 byte aligned */
 #define CHUNK_ALIGNMENT 8
 
-#define SZ_ALIGNMENT 32
-
 #define WHICH_BIT(bit_slot) \
     (bit_slot & (BITS_PER_QWORD - 1))
 
@@ -297,8 +313,15 @@ extern uint32_t g_page_size_shift;
  * the zone user memory! */
 #define ZONE_USER_SIZE 4194304
 
+#if ZONE_REGION
+static_assert(ZONE_REGION_SPAN >= (ZONE_USER_SIZE * 2), "ZONE_REGION_SPAN must be at least twice ZONE_USER_SIZE");
+static_assert(MAX_ZONES < ZONE_REGION_SLOT_RETIRED, "MAX_ZONES must fit in a zone region slot");
+#endif
+
 static_assert(SMALLEST_CHUNK_SZ >= 16, "SMALLEST_CHUNK_SZ is too small, must be at least 16");
 static_assert(SMALL_SIZE_MAX <= 131072, "SMALL_SIZE_MAX is too big, cannot exceed 131072");
+static_assert(ZONE_CACHE_SZ <= ZONE_CACHE_SZ_MAX, "ZONE_CACHE_SZ is too big, cannot exceed ZONE_CACHE_SZ_MAX");
+static_assert(DEFAULT_ZONE_COUNT <= DEFAULT_ZONES_MAX, "Too many default zones, cannot exceed DEFAULT_ZONES_MAX");
 
 /* bitmap_size = (ZONE_USER_SIZE / SMALLEST_CHUNK_SZ) * BITS_PER_CHUNK / BITS_PER_BYTE
  * max_bitmap_idx = bitmap_size / sizeof(uint64_t)
@@ -311,43 +334,65 @@ static_assert((ZONE_USER_SIZE * BITS_PER_CHUNK / BITS_PER_BYTE / SMALLEST_CHUNK_
 #if THREAD_SUPPORT
 #if USE_SPINLOCK
 extern atomic_flag root_busy_flag;
+#if LOCK_PROFILER
+#define LOCK_ROOT() \
+    _iso_spinlock_lock_profiled(&root_busy_flag, ISO_ALLOC_LOCK_ROOT, __func__);
+
+#define LOCK_BIG_ZONE_FREE() \
+    _iso_spinlock_lock_profiled(&_root->big_zone_free_flag, ISO_ALLOC_LOCK_BIG_ZONE_FREE, __func__);
+
+#define LOCK_BIG_ZONE_USED() \
+    _iso_spinlock_lock_profiled(&_root->big_zone_used_flag, ISO_ALLOC_LOCK_BIG_ZONE_USED, __func__);
+#else
 #define LOCK_ROOT() \
     do {            \
     } while(atomic_flag_test_and_set(&root_busy_flag));
 
-#define UNLOCK_ROOT() \
-    atomic_flag_clear(&root_busy_flag);
-
 #define LOCK_BIG_ZONE_FREE() \
     do {                     \
     } while(atomic_flag_test_and_set(&_root->big_zone_free_flag));
 
-#define UNLOCK_BIG_ZONE_FREE() \
-    atomic_flag_clear(&_root->big_zone_free_flag);
-
 #define LOCK_BIG_ZONE_USED() \
     do {                     \
     } while(atomic_flag_test_and_set(&_root->big_zone_used_flag));
+#endif
+
+#define UNLOCK_ROOT() \
+    atomic_flag_clear(&root_busy_flag);
+
+#define UNLOCK_BIG_ZONE_FREE() \
+    atomic_flag_clear(&_root->big_zone_free_flag);
 
 #define UNLOCK_BIG_ZONE_USED() \
     atomic_flag_clear(&_root->big_zone_used_flag);
 
 #else
 extern pthread_mutex_t root_busy_mutex;
+#if LOCK_PROFILER
 #define LOCK_ROOT() \
-    pthread_mutex_lock(&root_busy_mutex);
+    _iso_mutex_lock_profiled(&root_busy_mutex, ISO_ALLOC_LOCK_ROOT, __func__);
 
-#define UNLOCK_ROOT() \
-    pthread_mutex_unlock(&root_busy_mutex);
+#define LOCK_BIG_ZONE_FREE() \
+    _iso_mutex_lock_profiled(&_root->big_zone_free_mutex, ISO_ALLOC_LOCK_BIG_ZONE_FREE, __func__);
+
+#define LOCK_BIG_ZONE_USED() \
+    _iso_mutex_lock_profiled(&_root->big_zone_used_mutex, ISO_ALLOC_LOCK_BIG_ZONE_USED, __func__);
+#else
+#define LOCK_ROOT() \
+    pthread_mutex_lock(&root_busy_mutex);
 
 #define LOCK_BIG_ZONE_FREE() \
     pthread_mutex_lock(&_root->big_zone_free_mutex);
 
-#define UNLOCK_BIG_ZONE_FREE() \
-    pthread_mutex_unlock(&_root->big_zone_free_mutex);
-
 #define LOCK_BIG_ZONE_USED() \
     pthread_mutex_lock(&_root->big_zone_used_mutex);
+#endif
+
+#define UNLOCK_ROOT() \
+    pthread_mutex_unlock(&root_busy_mutex);
+
+#define UNLOCK_BIG_ZONE_FREE() \
+    pthread_mutex_unlock(&_root->big_zone_free_mutex);
 
 #define UNLOCK_BIG_ZONE_USED() \
     pthread_mutex_unlock(&_root->big_zone_used_mutex);
@@ -369,6 +414,7 @@ extern iso_alloc_root *_root;
 
 INTERNAL_HIDDEN INLINE void check_big_canary(iso_alloc_big_zone_t *big);
 INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone_t *zone, const void *p);
+INTERNAL_HIDDEN INLINE void check_unwritten_canary(iso_alloc_zone_t *zone, const void *p);
 INTERNAL_HIDDEN INLINE void iso_clear_user_chunk(uint8_t *p, size_t size);
 INTERNAL_HIDDEN INLINE void insert_free_bit_slot(iso_alloc_zone_t *zone, int64_t bit_slot);
 INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone_t *zone, void *p);
@@ -382,6 +428,11 @@ INTERNAL_HIDDEN iso_alloc_zone_t *iso_new_zone(size_t size, bool internal);
 INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal, int32_t index);
 INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_bitmap_range(const void *p);
 INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_range(void *p);
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_by_size(void *p, size_t size);
+INTERNAL_HIDDEN iso_alloc_zone_t *_next_private_zone(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void _iso_alloc_zone_reset(iso_alloc_zone_t *zone, bool release_pages);
+INTERNAL_HIDDEN iso_alloc_zone_t *_private_zone_member(iso_alloc_zone_t *zone, const void *p);
+INTERNAL_HIDDEN iso_alloc_zone_t *_usable_private_zone(iso_alloc_zone_t *zone, size_t size);
 INTERNAL_HIDDEN iso_alloc_zone_t *search_chunk_lookup_table(const void *p);
 INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot_slow(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN bit_slot_t iso_scan_zone_free_slot(iso_alloc_zone_t *zone);
@@ -394,7 +445,7 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_free_internal_unlocked(void *p, bool perm
 INTERNAL_HIDDEN void fill_free_bit_slots(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void flush_caches(void);
 INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *p, bool permanent);
-INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone, bool write);
 INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void);
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bool flush_caches, bool replace);
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone_t *zone);
@@ -402,6 +453,16 @@ INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void _verify_all_zones(void);
 INTERNAL_HIDDEN void verify_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN void verify_all_zones(void);
+INTERNAL_HIDDEN int64_t _verify_zone_bitmap(iso_alloc_zone_t *zone, const bitmap_index_t *bm, bool abort_on_fail);
+INTERNAL_HIDDEN uint64_t _iso_alloc_scan_zones(int32_t op);
+INTERNAL_HIDDEN void _zone_scan_begin(void);
+INTERNAL_HIDDEN void _zone_scan_end(void);
+INTERNAL_HIDDEN void _zone_scan_unmap(void *start, size_t size);
+INTERNAL_HIDDEN void _zone_scan_invalidate(iso_alloc_zone_t *zone);
+#if INCREMENTAL_VERIFY
+INTERNAL_HIDDEN void _verify_zones_incremental(void);
+INTERNAL_HIDDEN INLINE void _incremental_verify_record(void);
+#endif
 INTERNAL_HIDDEN void _iso_free(void *p, bool permanent);
 INTERNAL_HIDDEN void _iso_free_internal(void *p, bool permanent);
 INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size);
@@ -426,9 +487,28 @@ INTERNAL_HIDDEN void _iso_alloc_verify_tag(void *p, iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN size_t _iso_alloc_print_stats(void);
 INTERNAL_HIDDEN size_t _iso_chunk_size(void *p);
 INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone_t *zone, const void *p);
+INTERNAL_HIDDEN int64_t check_unwritten_canary_no_abort(iso_alloc_zone_t *zone, const void *p);
 INTERNAL_HIDDEN void _iso_alloc_initialize(void);
 INTERNAL_HIDDEN void _iso_alloc_destroy(void);
 
+#if ZONE_REGION
+INTERNAL_HIDDEN void _zone_region_initialize(void);
+INTERNAL_HIDDEN void _zone_region_destroy(void);
+INTERNAL_HIDDEN void *_zone_region_map(size_t size, uint16_t zone_index, int32_t prot, const char *name);
+INTERNAL_HIDDEN void _zone_region_unmap(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void _zone_region_release_slot(void *slot_start);
+INTERNAL_HIDDEN iso_alloc_zone_t *_zone_region_find(const void *p);
+#endif
+
+#if ADAPTIVE_ZONES
+INTERNAL_HIDDEN void _unlink_zone_lookup(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN void _release_zone(iso_alloc_zone_t *zone);
+INTERNAL_HIDDEN bool _zone_size_exists(size_t size);
+INTERNAL_HIDDEN bool _is_zone_cold(uint32_t i);
+INTERNAL_HIDDEN void _adapt_zones(void);
+INTERNAL_HIDDEN INLINE void _adaptive_zones_record(size_t size);
+#endif
+
 #if ARM_MTE
 INLINE void *iso_mte_untag_ptr(void *p);
 INLINE uint8_t iso_mte_extract_tag(void *p);
@@ -447,6 +527,10 @@ INTERNAL_HIDDEN void handle_signal(int sig, siginfo_t *si, void *ctx);
 INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start);
 #endif
 
+#if LEAK_REACHABILITY
+INTERNAL_HIDDEN uint64_t _iso_alloc_detect_unreachable(void);
+#endif
+
 #if UNIT_TESTING
 EXTERNAL_API iso_alloc_root *_get_root(void);
 #endif
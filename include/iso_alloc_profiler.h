@@ -7,53 +7,136 @@
 #include "compiler.h"
 #include "conf.h"
 
+/* Allocations are sampled by bytes. Every thread counts
+ * down a random number of bytes drawn from an exponential
+ * distribution with this mean, and the allocation that
+ * crosses zero is sampled. Each crossing stands for this
+ * many bytes so the sampled volume is an unbiased estimate
+ * of the bytes actually allocated */
+#define PROFILER_SAMPLE_BYTES (512 * 1024)
+
+/* The size of a chunk isn't known when it's passed to free
+ * so frees are sampled once every PROFILER_ODDS calls on
+ * average using the same per-thread countdown */
 #define PROFILER_ODDS 10000
-#define HG_SIZE 65535
+
 #define CHUNK_USAGE_THRESHOLD 75
 #define PROFILER_ENV_STR "ISO_ALLOC_PROFILER_FILE_PATH"
 #define PROFILER_FILE_PATH "iso_alloc_profiler.data"
+
+/* When set to a number of seconds a new snapshot of the
+ * profile is written by the first sampled allocation
+ * after each interval passes */
+#define PROFILER_INTERVAL_ENV_STR "ISO_ALLOC_PROFILER_INTERVAL"
+
+/* Allocation stacks in folded format are written to
+ * the profile path with this suffix appended */
+#define PROFILER_FOLDED_SUFFIX ".folded"
+
+/* Snapshots are written here first and renamed
+ * over the previous snapshot when complete */
+#define PROFILER_TMP_SUFFIX ".tmp"
+
+#define PROFILER_WRITE_BUFFER 65536
+#define PROFILER_LINE_MAX 1024
 #define BACKTRACE_DEPTH 8
-#define BACKTRACE_DEPTH_SZ 128
 
-/* The IsoAlloc profiler is not thread local but these
- * globals should only ever be touched by internal
- * allocator functions when the root is locked */
-uint64_t _alloc_count;
-uint64_t _free_count;
-uint64_t _alloc_sampled_count;
-uint64_t _free_sampled_count;
+/* Sampled backtraces are kept in open addressing hash
+ * tables keyed by the full backtrace hash. A table is
+ * mapped from internal pages the first time it's used,
+ * starts with room for PROFILER_TABLE_INITIAL_SIZE traces
+ * and doubles whenever it fills up. A table never grows
+ * past PROFILER_TABLE_MAX_BYTES, samples from call sites
+ * first seen after that are counted as overflow instead.
+ * Add -DPROFILER_TABLE_MAX_BYTES=N to HEAP_PROFILER in
+ * the Makefile to change the bound */
+#define PROFILER_TABLE_INITIAL_SIZE 256
+
+#ifndef PROFILER_TABLE_MAX_BYTES
+#define PROFILER_TABLE_MAX_BYTES (64 * MEGABYTE_SIZE)
+#endif
+
+/* Profiler counters are striped across threads the
+ * same way the allocator statistics are. Must be a
+ * power of 2 */
+#define PROFILER_SLOTS 16
+
+typedef struct {
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    uint64_t alloc_sampled_count;
+    /* Number of sample points that fell in sampled
+     * allocations, each one is PROFILER_SAMPLE_BYTES */
+    uint64_t alloc_sample_points;
+    uint64_t free_count;
+    uint64_t free_sampled_count;
+} __attribute__((aligned(64))) iso_alloc_profiler_slot_t;
 
-int32_t profiler_fd;
+typedef struct {
+    iso_alloc_profiler_slot_t *slot;
+    int64_t alloc_countdown;
+    int64_t free_countdown;
+    uint64_t seed;
+} iso_alloc_profiler_thread_t;
 
 typedef struct {
     uint64_t total;
     uint64_t count;
 } zone_profiler_map_t;
 
-zone_profiler_map_t _zone_profiler_map[SMALL_SIZE_MAX];
+/* A chunk size and its zone_profiler_map_t entry as
+ * copied out of the map for a snapshot */
+typedef struct {
+    uint32_t size;
+    uint64_t total;
+    uint64_t count;
+} zone_profile_entry_t;
+
+typedef struct {
+    int32_t fd;
+    size_t used;
+    char buf[PROFILER_WRITE_BUFFER];
+} profiler_writer_t;
 
-/* iso_alloc_traces_t is a public structure, and
- * is defined in the public header iso_alloc.h */
-iso_alloc_traces_t _alloc_bts[BACKTRACE_DEPTH_SZ];
-size_t _alloc_bts_count;
+typedef struct {
+    uint64_t hash;
+    /* Index of the trace in the entries array plus
+     * one, zero marks an empty bucket */
+    uint64_t index;
+} profiler_bucket_t;
+
+typedef struct {
+    /* There are always twice as many buckets as
+     * entries so probe sequences stay short */
+    profiler_bucket_t *buckets;
+    /* Traces in the order they were first seen. Either
+     * iso_alloc_traces_t or iso_free_traces_t */
+    void *entries;
+    size_t entry_size;
+    size_t capacity;
+    size_t count;
+    /* Samples dropped because the call site was new and
+     * the table had reached PROFILER_TABLE_MAX_BYTES */
+    uint64_t overflow;
+} profiler_table_t;
 
-/* iso_free_traces_t is a public structure, and
- * is defined in the public header iso_alloc.h */
-iso_free_traces_t _free_bts[BACKTRACE_DEPTH_SZ];
-size_t _free_bts_count;
+extern bool _profiler_snapshot_due;
 
-INTERNAL_HIDDEN INLINE uint64_t _get_backtrace_hash(void);
-INTERNAL_HIDDEN INLINE void _save_backtrace(iso_alloc_traces_t *abts);
-INTERNAL_HIDDEN INLINE uint64_t _call_count_from_hash(uint16_t hash);
+INTERNAL_HIDDEN uint64_t _iso_unwind(uint64_t *callers, int32_t skip);
 INTERNAL_HIDDEN void _iso_output_profile(void);
+INTERNAL_HIDDEN void _iso_write_profile(void);
+INTERNAL_HIDDEN void *_profiler_table_snapshot(profiler_table_t *t, size_t *count, uint64_t *overflow, size_t *map_size);
+INTERNAL_HIDDEN size_t _profiler_zone_snapshot(zone_profile_entry_t *out, size_t max);
+INTERNAL_HIDDEN void _iso_alloc_write_profile(void);
 INTERNAL_HIDDEN void _initialize_profiler(void);
 INTERNAL_HIDDEN void _iso_alloc_profile(size_t size);
 INTERNAL_HIDDEN void _iso_free_profile(void);
-INTERNAL_HIDDEN size_t _iso_get_alloc_traces(iso_alloc_traces_t *traces_out);
-INTERNAL_HIDDEN size_t _iso_get_free_traces(iso_free_traces_t *traces_out);
+INTERNAL_HIDDEN size_t _iso_get_alloc_traces(iso_alloc_traces_t *traces_out, size_t count);
+INTERNAL_HIDDEN size_t _iso_get_free_traces(iso_free_traces_t *traces_out, size_t count);
 INTERNAL_HIDDEN void _iso_alloc_reset_traces(void);
 #endif
 
+INTERNAL_HIDDEN uint64_t _zone_bitmap_leaks(iso_alloc_zone_t *zone, const bitmap_index_t *bm, bool profile, uint64_t *was_used);
 INTERNAL_HIDDEN uint64_t _iso_alloc_zone_leak_detector(iso_alloc_zone_t *zone, bool profile);
 INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks_in_zone(iso_alloc_zone_t *zone);
 INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks(void);
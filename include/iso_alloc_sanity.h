@@ -16,24 +16,40 @@
 
 #define SANITY_SAMPLE_ODDS 10000
 #define MAX_SANE_SAMPLES 1024
-#define SANE_CACHE_SIZE 65535
-#define SANE_CACHE_IDX(p) (((uint64_t) p >> 8) & 0xffff)
+
+/* Sampled allocations are served from a region reserved
+ * at startup. Slots alternate with guard pages so slot i is
+ * page (i * 2) + 1 of the region, and the slot of any
+ * pointer in the region is found with a shift */
+#define SANE_REGION_SIZE ((((uint64_t) MAX_SANE_SAMPLES * 2) + 1) << g_page_size_shift)
+#define SANE_SLOT_ADDR(i) (_sane_region + ((((uint64_t) (i) * 2) + 1) << g_page_size_shift))
+
 #define SANITY_CANARY_VALIDATE_MASK 0xffffffffffffff00
 #define SANITY_CANARY_SIZE 8
 
 #if THREAD_SUPPORT
 #if USE_SPINLOCK
 extern atomic_flag sane_cache_flag;
+#if LOCK_PROFILER
+#define LOCK_SANITY_CACHE() \
+    _iso_spinlock_lock_profiled(&sane_cache_flag, ISO_ALLOC_LOCK_SANITY_CACHE, __func__);
+#else
 #define LOCK_SANITY_CACHE() \
     do {                    \
     } while(atomic_flag_test_and_set(&sane_cache_flag));
+#endif
 
 #define UNLOCK_SANITY_CACHE() \
     atomic_flag_clear(&sane_cache_flag);
 #else
 extern pthread_mutex_t sane_cache_mutex;
+#if LOCK_PROFILER
+#define LOCK_SANITY_CACHE() \
+    _iso_mutex_lock_profiled(&sane_cache_mutex, ISO_ALLOC_LOCK_SANITY_CACHE, __func__);
+#else
 #define LOCK_SANITY_CACHE() \
     pthread_mutex_lock(&sane_cache_mutex);
+#endif
 
 #define UNLOCK_SANITY_CACHE() \
     pthread_mutex_unlock(&sane_cache_mutex);
@@ -49,15 +65,18 @@ extern struct uffdio_api _uffd_api;
 extern int64_t _uf_fd;
 #endif
 
-extern int32_t _sane_sampled;
-extern uint8_t _sane_cache[SANE_CACHE_SIZE];
-
 typedef struct {
     void *address;
     size_t orig_size;
     bool right_aligned;
 } _sane_allocation_t;
 
+static_assert(MAX_SANE_SAMPLES <= UINT16_MAX, "MAX_SANE_SAMPLES must fit in a uint16_t");
+
+extern int32_t _sane_sampled;
+extern void *_sane_region;
+extern uint16_t _sane_free_slots[MAX_SANE_SAMPLES];
+extern uint16_t _sane_free_count;
 extern _sane_allocation_t _sane_allocations[MAX_SANE_SAMPLES];
 extern uint64_t _sanity_canary;
 
@@ -66,11 +85,13 @@ INTERNAL_HIDDEN void _iso_alloc_setup_userfaultfd(void);
 INTERNAL_HIDDEN void *_page_fault_thread_handler(void *uf_fd);
 #endif
 
+INTERNAL_HIDDEN void _iso_alloc_initialize_sanity(void);
 INTERNAL_HIDDEN INLINE void write_sanity_canary(void *p);
 INTERNAL_HIDDEN INLINE void check_sanity_canary(_sane_allocation_t *sane_alloc);
 INTERNAL_HIDDEN void *_iso_alloc_sample(const size_t size);
 INTERNAL_HIDDEN int32_t _iso_alloc_free_sane_sample(void *p);
 INTERNAL_HIDDEN int32_t _remove_from_sane_trace(void *p);
+INTERNAL_HIDDEN bool _iso_alloc_maybe_sampled(const void *p);
 INTERNAL_HIDDEN _sane_allocation_t *_get_sane_alloc(void *p);
 #endif
 
@@ -0,0 +1,102 @@
+/* iso_alloc_stats.h - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#pragma once
+
+#include "compiler.h"
+
+#if ALLOC_STATS
+/* Map a chunk size to its power of 2 size class. Sizes
+ * that are not a power of 2 round up to the next class */
+#define STATS_SIZE_CLASS(sz) \
+    ((64 - __builtin_clzll((uint64_t) (sz) - 1)) - 4)
+
+#if THREAD_SUPPORT
+extern __thread iso_alloc_stats_slot_t *_stats_slot;
+#else
+extern iso_alloc_stats_slot_t *_stats_slot;
+#endif
+
+#define STATS_SLOT() \
+    (LIKELY(_stats_slot != NULL) ? _stats_slot : _iso_alloc_stats_slot())
+
+/* Counter updates are relaxed atomics against a slot that
+ * is almost always owned by the calling thread. They never
+ * take a lock and never bounce a shared cache line */
+#define STATS_ADD(field, v) \
+    __atomic_fetch_add(&STATS_SLOT()->field, (uint64_t) (v), __ATOMIC_RELAXED)
+
+#define STATS_SUB(field, v) \
+    __atomic_fetch_sub(&STATS_SLOT()->field, (uint64_t) (v), __ATOMIC_RELAXED)
+
+#define STATS_CHUNK_ALLOC(sz)                                                                        \
+    {                                                                                                \
+        iso_alloc_stats_slot_t *_ss = STATS_SLOT();                                                  \
+        __atomic_fetch_add(&_ss->allocated_bytes, (uint64_t) (sz), __ATOMIC_RELAXED);                \
+        __atomic_fetch_add(&_ss->allocations, 1, __ATOMIC_RELAXED);                                  \
+        __atomic_fetch_add(&_ss->active_chunks[STATS_SIZE_CLASS(sz)], 1, __ATOMIC_RELAXED);          \
+    }
+
+#define STATS_CHUNK_FREE(sz)                                                                         \
+    {                                                                                                \
+        iso_alloc_stats_slot_t *_ss = STATS_SLOT();                                                  \
+        __atomic_fetch_sub(&_ss->allocated_bytes, (uint64_t) (sz), __ATOMIC_RELAXED);                \
+        __atomic_fetch_add(&_ss->frees, 1, __ATOMIC_RELAXED);                                        \
+        __atomic_fetch_sub(&_ss->active_chunks[STATS_SIZE_CLASS(sz)], 1, __ATOMIC_RELAXED);          \
+    }
+
+/* Chunks that are still in use when their zone is
+ * reset or destroyed go away without being freed */
+#define STATS_CHUNKS_RELEASE(sz, n)                                                                  \
+    {                                                                                                \
+        iso_alloc_stats_slot_t *_ss = STATS_SLOT();                                                  \
+        __atomic_fetch_sub(&_ss->allocated_bytes, (uint64_t) (sz) * (n), __ATOMIC_RELAXED);          \
+        __atomic_fetch_sub(&_ss->active_chunks[STATS_SIZE_CLASS(sz)], (uint64_t) (n), __ATOMIC_RELAXED); \
+    }
+
+INTERNAL_HIDDEN iso_alloc_stats_slot_t *_iso_alloc_stats_slot(void);
+INTERNAL_HIDDEN void _iso_alloc_initialize_stats(void);
+#else
+#define STATS_ADD(field, v)
+#define STATS_SUB(field, v)
+#define STATS_CHUNK_ALLOC(sz)
+#define STATS_CHUNK_FREE(sz)
+#define STATS_CHUNKS_RELEASE(sz, n)
+#endif
+
+#if ALLOC_LATENCY
+#if THREAD_SUPPORT
+extern __thread iso_alloc_latency_slot_t *_latency_slot;
+#else
+extern iso_alloc_latency_slot_t *_latency_slot;
+#endif
+
+/* Latency is measured from function entry so time spent
+ * waiting on the root lock is included in the result */
+#define LATENCY_START(t) const uint64_t t = _iso_latency_now();
+#define LATENCY_RECORD(path, t) _iso_latency_record(path, t);
+
+INTERNAL_HIDDEN void _iso_alloc_initialize_latency(void);
+INTERNAL_HIDDEN void _iso_latency_record(int32_t path, uint64_t start);
+#else
+#define LATENCY_START(t)
+#define LATENCY_RECORD(path, t)
+#endif
+
+#if LOCK_PROFILER && THREAD_SUPPORT
+/* The lock macros call these instead of acquiring the
+ * lock directly. The site is the name of the function
+ * taking the lock so long waits can be attributed */
+#if USE_SPINLOCK
+INTERNAL_HIDDEN void _iso_spinlock_lock_profiled(atomic_flag *flag, int32_t lock, const char *site);
+#else
+INTERNAL_HIDDEN void _iso_mutex_lock_profiled(pthread_mutex_t *mutex, int32_t lock, const char *site);
+#endif
+#endif
+
+INTERNAL_HIDDEN uint64_t _iso_latency_now(void);
+INTERNAL_HIDDEN void _iso_alloc_get_lock_profile(iso_alloc_lock_profile_t *profile);
+INTERNAL_HIDDEN void _iso_alloc_get_stats(iso_alloc_stats_t *stats);
+INTERNAL_HIDDEN uint64_t _iso_alloc_resident_bytes(void);
+INTERNAL_HIDDEN void _iso_alloc_get_latency(iso_alloc_latency_t *latency);
+INTERNAL_HIDDEN void _iso_alloc_dump_latency(int32_t fd);
@@ -0,0 +1,71 @@
+/* iso_alloc_trace.h - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#pragma once
+
+#include "compiler.h"
+
+#define TRACE_ENV_STR "ISO_ALLOC_TRACE_FILE_PATH"
+#define TRACE_FILE_PATH "iso_alloc_trace.data"
+#define TRACE_MAGIC 0x45434152544f5349 /* ISOTRACE */
+#define TRACE_VERSION 1
+
+/* Each thread reserves this many events of the trace
+ * file at a time and fills them without synchronization */
+#define TRACE_BUFFER_EVENTS 4096
+
+/* The trace file is created sparse at its maximum size
+ * and truncated to the events recorded when it's closed.
+ * Events past this limit are counted and dropped */
+#define TRACE_MAX_EVENTS (16 * 1024 * 1024)
+
+/* Event types. Slots a thread reserved but never
+ * filled are left zeroed and read as TRACE_OP_NONE */
+#define TRACE_OP_NONE 0
+#define TRACE_OP_MALLOC 1
+#define TRACE_OP_CALLOC 2
+#define TRACE_OP_REALLOC 3
+#define TRACE_OP_FREE 4
+
+/* The trace file is a header followed by an array of
+ * events. Events are grouped by the thread that recorded
+ * them and are put back in program order by sorting on seq */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t event_size;
+    /* Number of threads that recorded events */
+    uint32_t threads;
+    uint32_t pad;
+    /* Events lost because the trace file was full */
+    uint64_t dropped;
+    uint64_t reserved[4];
+} iso_alloc_trace_header_t;
+
+typedef struct {
+    /* Global order of the event. A free takes its sequence
+     * number before the chunk is released and an allocation
+     * after it's returned, so an address is never reused
+     * before the event that released it */
+    uint64_t seq;
+    /* Nanoseconds since the trace file was opened */
+    uint64_t timestamp;
+    /* The chunk address returned by an allocation or passed to
+     * free. It identifies the object until it's freed */
+    uint64_t ptr_id;
+    /* The pointer passed to realloc */
+    uint64_t old_ptr_id;
+    /* Requested size, nmemb * size for calloc */
+    uint64_t size;
+    /* Usable size of the returned chunk, 0 for free */
+    uint32_t chunk_size;
+    uint16_t thread;
+    uint8_t op;
+    uint8_t pad;
+} iso_alloc_trace_event_t;
+
+#if ALLOC_TRACE
+INTERNAL_HIDDEN void _iso_alloc_initialize_trace(void);
+INTERNAL_HIDDEN void _iso_alloc_close_trace(void);
+INTERNAL_HIDDEN void _iso_trace_record(uint8_t op, void *p, void *old, size_t size, size_t chunk_size);
+#endif
@@ -13,6 +13,11 @@
 #define ZONE_BITMAP_NAME ""
 #define INTERNAL_UZ_NAME ""
 #define PRIVATE_UZ_NAME ""
+#define ZONE_REGION_NAME ""
+#define ARENA_SPAN_NAME ""
+#define ARENA_MD_NAME ""
+#define ZONE_SCAN_NAME ""
+#define LEAK_SCAN_NAME ""
 #endif
 
 #if USE_MLOCK
@@ -35,6 +40,7 @@ INTERNAL_HIDDEN size_t next_pow2(size_t sz);
 INTERNAL_HIDDEN uint32_t _log2(uint32_t v);
 
 INTERNAL_HIDDEN int8_t *_fmt(uint64_t n, uint32_t base);
+INTERNAL_HIDDEN size_t _iso_alloc_vsnprintf(char *out, size_t size, const char *f, va_list arg);
 INTERNAL_HIDDEN void _iso_alloc_printf(int32_t fd, const char *f, ...);
 
 #if CPU_PIN
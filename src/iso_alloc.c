@@ -21,7 +21,7 @@ pthread_mutex_t root_busy_mutex;
  * won't be as predictable as .bss
  * If a thread dies with the zone cache populated there
  * is no undefined behavior */
-static __thread _tzc zone_cache[ZONE_CACHE_SZ];
+static __thread _tzc zone_cache[ZONE_CACHE_SZ_MAX];
 static __thread size_t zone_cache_count;
 #else
 /* When not using thread local storage we can mmap
@@ -67,6 +67,10 @@ INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
      * result in a soft page fault */
     MLOCK(&_root, sizeof(iso_alloc_root));
 
+    /* Nothing sized by a runtime tunable can be
+     * created before this point */
+    _iso_alloc_initialize_conf(&_root->conf);
+
 #if ARM_MTE
     if(iso_is_mte_supported() == false) {
         _root->arm_mte_enabled = false;
@@ -78,7 +82,15 @@ INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
     }
 #endif
 
-    _root->zone_retirement_shf = _log2(ZONE_ALLOC_RETIRE);
+#if ALLOC_STATS
+    _iso_alloc_initialize_stats();
+#endif
+
+#if ALLOC_LATENCY
+    _iso_alloc_initialize_latency();
+#endif
+
+    _root->zone_retirement_shf = _log2(_root->conf.zone_alloc_retire);
     _root->zones_size = (MAX_ZONES * sizeof(iso_alloc_zone_t));
     _root->zones_size += (g_page_size * 2);
     _root->zones_size = ROUND_UP_PAGE(_root->zones_size);
@@ -91,15 +103,22 @@ INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
 #endif
     MLOCK(_root->zones, _root->zones_size);
 
-    size_t c = ROUND_UP_PAGE(CHUNK_QUARANTINE_SZ * sizeof(uintptr_t));
+    size_t c = ROUND_UP_PAGE(_root->conf.chunk_quarantine_sz * sizeof(uintptr_t));
     _root->chunk_quarantine = mmap_guarded_rw_pages(c, true, NULL);
 #if __APPLE__
     darwin_reuse(_root->chunk_quarantine, c);
 #endif
     MLOCK(_root->chunk_quarantine, c);
 
+    c = ROUND_UP_PAGE(_root->conf.chunk_quarantine_sz * sizeof(uint16_t));
+    _root->chunk_quarantine_zones = mmap_guarded_rw_pages(c, true, NULL);
+#if __APPLE__
+    darwin_reuse(_root->chunk_quarantine_zones, c);
+#endif
+    MLOCK(_root->chunk_quarantine_zones, c);
+
 #if !THREAD_SUPPORT
-    size_t z = ROUND_UP_PAGE(ZONE_CACHE_SZ * sizeof(_tzc));
+    size_t z = ROUND_UP_PAGE(_root->conf.zone_cache_sz * sizeof(_tzc));
     zone_cache = mmap_guarded_rw_pages(z, true, NULL);
 #if __APPLE__
     darwin_reuse(zone_cache, z);
@@ -113,8 +132,12 @@ INTERNAL_HIDDEN void iso_alloc_initialize_global_root(void) {
 #endif
     MLOCK(_root->chunk_lookup_table, CHUNK_TO_ZONE_TABLE_SZ);
 
-    for(int i = 0; i < DEFAULT_ZONE_COUNT; i++) {
-        if((_iso_new_zone(default_zones[i], true, -1)) == NULL) {
+#if ZONE_REGION
+    _zone_region_initialize();
+#endif
+
+    for(int i = 0; i < _root->conf.default_zone_count; i++) {
+        if((_iso_new_zone(_root->conf.default_zones[i], true, -1)) == NULL) {
             LOG_AND_ABORT("Failed to create a new zone");
         }
     }
@@ -162,6 +185,10 @@ INTERNAL_HIDDEN void _iso_alloc_initialize(void) {
     _initialize_profiler();
 #endif
 
+#if ALLOC_TRACE
+    _iso_alloc_initialize_trace();
+#endif
+
 #if NO_ZERO_ALLOCATIONS
     _root->zero_alloc_page = mmap_pages(g_page_size, false, NULL, PROT_NONE);
 #endif
@@ -175,7 +202,7 @@ INTERNAL_HIDDEN void _iso_alloc_initialize(void) {
 #endif
 
 #if ALLOC_SANITY
-    _sanity_canary = us_rand_uint64(&_root->seed);
+    _iso_alloc_initialize_sanity();
 #endif
 
 #if SIGNAL_HANDLER
@@ -200,12 +227,139 @@ __attribute__((constructor(FIRST_CTOR))) void iso_alloc_ctor(void) {
 }
 #endif
 
+/* Destroys a private zone and every zone that was
+ * linked to it as it grew */
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone(iso_alloc_zone_t *zone) {
+    bool flush = true;
+
+    LOCK_ROOT();
+
+    while(zone != NULL) {
+        iso_alloc_zone_t *next = _next_private_zone(zone);
+        _iso_alloc_destroy_zone_unlocked(zone, flush, true);
+        flush = false;
+        zone = next;
+    }
+
+    UNLOCK_ROOT();
+}
+
+/* Frees every chunk in a private zone and the zones
+ * linked to it in one pass over each bitmap. Nothing is
+ * unmapped, each zone gets new canaries, a new pointer
+ * mask and a new free list as if it was just created */
+INTERNAL_HIDDEN void _iso_alloc_zone_reset(iso_alloc_zone_t *zone, bool release_pages) {
     LOCK_ROOT();
-    _iso_alloc_destroy_zone_unlocked(zone, true, true);
+
+    /* A quarantined chunk from one of these zones
+     * would otherwise be freed again after the reset */
+    flush_chunk_quarantine();
+
+    for(; zone != NULL; zone = _next_private_zone(zone)) {
+        if(zone->af_count != 0) {
+            STATS_CHUNKS_RELEASE(zone->chunk_size, zone->af_count);
+        }
+
+        /* A scan in flight drops what it found in this zone */
+        _zone_scan_invalidate(zone);
+
+        UNMASK_ZONE_PTRS(zone);
+        UNPOISON_ZONE(zone);
+
+        __iso_memset(zone->bitmap_start, 0x0, zone->bitmap_size);
+
+        if(release_pages == true) {
+            dont_need_pages(zone->user_pages_start, ZONE_USER_SIZE);
+        } else {
+#if !ENABLE_ASAN && SANITIZE_CHUNKS
+            __iso_memset(zone->user_pages_start, POISON_BYTE, ZONE_USER_SIZE);
+#endif
+        }
+
+        zone->is_full = false;
+        zone->af_count = 0;
+        zone->next_free_bit_slot = BAD_BIT_SLOT;
+        zone->canary_secret = us_rand_uint64(&_root->seed);
+        zone->pointer_mask = us_rand_uint64(&_root->seed);
+
+#if MEMORY_TAGGING
+        if(zone->tagged == true) {
+            size_t s = ROUND_UP_PAGE(zone->chunk_count * MEM_TAG_SIZE);
+            uint64_t *_mtp = (zone->user_pages_start - g_page_size - s);
+
+            for(uint64_t o = 0; o < (s >> 3); o++) {
+                _mtp[o] = us_rand_uint64(&_root->seed);
+            }
+        }
+#endif
+
+        /* Released pages may not read as zero until the
+         * kernel reclaims them, so canaries are written now */
+        create_canary_chunks(zone, true);
+        fill_free_bit_slots(zone);
+        get_next_free_bit_slot(zone);
+
+        POISON_ZONE(zone);
+        MASK_ZONE_PTRS(zone);
+    }
+
     UNLOCK_ROOT();
 }
 
+/* Private zones grow by linking new zones of the same
+ * size behind the one returned by iso_alloc_new_zone.
+ * The chain is only appended to while the root is
+ * locked and is never shortened until it's destroyed */
+INTERNAL_HIDDEN iso_alloc_zone_t *_next_private_zone(iso_alloc_zone_t *zone) {
+    if(zone->next_private_index == 0) {
+        return NULL;
+    }
+
+    return &_root->zones[zone->next_private_index];
+}
+
+/* Returns the member of a private zone that holds p */
+INTERNAL_HIDDEN iso_alloc_zone_t *_private_zone_member(iso_alloc_zone_t *zone, const void *p) {
+    for(; zone != NULL; zone = _next_private_zone(zone)) {
+        void *user_pages_start = UNMASK_USER_PTR(zone);
+
+        if(user_pages_start <= p && (user_pages_start + ZONE_USER_SIZE) > p) {
+            return zone;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns the first member of a private zone with a
+ * free chunk, adding a new member if they are all full.
+ * Requires the root is locked */
+INTERNAL_HIDDEN iso_alloc_zone_t *_usable_private_zone(iso_alloc_zone_t *zone, size_t size) {
+    iso_alloc_zone_t *last = zone;
+
+    for(; zone != NULL; zone = _next_private_zone(zone)) {
+        if(is_zone_usable(zone, size) != NULL) {
+            return zone;
+        }
+
+        last = zone;
+    }
+
+    if(UNLIKELY(_root->zones_used >= MAX_ZONES)) {
+        return NULL;
+    }
+
+    iso_alloc_zone_t *new_zone = _iso_new_zone(last->chunk_size, false, -1);
+
+    if(UNLIKELY(new_zone == NULL)) {
+        return NULL;
+    }
+
+    last->next_private_index = new_zone->index;
+    LOG("Private zone %d grew by zone %d", last->index, new_zone->index);
+    return new_zone;
+}
+
 INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bool flush_caches, bool replace) {
     if(flush_caches == true) {
         /* We don't need a lock to clear the zone cache
@@ -216,15 +370,27 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bo
         flush_chunk_quarantine();
     }
 
+    /* Leak and verify scans read chunks without the root
+     * lock. Any in flight drop what they found in this zone
+     * and its user pages stay mapped until they finish */
+    _zone_scan_invalidate(zone);
+
+    /* Private zones can be destroyed with chunks still in use */
+    if(zone->af_count != 0) {
+        STATS_CHUNKS_RELEASE(zone->chunk_size, zone->af_count);
+    }
+
     UNMASK_ZONE_PTRS(zone);
     UNPOISON_ZONE(zone);
 
 #if MEMORY_TAGGING
     /* If the zone is tagged then unmap the page holding the tags */
     if(zone->tagged == true) {
+#if !ZONE_REGION
         size_t s = ROUND_UP_PAGE(zone->chunk_count * MEM_TAG_SIZE);
         void *_mtp = (zone->user_pages_start - s - g_page_size);
         munmap(_mtp, g_page_size + s);
+#endif
         zone->tagged = false;
     }
 #endif
@@ -245,7 +411,12 @@ INTERNAL_HIDDEN void _iso_alloc_destroy_zone_unlocked(iso_alloc_zone_t *zone, bo
         }
     }
 
-    munmap(zone->user_pages_start - g_page_size, (ZONE_USER_SIZE + g_page_size * 2));
+#if ZONE_REGION
+    /* The memory tags share the zone's slot */
+    _zone_region_unmap(zone);
+#else
+    _zone_scan_unmap(zone->user_pages_start - g_page_size, (ZONE_USER_SIZE + g_page_size * 2));
+#endif
 
     if(replace == true) {
         _iso_new_zone(zone->chunk_size, true, zone->index);
@@ -267,7 +438,7 @@ INTERNAL_HIDDEN INLINE void clear_zone_cache(void) {
 #if THREAD_SUPPORT
     __iso_memset(zone_cache, 0x0, sizeof(zone_cache));
 #else
-    __iso_memset(zone_cache, 0x0, ZONE_CACHE_SZ * sizeof(_tzc));
+    __iso_memset(zone_cache, 0x0, _root->conf.zone_cache_sz * sizeof(_tzc));
 #endif
 
     zone_cache_count = 0;
@@ -275,8 +446,13 @@ INTERNAL_HIDDEN INLINE void clear_zone_cache(void) {
 
 /* Select a random number of chunks to be canaries. These
  * can be verified anytime by calling check_canary()
- * or check_canary_no_abort() */
-INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone) {
+ * or check_canary_no_abort(). Unless write is set only
+ * the bitmap is changed, the canary itself is written the
+ * first time a chunk in the same bitmap qword is handed
+ * out. This way creating a zone doesn't fault in any of
+ * its user pages. Until then the canary must read as 0,
+ * which is only true of freshly mapped pages */
+INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone, bool write) {
 #if ENABLE_ASAN || DISABLE_CANARY
     return;
 #else
@@ -317,9 +493,12 @@ INTERNAL_HIDDEN void create_canary_chunks(iso_alloc_zone_t *zone) {
         /* Set the 1st and 2nd bits as 1 */
         SET_BIT(bm[bm_idx], 0);
         SET_BIT(bm[bm_idx], 1);
-        bit_slot = (bm_idx << BITS_PER_QWORD_SHIFT);
-        void *p = POINTER_FROM_BITSLOT(zone, bit_slot);
-        write_canary(zone, p);
+
+        if(write == true) {
+            bit_slot = (bm_idx << BITS_PER_QWORD_SHIFT);
+            void *p = POINTER_FROM_BITSLOT(zone, bit_slot);
+            write_canary(zone, p);
+        }
     }
 #endif
 }
@@ -374,6 +553,17 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal, int3
     new_zone->bitmap_size = (bitmap_size > sizeof(bitmap_index_t)) ? bitmap_size : sizeof(bitmap_index_t);
     new_zone->max_bitmap_idx = (new_zone->bitmap_size >> 3);
 
+    /* Chunk sizes that are not a power of 2 don't divide the
+     * zone into a multiple of 32 chunks. The bitmap is sized
+     * in whole qwords so any chunks past the last one it can
+     * track are never used. Otherwise the neighbor canary
+     * checks in iso_free_chunk_from_zone read past the bitmap */
+    const uint64_t bitmap_chunks = ((uint64_t) new_zone->max_bitmap_idx * BITS_PER_QWORD) / BITS_PER_CHUNK;
+
+    if(new_zone->chunk_count > bitmap_chunks) {
+        new_zone->chunk_count = bitmap_chunks;
+    }
+
     if(g_page_size >= new_zone->bitmap_size) {
         const int sbsi = (sizeof(small_bitmap_sizes) / sizeof(int)) - 1;
 
@@ -439,7 +629,15 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal, int3
 #endif
     void *p = NULL;
 
+#if ZONE_REGION
+    int32_t prot = PROT_READ | PROT_WRITE;
 #if ARM_MTE
+    if(_root->arm_mte_enabled == true) {
+        prot |= PROT_MTE;
+    }
+#endif
+    p = _zone_region_map(total_size, (uint16_t) (new_zone - _root->zones), prot, name);
+#elif ARM_MTE
     if(_root->arm_mte_enabled == true) {
         p = mmap_rw_mte_pages(total_size, false, name);
     } else {
@@ -492,7 +690,7 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal, int3
     create_guard_page(user_pages_guard_above);
 
     /* We created a new zone, we did not replace a retired one */
-    if(index > 0) {
+    if(index >= 0) {
         new_zone->index = index;
     } else {
         new_zone->index = _root->zones_used;
@@ -501,7 +699,7 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal, int3
     new_zone->canary_secret = us_rand_uint64(&_root->seed);
     new_zone->pointer_mask = us_rand_uint64(&_root->seed);
 
-    create_canary_chunks(new_zone);
+    create_canary_chunks(new_zone, false);
 
     /* When we create a new zone its an opportunity to
      * populate our free list cache with random entries */
@@ -543,6 +741,8 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_new_zone(size_t size, bool internal, int3
         _root->zones_used++;
     }
 
+    STATS_ADD(zone_creations, 1);
+
     return new_zone;
 }
 
@@ -815,6 +1015,18 @@ INTERNAL_HIDDEN FLATTEN iso_alloc_zone_t *is_zone_usable(iso_alloc_zone_t *zone,
         return NULL;
     }
 
+#if ADAPTIVE_ZONES
+    /* Zones can change size when they are reused for a
+     * hot size so a thread's zone cache may be out of date */
+    if(UNLIKELY(zone->chunk_size < size)) {
+        return NULL;
+    }
+
+    if(UNLIKELY(zone->released == true)) {
+        _iso_alloc_destroy_zone_unlocked(zone, false, true);
+    }
+#endif
+
     if(zone->next_free_bit_slot != BAD_BIT_SLOT) {
         return zone;
     }
@@ -924,9 +1136,15 @@ INTERNAL_HIDDEN iso_alloc_zone_t *find_suitable_zone(size_t size) {
      * program runs the more likely we will fail this
      * fast path as default zones may fill up */
     if(orig_size >= ZONE_512 && orig_size <= MAX_DEFAULT_ZONE_SZ) {
-        i = DEFAULT_ZONE_COUNT >> 1;
+#if ADAPTIVE_ZONES
+        /* The fast path relies on default zones being sorted
+         * by size, which replacing one of them undoes */
+        i = (_root->default_zones_replaced == true) ? 0 : _root->conf.default_zone_count >> 1;
+#else
+        i = _root->conf.default_zone_count >> 1;
+#endif
     } else if(orig_size > MAX_DEFAULT_ZONE_SZ) {
-        i = DEFAULT_ZONE_COUNT;
+        i = _root->conf.default_zone_count;
     }
 #else
     i = 0;
@@ -973,11 +1191,20 @@ INTERNAL_HIDDEN INLINE ASSUME_ALIGNED void *_iso_alloc_bitslot_from_zone(bit_slo
                       zone->index, zone->chunk_size, p, &bm[dwords_to_bit_slot], bitslot, which_bit);
     }
 
+#if !ENABLE_ASAN && !DISABLE_CANARY
+    /* This is the first chunk handed out from this qword
+     * so its canary chunk is written now. The canary is
+     * never the chunk being allocated, that aborted above */
+    if(UNLIKELY(b == CANARY_UNWRITTEN_QWORD)) {
+        void *canary = zone->user_pages_start + ((dwords_to_bit_slot << BITS_PER_QWORD_SHIFT) >> 1) * zone->chunk_size;
+        check_unwritten_canary(zone, canary);
+        write_canary(zone, canary);
+    }
+
     /* This chunk was either previously allocated and free'd
      * or it's a canary chunk. In either case this means it
      * has a canary written in its first qword. Here we check
      * that canary and abort if its been corrupted */
-#if !ENABLE_ASAN && !DISABLE_CANARY
     if((GET_BIT(b, (which_bit + 1))) == 1) {
         check_canary(zone, p);
         *(uint64_t *) p = 0x0;
@@ -1013,14 +1240,16 @@ INTERNAL_HIDDEN INLINE void populate_zone_cache(iso_alloc_zone_t *zone) {
         return;
     }
 
-    if(_zone_cache_count < ZONE_CACHE_SZ) {
+    const size_t zone_cache_sz = _root->conf.zone_cache_sz;
+
+    if(_zone_cache_count < zone_cache_sz) {
         tzc[_zone_cache_count].zone = zone;
         tzc[_zone_cache_count].chunk_size = zone->chunk_size;
         _zone_cache_count++;
     } else {
         /* Evict oldest entry (index 0) via FIFO: shift all entries down by one */
-        __iso_memmove(&tzc[0], &tzc[1], (ZONE_CACHE_SZ - 1) * sizeof(_tzc));
-        _zone_cache_count = ZONE_CACHE_SZ - 1;
+        __iso_memmove(&tzc[0], &tzc[1], (zone_cache_sz - 1) * sizeof(_tzc));
+        _zone_cache_count = zone_cache_sz - 1;
         tzc[_zone_cache_count].zone = zone;
         tzc[_zone_cache_count].chunk_size = zone->chunk_size;
         _zone_cache_count++;
@@ -1074,6 +1303,29 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t s
         LOG_AND_ABORT("Private zone %d cannot hold chunks of size %d, only %d", zone->index, size, zone->chunk_size);
     }
 
+#if HEAP_PROFILER
+    /* The countdown and counters are thread local. Only
+     * a sampled allocation reads shared state and none
+     * of it needs the root lock */
+    if(LIKELY(_root != NULL)) {
+        _iso_alloc_profile(size);
+    }
+
+    /* A periodic snapshot marked due by a sample is
+     * written here, before the root is locked */
+    if(UNLIKELY(__atomic_load_n(&_profiler_snapshot_due, __ATOMIC_RELAXED)) &&
+       __atomic_exchange_n(&_profiler_snapshot_due, false, __ATOMIC_ACQ_REL)) {
+        _iso_write_profile();
+    }
+#endif
+
+    LATENCY_START(latency_start);
+#if ALLOC_LATENCY
+    /* Allocations from private zones are recorded as
+     * cache hits because they never scan for a zone */
+    int32_t latency_path = ISO_ALLOC_LATENCY_CACHE_HIT;
+#endif
+
     /* Pre-lock hot path: scan the thread-local zone cache using only
      * thread-local data (chunk_size comparison and pointer read). No
      * zone struct fields are dereferenced here. Validation happens
@@ -1118,8 +1370,9 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t s
     }
 
 #if ALLOC_SANITY
-    /* We only sample if a zone was not directly passed */
-    if(zone != NULL) {
+    /* We only sample if a zone was not directly passed,
+     * a sample can't be freed back to a private zone */
+    if(zone == NULL) {
         if(size < g_page_size && _sane_sampled < MAX_SANE_SAMPLES) {
             /* If we chose to sample this allocation then
              * _iso_alloc_sample will call UNLOCK_ROOT() */
@@ -1132,15 +1385,26 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t s
     }
 #endif
 
-#if HEAP_PROFILER
-    _iso_alloc_profile(size);
-#endif
-
     /* Allocation requests of SMALL_SIZE_MAX bytes or larger are
      * handled by the 'big allocation' path. */
     if(LIKELY(size <= SMALL_SIZE_MAX)) {
 #if FUZZ_MODE
         _verify_all_zones();
+#endif
+#if INCREMENTAL_VERIFY
+        _incremental_verify_record();
+#endif
+#if ADAPTIVE_ZONES
+        if(LIKELY(zone == NULL)) {
+            _adaptive_zones_record(size);
+
+            /* Prefer a zone made for this exact size over a
+             * larger zone that happens to be in the cache */
+            if(cached_zone != NULL && cached_zone->chunk_size != size &&
+               _root->zone_lookup_table[SZ_TO_ZONE_LOOKUP_IDX(size)] != 0) {
+                cached_zone = NULL;
+            }
+        }
 #endif
         if(LIKELY(zone == NULL)) {
             /* Hot Path: Validate the zone candidate selected pre-lock.
@@ -1159,6 +1423,9 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t s
          * zones we cached above */
         if(zone == NULL) {
             zone = find_suitable_zone(size);
+#if ALLOC_LATENCY
+            latency_path = ISO_ALLOC_LATENCY_SLOW_SCAN;
+#endif
         }
 
         if(LIKELY(zone != NULL)) {
@@ -1166,7 +1433,7 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t s
              * if it's a private zone. If we chose this zone
              * then its guaranteed to already be usable */
             if(zone->internal == false) {
-                zone = is_zone_usable(zone, size);
+                zone = _usable_private_zone(zone, size);
 
                 if(zone == NULL) {
                     UNLOCK_ROOT();
@@ -1195,6 +1462,10 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t s
                 LOG_AND_ABORT("Failed to create a zone for allocation of %zu bytes", size);
             }
 
+#if ALLOC_LATENCY
+            latency_path = ISO_ALLOC_LATENCY_NEW_ZONE;
+#endif
+
             /* This is a brand new zone, so the fast path
              * should always work. Abort if it doesn't */
             free_bit_slot = zone->next_free_bit_slot;
@@ -1210,8 +1481,10 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_alloc(iso_alloc_zone_t *zone, size_t s
         void *p = _iso_alloc_bitslot_from_zone(free_bit_slot, zone);
 
         MASK_ZONE_PTRS(zone);
+        STATS_CHUNK_ALLOC(zone->chunk_size);
         UNLOCK_ROOT();
         populate_zone_cache(zone);
+        LATENCY_RECORD(latency_path, latency_start);
 
 #if ARM_MTE
         if(_root->arm_mte_enabled == true) {
@@ -1287,12 +1560,55 @@ INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_bitmap_range(const void *restric
     return NULL;
 }
 
+/* Finds the zone holding a chunk using the size it was
+ * allocated with. Chunks usually live in the first zone
+ * of the size class chain so this avoids the thread cache
+ * and full zone scans. Falls back to iso_find_zone_range
+ * for chunks that were placed in a larger zone */
+INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_by_size(void *restrict p, size_t size) {
+#if ARM_MTE
+    if(_root->arm_mte_enabled == true) {
+        p = iso_mte_untag_ptr(p);
+    }
+#endif
+
+#if ZONE_REGION
+    /* The region lookup is already O(1) */
+    return _zone_region_find(p);
+#else
+    if(size < SMALLEST_CHUNK_SZ) {
+        size = SMALLEST_CHUNK_SZ;
+    } else if((size % SZ_ALIGNMENT) != 0) {
+        size = ALIGN_SZ_UP(size);
+    }
+
+    int32_t i = _root->zone_lookup_table[SZ_TO_ZONE_LOOKUP_IDX(size)];
+    const size_t zones_used = _root->zones_used;
+
+    while(i != 0 && i < zones_used) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+        void *user_pages_start = UNMASK_USER_PTR(zone);
+
+        if(LIKELY(user_pages_start <= p && (user_pages_start + ZONE_USER_SIZE) > p)) {
+            return zone;
+        }
+
+        i = zone->next_sz_index;
+    }
+
+    return iso_find_zone_range(p);
+#endif
+}
+
 INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_range(void *restrict p) {
 #if ARM_MTE
     if(_root->arm_mte_enabled == true) {
         p = iso_mte_untag_ptr(p);
     }
 #endif
+#if ZONE_REGION
+    return _zone_region_find(p);
+#else
     iso_alloc_zone_t *zone = search_chunk_lookup_table(p);
     void *user_pages_start = UNMASK_USER_PTR(zone);
 
@@ -1327,6 +1643,7 @@ INTERNAL_HIDDEN iso_alloc_zone_t *iso_find_zone_range(void *restrict p) {
     }
 
     return NULL;
+#endif
 }
 
 /* Checking canaries under ASAN mode is not trivial. ASAN
@@ -1341,6 +1658,14 @@ INTERNAL_HIDDEN int64_t check_canary_no_abort(iso_alloc_zone_t *zone, const void
     return OK;
 }
 
+INTERNAL_HIDDEN int64_t check_unwritten_canary_no_abort(iso_alloc_zone_t *zone, const void *p) {
+    return OK;
+}
+
+INTERNAL_HIDDEN INLINE void check_unwritten_canary(iso_alloc_zone_t *zone, const void *p) {
+    return;
+}
+
 INTERNAL_HIDDEN INLINE void write_canary(iso_alloc_zone_t *zone, void *p) {
     return;
 }
@@ -1414,6 +1739,29 @@ INTERNAL_HIDDEN INLINE void check_canary(iso_alloc_zone_t *zone, const void *p)
                       p, zone->index, zone->chunk_size, v, canary);
     }
 }
+
+/* A canary chunk in a qword that has never been used
+ * still reads as 0. It can also hold a canary if it was
+ * permanently freed before anything else in its qword
+ * was used. Anything else was written by an overflow */
+INTERNAL_HIDDEN int64_t check_unwritten_canary_no_abort(iso_alloc_zone_t *zone, const void *p) {
+    const uint64_t canary = (zone->canary_secret ^ (uint64_t) p) & CANARY_VALIDATE_MASK;
+    const uint64_t a = *((uint64_t *) p);
+    const uint64_t b = *((uint64_t *) (p + zone->chunk_size - sizeof(uint64_t)));
+
+    if(UNLIKELY((a != 0 || b != 0) && (a != canary || b != canary))) {
+        LOG("Unwritten canary chunk 0x%p in zone[%d] has been corrupted! Values: 0x%x 0x%x", p, zone->index, a, b);
+        return ERR;
+    }
+
+    return OK;
+}
+
+INTERNAL_HIDDEN INLINE void check_unwritten_canary(iso_alloc_zone_t *zone, const void *p) {
+    if(UNLIKELY(check_unwritten_canary_no_abort(zone, p) == ERR)) {
+        LOG_AND_ABORT("Unwritten canary chunk 0x%p in zone[%d][%d byte chunks] has been corrupted!", p, zone->index, zone->chunk_size);
+    }
+}
 #endif
 
 INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *restrict p, bool permanent) {
@@ -1433,7 +1781,7 @@ INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *rest
                       chunk_offset, p, zone->index, chunk_size, (chunk_offset & (chunk_size - 1)));
     }
 
-    if(UNLIKELY(dwords_to_bit_slot > zone->max_bitmap_idx)) {
+    if(UNLIKELY(dwords_to_bit_slot >= zone->max_bitmap_idx)) {
         LOG_AND_ABORT("Cannot calculate this chunks location in the bitmap 0x%p", p);
     }
 
@@ -1471,6 +1819,7 @@ INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *rest
     bm[dwords_to_bit_slot] = b;
 
     zone->af_count--;
+    STATS_CHUNK_FREE(chunk_size);
 
     /* Now that we have free'd this chunk lets validate the
      * chunks before and after it. If they were previously
@@ -1481,7 +1830,13 @@ INTERNAL_HIDDEN void iso_free_chunk_from_zone(iso_alloc_zone_t *zone, void *rest
 
     if((chunk_number + 1) != zone->chunk_count) {
         const bit_slot_t bit_slot_over = ((chunk_number + 1) << BITS_PER_CHUNK_SHIFT);
-        if((GET_BIT(bm[(bit_slot_over >> BITS_PER_QWORD_SHIFT)], (WHICH_BIT(bit_slot_over) + 1))) == 1) {
+        const bitmap_index_t b_over = bm[(bit_slot_over >> BITS_PER_QWORD_SHIFT)];
+
+        /* The next chunk may be the canary of a
+         * qword that has never been used */
+        if(UNLIKELY(b_over == CANARY_UNWRITTEN_QWORD)) {
+            check_unwritten_canary(zone, p + chunk_size);
+        } else if((GET_BIT(b_over, (WHICH_BIT(bit_slot_over) + 1))) == 1) {
             check_canary(zone, p + chunk_size);
         }
     }
@@ -1512,7 +1867,14 @@ INTERNAL_HIDDEN void _iso_free_from_zone(void *p, iso_alloc_zone_t *zone, bool p
 #endif
 
     LOCK_ROOT();
-    _iso_free_internal_unlocked(p, permanent, zone);
+
+    iso_alloc_zone_t *member = _private_zone_member(zone, p);
+
+    if(UNLIKELY(member == NULL)) {
+        LOG_AND_ABORT("Chunk at 0x%p does not belong to zone[%d]", p, zone->index);
+    }
+
+    _iso_free_internal_unlocked(p, permanent, member);
     UNLOCK_ROOT();
 }
 
@@ -1530,10 +1892,15 @@ INTERNAL_HIDDEN INLINE void flush_chunk_quarantine(void) {
     /* Free all the thread quarantined chunks */
     size_t chunk_quarantine_count = _root->chunk_quarantine_count;
     for(int64_t i = 0; i < chunk_quarantine_count; i++) {
-        _iso_free_internal_unlocked((void *) _root->chunk_quarantine[i], false, NULL);
+        /* A zone can't be destroyed or replaced while it has
+         * chunks in the quarantine, a recorded index is valid */
+        const uint16_t zi = _root->chunk_quarantine_zones[i];
+        iso_alloc_zone_t *zone = (zi != 0) ? &_root->zones[zi - 1] : NULL;
+        _iso_free_internal_unlocked((void *) _root->chunk_quarantine[i], false, zone);
     }
 
-    __iso_memset(_root->chunk_quarantine, 0x0, CHUNK_QUARANTINE_SZ * sizeof(uintptr_t));
+    __iso_memset(_root->chunk_quarantine, 0x0, _root->conf.chunk_quarantine_sz * sizeof(uintptr_t));
+    __iso_memset(_root->chunk_quarantine_zones, 0x0, _root->conf.chunk_quarantine_sz * sizeof(uint16_t));
     _root->chunk_quarantine_count = 0;
 }
 
@@ -1581,9 +1948,10 @@ INTERNAL_HIDDEN void _iso_free(void *p, bool permanent) {
         return;
     }
 
+    LATENCY_START(latency_start);
     LOCK_ROOT();
 
-    if(_root->chunk_quarantine_count >= CHUNK_QUARANTINE_SZ) {
+    if(_root->chunk_quarantine_count >= _root->conf.chunk_quarantine_sz) {
         /* If the quarantine is full that means we got the
          * lock before our handle_quarantine_thread could.
          * Flushing the quarantine has the same perf cost */
@@ -1591,9 +1959,11 @@ INTERNAL_HIDDEN void _iso_free(void *p, bool permanent) {
     }
 
     _root->chunk_quarantine[_root->chunk_quarantine_count] = (uintptr_t) p;
+    _root->chunk_quarantine_zones[_root->chunk_quarantine_count] = 0;
     _root->chunk_quarantine_count++;
 
     UNLOCK_ROOT();
+    LATENCY_RECORD(ISO_ALLOC_LATENCY_FREE, latency_start);
 }
 
 INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size) {
@@ -1638,9 +2008,18 @@ INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size) {
         return;
     }
 
+    if(UNLIKELY(IS_ALIGNED((uintptr_t) p) != 0)) {
+        LOG_AND_ABORT("Chunk at 0x%p is not %d byte aligned", p, SZ_ALIGNMENT);
+    }
+
+#if HEAP_PROFILER
+    _iso_free_profile();
+#endif
+
+    LATENCY_START(latency_start);
     LOCK_ROOT();
 
-    iso_alloc_zone_t *zone = iso_find_zone_range(p);
+    iso_alloc_zone_t *zone = iso_find_zone_by_size(p, size);
 
     if(UNLIKELY(zone == NULL)) {
 #if ABORT_ON_UNOWNED_PTR
@@ -1658,8 +2037,26 @@ INTERNAL_HIDDEN void _iso_free_size(void *p, size_t size) {
         LOG_AND_ABORT("Invalid size (expected %d, got %d) for chunk 0x%p", zone->chunk_size, size, p);
     }
 
-    _iso_free_internal_unlocked(p, false, zone);
+#if ARM_MTE
+    if(_root->arm_mte_enabled == true) {
+        p = (void *) iso_mte_create_tag(p, (1ULL << iso_mte_extract_tag(p)));
+        iso_mte_set_tag(p);
+    }
+#endif
+
+    /* The size has been validated, from here on this
+     * chunk is quarantined exactly like _iso_free */
+    if(_root->chunk_quarantine_count >= _root->conf.chunk_quarantine_sz) {
+        flush_chunk_quarantine();
+    }
+
+    /* The zone is kept so the flush doesn't look it up again */
+    _root->chunk_quarantine[_root->chunk_quarantine_count] = (uintptr_t) p;
+    _root->chunk_quarantine_zones[_root->chunk_quarantine_count] = zone->index + 1;
+    _root->chunk_quarantine_count++;
+
     UNLOCK_ROOT();
+    LATENCY_RECORD(ISO_ALLOC_LATENCY_FREE, latency_start);
 }
 
 INTERNAL_HIDDEN void _iso_free_internal(void *p, bool permanent) {
@@ -1686,10 +2083,179 @@ INTERNAL_HIDDEN bool _is_zone_retired(iso_alloc_zone_t *zone) {
     return false;
 }
 
+#if ADAPTIVE_ZONES
+/* Removes a zone from the zone lookup table list for
+ * its chunk size so the zone can hold another size */
+INTERNAL_HIDDEN void _unlink_zone_lookup(iso_alloc_zone_t *zone) {
+    zone_lookup_table_t *head = &_root->zone_lookup_table[SZ_TO_ZONE_LOOKUP_IDX(zone->chunk_size)];
+
+    if(*head == zone->index) {
+        *head = zone->next_sz_index;
+    } else {
+        for(uint16_t i = *head; i != 0; i = _root->zones[i].next_sz_index) {
+            if(_root->zones[i].next_sz_index == zone->index) {
+                _root->zones[i].next_sz_index = zone->next_sz_index;
+                break;
+            }
+        }
+    }
+
+    zone->next_sz_index = 0;
+}
+
+/* Returns the user pages of an empty zone to the kernel.
+ * Canary chunks would read back as zero so the bitmap is
+ * cleared with them. The zone is replaced by a new one with
+ * new canaries the next time is_zone_usable() considers it */
+INTERNAL_HIDDEN void _release_zone(iso_alloc_zone_t *zone) {
+    _zone_scan_invalidate(zone);
+    UNMASK_ZONE_PTRS(zone);
+    __iso_memset(zone->bitmap_start, 0x0, zone->bitmap_size);
+    /* MADV_FREE would leave the pages counted in RSS
+     * until the kernel is under memory pressure */
+    madvise(zone->user_pages_start, ZONE_USER_SIZE, MADV_DONTNEED);
+    zone->released = true;
+    MASK_ZONE_PTRS(zone);
+    LOG("Released zone[%d] for chunk size %d", zone->index, zone->chunk_size);
+}
+
+INTERNAL_HIDDEN bool _zone_size_exists(size_t size) {
+    for(uint16_t i = 0; i < _root->zones_used; i++) {
+        if(_root->zones[i].internal == true && _root->zones[i].chunk_size == size) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* A default zone is cold if it holds no chunks and
+ * wasn't allocated from since the last review */
+INTERNAL_HIDDEN bool _is_zone_cold(uint32_t i) {
+    iso_alloc_zone_t *zone = &_root->zones[i];
+    return zone->internal == true && zone->af_count == 0 && zone->alloc_count == _root->adaptive_zone_allocs[i];
+}
+
+/* Reviews the default zones once per adaptive_zones_window
+ * small allocations. Hot sizes without a zone of their own
+ * get one, taking the place of a cold default zone when
+ * there is one. Cold default zones left over are released */
+INTERNAL_HIDDEN void _adapt_zones(void) {
+    const uint32_t hot = _root->conf.adaptive_zones_window >> ADAPTIVE_ZONES_HOT_SHIFT;
+    const uint32_t default_zone_count = _root->conf.default_zone_count;
+    const size_t slots = sizeof(_root->adaptive_sizes) / sizeof(uint32_t);
+
+    /* One bit per adaptive_sizes slot that already has an
+     * internal zone, built with a single pass over the zones */
+    uint64_t sizes[((sizeof(_root->adaptive_sizes) / sizeof(uint32_t)) + 63) / 64] = {0};
+
+    for(uint16_t i = 0; i < _root->zones_used; i++) {
+        const iso_alloc_zone_t *zone = &_root->zones[i];
+
+        if(zone->internal == true && zone->chunk_size <= MAX_DEFAULT_ZONE_SZ) {
+            SET_BIT(sizes[(zone->chunk_size / SZ_ALIGNMENT) / 64], (zone->chunk_size / SZ_ALIGNMENT) % 64);
+        }
+    }
+
+    /* An index of 0 in the zone lookup table means there
+     * is no zone of that size, so zone 0 is never reused
+     * for a hot size. It would only be found by a scan */
+    uint32_t next_cold = 1;
+
+    /* Quarantined chunks still count against af_count.
+     * Every thread's zone cache may still point at a zone
+     * that is replaced or released here. Those caches can't
+     * be cleared from this thread, instead is_zone_usable()
+     * checks the chunk size and released flag of a cached
+     * zone under the root lock before it is used */
+    flush_chunk_quarantine();
+
+    for(size_t i = 0; i < slots; i++) {
+        size_t size = i * SZ_ALIGNMENT;
+
+        if(size < SMALLEST_CHUNK_SZ) {
+            size = SMALLEST_CHUNK_SZ;
+        }
+
+        const size_t slot = size / SZ_ALIGNMENT;
+
+        if(_root->adaptive_sizes[i] <= hot || (GET_BIT(sizes[slot / 64], slot % 64)) == 1) {
+            continue;
+        }
+
+        while(next_cold < default_zone_count && _is_zone_cold(next_cold) == false) {
+            next_cold++;
+        }
+
+        if(next_cold < default_zone_count) {
+            iso_alloc_zone_t *zone = &_root->zones[next_cold];
+            LOG("Replacing zone[%d] for chunk size %d with hot size %d", zone->index, zone->chunk_size, size);
+            const uint32_t old_size = zone->chunk_size;
+            _unlink_zone_lookup(zone);
+            _iso_alloc_destroy_zone_unlocked(zone, false, false);
+            _iso_new_zone(size, true, next_cold);
+            _root->default_zones_replaced = true;
+            next_cold++;
+
+            /* The replaced size may have had no other zone */
+            if(old_size <= MAX_DEFAULT_ZONE_SZ && _zone_size_exists(old_size) == false) {
+                UNSET_BIT(sizes[(old_size / SZ_ALIGNMENT) / 64], (old_size / SZ_ALIGNMENT) % 64);
+            }
+        } else if(_root->zones_used < MAX_ZONES) {
+            LOG("Creating a zone for hot size %d", size);
+            _iso_new_zone(size, true, -1);
+        } else {
+            continue;
+        }
+
+        SET_BIT(sizes[slot / 64], slot % 64);
+    }
+
+    for(uint32_t i = (next_cold == 1) ? 0 : next_cold; i < default_zone_count; i++) {
+        if(_root->zones[i].released == false && _is_zone_cold(i) == true) {
+            _release_zone(&_root->zones[i]);
+        }
+    }
+
+    for(uint32_t i = 0; i < default_zone_count; i++) {
+        _root->adaptive_zone_allocs[i] = _root->zones[i].alloc_count;
+    }
+
+    __iso_memset(_root->adaptive_sizes, 0x0, sizeof(_root->adaptive_sizes));
+    _root->adaptive_allocs = 0;
+}
+
+/* Called with the root locked for every small
+ * allocation that doesn't target a private zone */
+INTERNAL_HIDDEN INLINE void _adaptive_zones_record(size_t size) {
+    if(size <= MAX_DEFAULT_ZONE_SZ) {
+        _root->adaptive_sizes[size / SZ_ALIGNMENT]++;
+    }
+
+    if(UNLIKELY(++_root->adaptive_allocs >= _root->conf.adaptive_zones_window)) {
+        _adapt_zones();
+    }
+}
+#endif
+
+#if INCREMENTAL_VERIFY
+/* Called with the root locked for every small
+ * allocation and every free */
+INTERNAL_HIDDEN INLINE void _incremental_verify_record(void) {
+    if(UNLIKELY(++_root->verify_calls >= VERIFY_INTERVAL)) {
+        _root->verify_calls = 0;
+        _verify_zones_incremental();
+    }
+}
+#endif
+
 INTERNAL_HIDDEN iso_alloc_zone_t *_iso_free_internal_unlocked(void *p, bool permanent, iso_alloc_zone_t *zone) {
 #if FUZZ_MODE
     _verify_all_zones();
 #endif
+#if INCREMENTAL_VERIFY
+    _incremental_verify_record();
+#endif
 
     if(LIKELY(zone == NULL)) {
         zone = iso_find_zone_range(p);
@@ -1703,6 +2269,7 @@ INTERNAL_HIDDEN iso_alloc_zone_t *_iso_free_internal_unlocked(void *p, bool perm
          * chunks in its lifetime then we destroy and replace it with
          * a new zone */
         if(UNLIKELY(_is_zone_retired(zone))) {
+            STATS_ADD(zone_retirements, 1);
             _iso_alloc_destroy_zone_unlocked(zone, false, true);
         }
 
@@ -1779,19 +2346,23 @@ INTERNAL_HIDDEN iso_alloc_big_zone_t *iso_find_big_zone(void *p, bool remove) {
         check_big_canary(big_zone);
         /* Only an exact match of the address is valid */
         if(p == big_zone->user_pages_start) {
-            if(remove == true && prev != NULL) {
-                prev->next = big_zone->next;
-            }
+            /* A lookup without removal must leave the used list intact */
+            if(remove == true) {
+                if(prev != NULL) {
+                    prev->next = big_zone->next;
+                }
 
-            _root->big_zone_used_count--;
+                _root->big_zone_used_count--;
 
-            /* If this is our first iteration then we are returning the
-             * used list head. Set its new value to the next entry */
-            if(prev == NULL) {
-                _root->big_zone_used = big_zone->next;
+                /* If this is our first iteration then we are returning the
+                 * used list head. Set its new value to the next entry */
+                if(prev == NULL) {
+                    _root->big_zone_used = big_zone->next;
+                }
+
+                big_zone->next = NULL;
             }
 
-            big_zone->next = NULL;
             UNLOCK_BIG_ZONE_USED();
             return big_zone;
         }
@@ -1818,6 +2389,9 @@ INTERNAL_HIDDEN void iso_free_big_zone(iso_alloc_big_zone_t *big_zone, bool perm
         LOG_AND_ABORT("Double free of big zone 0x%p has been detected!", big_zone);
     }
 
+    STATS_SUB(big_allocations, 1);
+    STATS_SUB(big_allocated_bytes, big_zone->size);
+
 #if !ENABLE_ASAN && SANITIZE_CHUNKS
     __iso_memset(big_zone->user_pages_start, POISON_BYTE, big_zone->size);
 #endif
@@ -1827,8 +2401,8 @@ INTERNAL_HIDDEN void iso_free_big_zone(iso_alloc_big_zone_t *big_zone, bool perm
      * if we aren't at max entries in the free list */
     LOCK_BIG_ZONE_FREE();
 
-    if(LIKELY(permanent == false) && _root->big_zone_free_count < BIG_ZONE_MAX_FREE_LIST &&
-       big_zone->ttl < BIG_ZONE_ALLOC_RETIRE) {
+    if(LIKELY(permanent == false) && _root->big_zone_free_count < (int32_t) _root->conf.big_zone_max_free_list &&
+       big_zone->ttl < _root->conf.big_zone_alloc_retire) {
         POISON_BIG_ZONE(big_zone);
         big_zone->free = true;
         dont_need_pages(big_zone->user_pages_start, big_zone->size);
@@ -1856,6 +2430,12 @@ INTERNAL_HIDDEN void iso_free_big_zone(iso_alloc_big_zone_t *big_zone, bool perm
         /* Big zone meta data is at a random offset from its base page */
         mprotect_pages(((void *) ROUND_DOWN_PAGE((uintptr_t) big_zone)), g_page_size, PROT_NONE);
     } else {
+#if ALLOC_STATS
+        if(big_zone->ttl >= _root->conf.big_zone_alloc_retire) {
+            STATS_ADD(big_zone_retirements, 1);
+        }
+#endif
+
 #if BIG_ZONE_GUARD
         /* Free the user pages first */
         unmap_guarded_pages(big_zone->user_pages_start, big_zone->size);
@@ -1885,6 +2465,7 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_big_alloc(size_t size) {
     size = new_size;
     iso_alloc_big_zone_t *prev = NULL;
 
+    LATENCY_START(latency_start);
     LOCK_BIG_ZONE_FREE();
 
     /* There are two big zone lists, one for free chunks and a
@@ -1912,7 +2493,7 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_big_alloc(size_t size) {
             check_big_canary(big);
 
             /* We found a suitable big zone we can reuse */
-            if(big->size >= size && (big->size - size) <= BIG_ZONE_WASTE * 2) {
+            if(big->size >= size && (big->size - size) <= (size_t) _root->conf.big_zone_waste * 2) {
                 big->free = false;
                 _root->big_zone_free_count--;
                 UNPOISON_BIG_ZONE(big);
@@ -1937,6 +2518,9 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_big_alloc(size_t size) {
                 _root->big_zone_used_count++;
 
                 UNLOCK_BIG_ZONE_USED();
+
+                STATS_ADD(big_allocations, 1);
+                STATS_ADD(big_allocated_bytes, big->size);
 #if PROTECT_FREE_BIG_ZONES
                 mprotect_pages(big->user_pages_start, big->size, PROT_READ | PROT_WRITE);
 #endif
@@ -1945,6 +2529,7 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_big_alloc(size_t size) {
                     big->user_pages_start = iso_mte_set_tag_range(big->user_pages_start, big->size);
                 }
 #endif
+                LATENCY_RECORD(ISO_ALLOC_LATENCY_BIG_REUSE, latency_start);
                 return big->user_pages_start;
             }
 
@@ -2020,11 +2605,15 @@ INTERNAL_HIDDEN ASSUME_ALIGNED void *_iso_big_alloc(size_t size) {
     _root->big_zone_used_count++;
 
     UNLOCK_BIG_ZONE_USED();
+
+    STATS_ADD(big_allocations, 1);
+    STATS_ADD(big_allocated_bytes, size);
 #if ARM_MTE
     if(_root->arm_mte_enabled == true) {
         new_big->user_pages_start = iso_mte_set_tag_range(new_big->user_pages_start, new_big->size);
     }
 #endif
+    LATENCY_RECORD(ISO_ALLOC_LATENCY_BIG_MMAP, latency_start);
     return new_big->user_pages_start;
 }
 
@@ -2052,16 +2641,18 @@ INTERNAL_HIDDEN size_t _iso_chunk_size(void *p) {
 #endif
 
 #if ALLOC_SANITY
-    LOCK_SANITY_CACHE();
-    _sane_allocation_t *sane_alloc = _get_sane_alloc(p);
+    if(UNLIKELY(_iso_alloc_maybe_sampled(p) == true)) {
+        LOCK_SANITY_CACHE();
+        _sane_allocation_t *sane_alloc = _get_sane_alloc(p);
+
+        if(sane_alloc != NULL) {
+            size_t orig_size = sane_alloc->orig_size;
+            UNLOCK_SANITY_CACHE();
+            return orig_size;
+        }
 
-    if(sane_alloc != NULL) {
-        size_t orig_size = sane_alloc->orig_size;
         UNLOCK_SANITY_CACHE();
-        return orig_size;
     }
-
-    UNLOCK_SANITY_CACHE();
 #endif
 
     LOCK_ROOT();
@@ -2121,14 +2712,20 @@ INTERNAL_HIDDEN void _free_big_zone_list(iso_alloc_big_zone_t *head) {
 }
 
 INTERNAL_HIDDEN void _iso_alloc_destroy(void) {
+#if HEAP_PROFILER
+    /* The profile is written before the root is locked,
+     * writing it takes the root lock for the zone counts */
+    _iso_output_profile();
+#endif
+
     LOCK_ROOT();
 
     flush_chunk_quarantine();
 
     const uint16_t zones_used = _root->zones_used;
 
-#if HEAP_PROFILER
-    _iso_output_profile();
+#if ALLOC_TRACE
+    _iso_alloc_close_trace();
 #endif
 
 #if NO_ZERO_ALLOCATIONS
@@ -2181,9 +2778,23 @@ INTERNAL_HIDDEN void _iso_alloc_destroy(void) {
     UNLOCK_BIG_ZONE_FREE();
 
 #if ISO_DTOR_CLEANUP
+#if ZONE_REGION
+    _zone_region_destroy();
+#endif
     unmap_guarded_pages(_root->chunk_lookup_table, CHUNK_TO_ZONE_TABLE_SZ);
-    unmap_guarded_pages(_root->chunk_quarantine, CHUNK_QUARANTINE_SZ * sizeof(uintptr_t));
-    unmap_guarded_pages(zone_cache, ZONE_CACHE_SZ * sizeof(_tzc));
+    unmap_guarded_pages(_root->chunk_quarantine, _root->conf.chunk_quarantine_sz * sizeof(uintptr_t));
+    unmap_guarded_pages(_root->chunk_quarantine_zones, _root->conf.chunk_quarantine_sz * sizeof(uint16_t));
+    unmap_guarded_pages(zone_cache, _root->conf.zone_cache_sz * sizeof(_tzc));
+
+    if(_root->deferred_unmaps != NULL) {
+        munmap(_root->deferred_unmaps, _root->deferred_unmap_capacity * sizeof(zone_unmap_t));
+    }
+#if ALLOC_STATS
+    unmap_guarded_pages(_root->stats_slots, STATS_SLOTS * sizeof(iso_alloc_stats_slot_t));
+#endif
+#if ALLOC_LATENCY
+    unmap_guarded_pages(_root->latency_slots, LATENCY_SLOTS * sizeof(iso_alloc_latency_slot_t));
+#endif
 
 #if THREAD_SUPPORT && !USE_SPINLOCK
     UNLOCK_BIG_ZONE_FREE();
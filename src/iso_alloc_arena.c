@@ -0,0 +1,176 @@
+/* iso_alloc_arena.c - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#define MASK_ARENA_PTR(arena, p) ((uintptr_t) (p) ^ (uintptr_t) arena->mask)
+#define UNMASK_ARENA_PTR(arena, p) ((uintptr_t) (p) ^ (uintptr_t) arena->mask)
+
+/* Makes span i the one allocations are bumped through */
+INTERNAL_HIDDEN INLINE void _arena_use_span(iso_alloc_arena_t *arena, uint32_t i) {
+    const uintptr_t start = UNMASK_ARENA_PTR(arena, arena->spans[i].start);
+    arena->current_span = i;
+    arena->cursor = MASK_ARENA_PTR(arena, start);
+    arena->end = MASK_ARENA_PTR(arena, start + arena->spans[i].size);
+}
+
+/* Maps a new span at the end of the span table. Requests
+ * larger than the next span get a span of their own and
+ * don't count towards growing the span size */
+INTERNAL_HIDDEN bool _arena_new_span(iso_alloc_arena_t *arena, size_t size) {
+    if(UNLIKELY(arena->span_count == ARENA_MAX_SPANS)) {
+        LOG("Arena has no room for another span");
+        return false;
+    }
+
+    size_t span_size = arena->next_span_sz;
+
+    if(size > span_size) {
+        span_size = ROUND_UP_PAGE(size);
+    } else if(arena->next_span_sz < ARENA_SPAN_SZ_MAX) {
+        arena->next_span_sz <<= 1;
+    }
+
+    void *p = mmap_guarded_rw_pages(span_size, false, ARENA_SPAN_NAME);
+
+    if(p == NULL) {
+        return false;
+    }
+
+    arena->spans[arena->span_count].start = MASK_ARENA_PTR(arena, p);
+    arena->spans[arena->span_count].size = span_size;
+    _arena_use_span(arena, arena->span_count);
+    arena->span_count++;
+    return true;
+}
+
+/* Moves to the next span that can hold size bytes. Spans
+ * left over from before a reset are reused in order, any
+ * too small for this request are skipped until the next reset */
+INTERNAL_HIDDEN bool _arena_next_span(iso_alloc_arena_t *arena, size_t size) {
+    for(uint32_t i = arena->current_span + 1; i < arena->span_count; i++) {
+        if(arena->spans[i].size >= size) {
+            _arena_use_span(arena, i);
+            return true;
+        }
+    }
+
+    return _arena_new_span(arena, size);
+}
+
+INTERNAL_HIDDEN iso_alloc_arena_t *_iso_new_arena(size_t span_size) {
+    if(span_size == 0) {
+        span_size = ARENA_SPAN_SZ;
+    }
+
+    if(span_size > ARENA_SPAN_SZ_MAX) {
+        LOG("Arena span size %lu is larger than ARENA_SPAN_SZ_MAX", span_size);
+        return NULL;
+    }
+
+    iso_alloc_arena_t *arena = (iso_alloc_arena_t *) mmap_guarded_rw_pages(sizeof(iso_alloc_arena_t), true, ARENA_MD_NAME);
+
+    if(arena == NULL) {
+        return NULL;
+    }
+
+#if THREAD_SUPPORT && !USE_SPINLOCK
+    pthread_mutex_init(&arena->lock, NULL);
+#endif
+
+    arena->mask = rand_uint64();
+    arena->next_span_sz = ROUND_UP_PAGE(span_size);
+
+    if(_arena_new_span(arena, 0) == false) {
+        _iso_arena_destroy(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+INTERNAL_HIDDEN void *_iso_arena_alloc(iso_alloc_arena_t *arena, size_t size, size_t alignment) {
+    if(alignment == 0) {
+        alignment = ARENA_ALIGNMENT;
+    }
+
+    /* Spans are page aligned so any power of 2 up
+     * to a page can be honored without padding a span */
+    if(UNLIKELY((alignment & (alignment - 1)) != 0 || alignment > g_page_size)) {
+        LOG("Arena allocations can't be aligned to %lu", alignment);
+        return NULL;
+    }
+
+    if(UNLIKELY(size > BIG_SZ_MAX)) {
+        return NULL;
+    }
+
+    /* Every allocation gets a unique address */
+    if(size == 0) {
+        size = 1;
+    }
+
+    LOCK_ARENA(arena);
+
+    uintptr_t end = UNMASK_ARENA_PTR(arena, arena->end);
+    uintptr_t p = (UNMASK_ARENA_PTR(arena, arena->cursor) + (alignment - 1)) & ~(alignment - 1);
+
+    if(p > end || size > (end - p)) {
+        if(_arena_next_span(arena, size) == false) {
+            UNLOCK_ARENA(arena);
+            return NULL;
+        }
+
+        p = UNMASK_ARENA_PTR(arena, arena->cursor);
+    }
+
+    arena->cursor = MASK_ARENA_PTR(arena, p + size);
+
+    UNLOCK_ARENA(arena);
+    return (void *) p;
+}
+
+/* Frees everything allocated from the arena by rewinding
+ * to the first span. Spans stay mapped so the next round
+ * of allocations doesn't fault in new pages */
+INTERNAL_HIDDEN void _iso_arena_reset(iso_alloc_arena_t *arena) {
+    LOCK_ARENA(arena);
+
+#if !ENABLE_ASAN && SANITIZE_CHUNKS
+    for(uint32_t i = 0; i < arena->current_span; i++) {
+        __iso_memset((void *) UNMASK_ARENA_PTR(arena, arena->spans[i].start), POISON_BYTE, arena->spans[i].size);
+    }
+
+    const uintptr_t start = UNMASK_ARENA_PTR(arena, arena->spans[arena->current_span].start);
+    __iso_memset((void *) start, POISON_BYTE, UNMASK_ARENA_PTR(arena, arena->cursor) - start);
+#endif
+
+    /* Pick a new mask so stale copies of the
+     * metadata can't be used to recover pointers */
+    const uint64_t mask = rand_uint64();
+
+    for(uint32_t i = 0; i < arena->span_count; i++) {
+        arena->spans[i].start = UNMASK_ARENA_PTR(arena, arena->spans[i].start) ^ mask;
+    }
+
+    arena->mask = mask;
+    _arena_use_span(arena, 0);
+
+    UNLOCK_ARENA(arena);
+}
+
+INTERNAL_HIDDEN void _iso_arena_destroy(iso_alloc_arena_t *arena) {
+    LOCK_ARENA(arena);
+
+    for(uint32_t i = 0; i < arena->span_count; i++) {
+        unmap_guarded_pages((void *) UNMASK_ARENA_PTR(arena, arena->spans[i].start), arena->spans[i].size);
+    }
+
+    UNLOCK_ARENA(arena);
+
+#if THREAD_SUPPORT && !USE_SPINLOCK
+    pthread_mutex_destroy(&arena->lock);
+#endif
+
+    unmap_guarded_pages(arena, sizeof(iso_alloc_arena_t));
+}
@@ -0,0 +1,181 @@
+/* iso_alloc_conf.c - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+#include <stddef.h>
+
+/* Keys that take a single number. Keys for features that
+ * weren't compiled in are still accepted so the same
+ * ISO_ALLOC_CONF can be used with every build */
+typedef struct {
+    const char *name;
+    size_t offset;
+    uint32_t min;
+    uint32_t max;
+    bool power_of_2;
+} iso_alloc_conf_key_t;
+
+static const iso_alloc_conf_key_t _conf_keys[] = {
+    {"zone_cache_sz", offsetof(iso_alloc_conf_t, zone_cache_sz), 1, ZONE_CACHE_SZ_MAX, false},
+    {"chunk_quarantine_sz", offsetof(iso_alloc_conf_t, chunk_quarantine_sz), 1, CHUNK_QUARANTINE_SZ_MAX, false},
+    {"zone_alloc_retire", offsetof(iso_alloc_conf_t, zone_alloc_retire), 1, ZONE_ALLOC_RETIRE_MAX, true},
+    {"big_zone_waste", offsetof(iso_alloc_conf_t, big_zone_waste), 0, UINT32_MAX, false},
+    {"big_zone_max_free_list", offsetof(iso_alloc_conf_t, big_zone_max_free_list), 0, BIG_ZONE_MAX_FREE_LIST_MAX, false},
+    {"big_zone_alloc_retire", offsetof(iso_alloc_conf_t, big_zone_alloc_retire), 1, BIG_ZONE_ALLOC_RETIRE_MAX, false},
+    {"sanity_sample_odds", offsetof(iso_alloc_conf_t, sanity_sample_odds), 1, UINT32_MAX, false},
+    {"profiler_sample_bytes", offsetof(iso_alloc_conf_t, profiler_sample_bytes), 1, UINT32_MAX, false},
+    {"profiler_odds", offsetof(iso_alloc_conf_t, profiler_odds), 1, UINT32_MAX, false},
+    {"adaptive_zones_window", offsetof(iso_alloc_conf_t, adaptive_zones_window), ADAPTIVE_ZONES_WINDOW_MIN, UINT32_MAX, false},
+};
+
+/* strtoul and friends may call malloc or depend on the
+ * locale, neither of which is available this early */
+INTERNAL_HIDDEN uint64_t _conf_parse_number(const char *key, const char *s, size_t len) {
+    uint64_t v = 0;
+
+    if(len == 0) {
+        LOG_AND_ABORT("%s has no value for %s", CONF_ENV_STR, key);
+    }
+
+    for(size_t i = 0; i < len; i++) {
+        if(s[i] < '0' || s[i] > '9' || v > (UINT32_MAX / 10)) {
+            LOG_AND_ABORT("%s has an invalid value for %s", CONF_ENV_STR, key);
+        }
+
+        v = (v * 10) + (s[i] - '0');
+    }
+
+    return v;
+}
+
+INTERNAL_HIDDEN void _conf_parse_default_zones(iso_alloc_conf_t *conf, const char *s, size_t len) {
+    size_t start = 0;
+
+    conf->default_zone_count = 0;
+
+    for(size_t i = 0; i <= len; i++) {
+        if(i != len && s[i] != ':') {
+            continue;
+        }
+
+        if(conf->default_zone_count >= DEFAULT_ZONES_MAX) {
+            LOG_AND_ABORT("%s default_zones can't have more than %d zones", CONF_ENV_STR, DEFAULT_ZONES_MAX);
+        }
+
+        uint64_t z = _conf_parse_number("default_zones", &s[start], i - start);
+
+        if(z < SMALLEST_CHUNK_SZ || z > MAX_DEFAULT_ZONE_SZ || (z & (z - 1)) != 0) {
+            LOG_AND_ABORT("%s default_zones value %lu must be a power of 2 between %d and %d", CONF_ENV_STR, z,
+                          SMALLEST_CHUNK_SZ, MAX_DEFAULT_ZONE_SZ);
+        }
+
+        /* The SMALL_MEM_STARTUP fast path depends on
+         * the default zones being sorted by size */
+        if(conf->default_zone_count != 0 && z < conf->default_zones[conf->default_zone_count - 1]) {
+            LOG_AND_ABORT("%s default_zones must be sorted by size", CONF_ENV_STR);
+        }
+
+        conf->default_zones[conf->default_zone_count++] = z;
+        start = i + 1;
+    }
+}
+
+INTERNAL_HIDDEN void _conf_set(iso_alloc_conf_t *conf, const char *key, size_t key_len, const char *value, size_t value_len) {
+    char name[CONF_TOKEN_MAX];
+
+    if(key_len >= sizeof(name)) {
+        LOG_AND_ABORT("%s has a key that is too long", CONF_ENV_STR);
+    }
+
+    __iso_memcpy(name, key, key_len);
+    name[key_len] = '\0';
+
+    if(strcmp(name, "default_zones") == 0) {
+        _conf_parse_default_zones(conf, value, value_len);
+        return;
+    }
+
+    for(size_t i = 0; i < (sizeof(_conf_keys) / sizeof(iso_alloc_conf_key_t)); i++) {
+        const iso_alloc_conf_key_t *k = &_conf_keys[i];
+
+        if(strcmp(name, k->name) != 0) {
+            continue;
+        }
+
+        uint64_t v = _conf_parse_number(name, value, value_len);
+
+        if(v < k->min || v > k->max || (k->power_of_2 == true && (v & (v - 1)) != 0)) {
+            LOG_AND_ABORT("%s value %lu for %s is out of range", CONF_ENV_STR, v, name);
+        }
+
+        *(uint32_t *) ((uintptr_t) conf + k->offset) = (uint32_t) v;
+        return;
+    }
+
+    LOG_AND_ABORT("%s has an unknown key %s", CONF_ENV_STR, name);
+}
+
+/* Fills in the compile time defaults and then applies
+ * anything set in ISO_ALLOC_CONF. Called once while the
+ * root is being created, before any zone exists */
+INTERNAL_HIDDEN void _iso_alloc_initialize_conf(iso_alloc_conf_t *conf) {
+    conf->zone_cache_sz = ZONE_CACHE_SZ;
+    conf->chunk_quarantine_sz = CHUNK_QUARANTINE_SZ;
+    conf->zone_alloc_retire = ZONE_ALLOC_RETIRE;
+    conf->big_zone_waste = BIG_ZONE_WASTE;
+    conf->big_zone_max_free_list = BIG_ZONE_MAX_FREE_LIST;
+    conf->big_zone_alloc_retire = BIG_ZONE_ALLOC_RETIRE;
+#if ALLOC_SANITY
+    conf->sanity_sample_odds = SANITY_SAMPLE_ODDS;
+#endif
+#if HEAP_PROFILER
+    conf->profiler_sample_bytes = PROFILER_SAMPLE_BYTES;
+    conf->profiler_odds = PROFILER_ODDS;
+#endif
+#if ADAPTIVE_ZONES
+    conf->adaptive_zones_window = ADAPTIVE_ZONES_WINDOW;
+#endif
+
+    conf->default_zone_count = DEFAULT_ZONE_COUNT;
+
+    for(size_t i = 0; i < DEFAULT_ZONE_COUNT; i++) {
+        conf->default_zones[i] = default_zones[i];
+    }
+
+    const char *s = getenv(CONF_ENV_STR);
+
+    if(s == NULL) {
+        return;
+    }
+
+    while(*s != '\0') {
+        const char *key = s;
+
+        while(*s != '\0' && *s != ',') {
+            s++;
+        }
+
+        const char *end = s;
+
+        if(*s == ',') {
+            s++;
+        }
+
+        /* Allow empty entries e.g. a trailing comma */
+        if(key == end) {
+            continue;
+        }
+
+        const char *eq = key;
+
+        while(eq < end && *eq != '=') {
+            eq++;
+        }
+
+        if(eq == end) {
+            LOG_AND_ABORT("%s entries must be key=value", CONF_ENV_STR);
+        }
+
+        _conf_set(conf, key, eq - key, eq + 1, end - (eq + 1));
+    }
+}
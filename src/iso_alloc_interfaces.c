@@ -54,13 +54,26 @@ EXTERNAL_API FLATTEN size_t iso_chunksz(void *p) {
 
 EXTERNAL_API FLATTEN NO_DISCARD size_t iso_zone_chunk_count(iso_alloc_zone_handle *zone) {
     UNMASK_ZONE_HANDLE(zone);
-    iso_alloc_zone_t *_zone = (iso_alloc_zone_t *) zone;
-    size_t canaries = 0;
+    size_t count = 0;
 
+    for(iso_alloc_zone_t *_zone = (iso_alloc_zone_t *) zone; _zone != NULL; _zone = _next_private_zone(_zone)) {
+        size_t canaries = 0;
 #if !DISABLE_CANARY
-    canaries = _zone->chunk_count >> CANARY_COUNT_DIV;
+        canaries = _zone->chunk_count >> CANARY_COUNT_DIV;
 #endif
-    return (_zone->chunk_count - canaries);
+        count += (_zone->chunk_count - canaries);
+    }
+
+    return count;
+}
+
+EXTERNAL_API FLATTEN NO_DISCARD bool iso_zone_owns_ptr(iso_alloc_zone_handle *zone, void *p) {
+    if(zone == NULL || p == NULL) {
+        return false;
+    }
+
+    UNMASK_ZONE_HANDLE(zone);
+    return (_private_zone_member((iso_alloc_zone_t *) zone, p) != NULL);
 }
 
 EXTERNAL_API FLATTEN NO_DISCARD REALLOC_SIZE ASSUME_ALIGNED void *iso_realloc(void *p, size_t size) {
@@ -229,6 +242,54 @@ EXTERNAL_API FLATTEN void iso_alloc_destroy_zone(iso_alloc_zone_handle *zone) {
     _iso_alloc_destroy_zone(zone);
 }
 
+EXTERNAL_API FLATTEN void iso_alloc_zone_reset(iso_alloc_zone_handle *zone, bool release_pages) {
+    if(zone == NULL) {
+        return;
+    }
+
+    UNMASK_ZONE_HANDLE(zone);
+    _iso_alloc_zone_reset(zone, release_pages);
+}
+
+/* Arena handles are masked the same way zone handles are */
+EXTERNAL_API FLATTEN NO_DISCARD iso_alloc_arena_handle *iso_alloc_new_arena(size_t span_size) {
+    iso_alloc_arena_handle *arena = (iso_alloc_arena_handle *) _iso_new_arena(span_size);
+
+    if(arena == NULL) {
+        return NULL;
+    }
+
+    UNMASK_ZONE_HANDLE(arena);
+    return arena;
+}
+
+EXTERNAL_API FLATTEN NO_DISCARD MALLOC_ATTR void *iso_alloc_from_arena(iso_alloc_arena_handle *arena, size_t size, size_t alignment) {
+    if(arena == NULL) {
+        return NULL;
+    }
+
+    UNMASK_ZONE_HANDLE(arena);
+    return _iso_arena_alloc((iso_alloc_arena_t *) arena, size, alignment);
+}
+
+EXTERNAL_API FLATTEN void iso_alloc_arena_reset(iso_alloc_arena_handle *arena) {
+    if(arena == NULL) {
+        return;
+    }
+
+    UNMASK_ZONE_HANDLE(arena);
+    _iso_arena_reset((iso_alloc_arena_t *) arena);
+}
+
+EXTERNAL_API FLATTEN void iso_alloc_destroy_arena(iso_alloc_arena_handle *arena) {
+    if(arena == NULL) {
+        return;
+    }
+
+    UNMASK_ZONE_HANDLE(arena);
+    _iso_arena_destroy((iso_alloc_arena_t *) arena);
+}
+
 EXTERNAL_API FLATTEN NO_DISCARD iso_alloc_zone_handle *iso_alloc_new_zone(size_t size) {
     iso_alloc_zone_handle *zone = (iso_alloc_zone_handle *) iso_new_zone(size, false);
     UNMASK_ZONE_HANDLE(zone);
@@ -242,8 +303,17 @@ EXTERNAL_API FLATTEN int32_t iso_alloc_name_zone(iso_alloc_zone_handle *zone, ch
         UNMASK_ZONE_HANDLE(zone);
     }
 
-    iso_alloc_zone_t *_zone = (iso_alloc_zone_t *) zone;
-    return name_mapping(_zone->user_pages_start, ZONE_USER_SIZE, name);
+    /* The name isn't kept, zones linked into the chain
+     * after this call are left unnamed */
+    for(iso_alloc_zone_t *_zone = (iso_alloc_zone_t *) zone; _zone != NULL; _zone = _next_private_zone(_zone)) {
+        int32_t r = name_mapping(UNMASK_USER_PTR(_zone), ZONE_USER_SIZE, name);
+
+        if(r != 0) {
+            return r;
+        }
+    }
+
+    return 0;
 }
 
 EXTERNAL_API FLATTEN void iso_alloc_protect_root(void) {
@@ -261,7 +331,13 @@ EXTERNAL_API FLATTEN uint64_t iso_alloc_detect_zone_leaks(iso_alloc_zone_handle
         UNMASK_ZONE_HANDLE(zone);
     }
 
-    return _iso_alloc_detect_leaks_in_zone(zone);
+    uint64_t leaks = 0;
+
+    for(iso_alloc_zone_t *_zone = (iso_alloc_zone_t *) zone; _zone != NULL; _zone = _next_private_zone(_zone)) {
+        leaks += _iso_alloc_detect_leaks_in_zone(_zone);
+    }
+
+    return leaks;
 }
 
 EXTERNAL_API FLATTEN uint64_t iso_alloc_detect_leaks(void) {
@@ -275,7 +351,13 @@ EXTERNAL_API FLATTEN uint64_t iso_alloc_zone_mem_usage(iso_alloc_zone_handle *zo
         UNMASK_ZONE_HANDLE(zone);
     }
 
-    return _iso_alloc_zone_mem_usage(zone);
+    uint64_t usage = 0;
+
+    for(iso_alloc_zone_t *_zone = (iso_alloc_zone_t *) zone; _zone != NULL; _zone = _next_private_zone(_zone)) {
+        usage += _iso_alloc_zone_mem_usage(_zone);
+    }
+
+    return usage;
 }
 
 EXTERNAL_API FLATTEN uint64_t iso_alloc_mem_usage(void) {
@@ -293,25 +375,47 @@ EXTERNAL_API FLATTEN void iso_verify_zone(iso_alloc_zone_handle *zone) {
         UNMASK_ZONE_HANDLE(zone);
     }
 
-    verify_zone(zone);
+    for(iso_alloc_zone_t *_zone = (iso_alloc_zone_t *) zone; _zone != NULL; _zone = _next_private_zone(_zone)) {
+        verify_zone(_zone);
+    }
 }
 
 EXTERNAL_API FLATTEN void iso_flush_caches(void) {
     flush_caches();
 }
 
+EXTERNAL_API FLATTEN void iso_alloc_get_stats(iso_alloc_stats_t *stats) {
+    _iso_alloc_get_stats(stats);
+}
+
+EXTERNAL_API FLATTEN void iso_alloc_get_latency(iso_alloc_latency_t *latency) {
+    _iso_alloc_get_latency(latency);
+}
+
+EXTERNAL_API FLATTEN void iso_alloc_dump_latency(int32_t fd) {
+    _iso_alloc_dump_latency(fd);
+}
+
+EXTERNAL_API FLATTEN void iso_alloc_get_lock_profile(iso_alloc_lock_profile_t *profile) {
+    _iso_alloc_get_lock_profile(profile);
+}
+
 #if HEAP_PROFILER
-EXTERNAL_API FLATTEN size_t iso_get_alloc_traces(iso_alloc_traces_t *traces_out) {
-    return _iso_get_alloc_traces(traces_out);
+EXTERNAL_API FLATTEN size_t iso_get_alloc_traces(iso_alloc_traces_t *traces_out, size_t count) {
+    return _iso_get_alloc_traces(traces_out, count);
 }
 
-EXTERNAL_API FLATTEN size_t iso_get_free_traces(iso_free_traces_t *traces_out) {
-    return _iso_get_free_traces(traces_out);
+EXTERNAL_API FLATTEN size_t iso_get_free_traces(iso_free_traces_t *traces_out, size_t count) {
+    return _iso_get_free_traces(traces_out, count);
 }
 
 EXTERNAL_API FLATTEN void iso_alloc_reset_traces(void) {
     _iso_alloc_reset_traces();
 }
+
+EXTERNAL_API FLATTEN void iso_alloc_write_profile(void) {
+    _iso_alloc_write_profile();
+}
 #endif
 
 #if EXPERIMENTAL
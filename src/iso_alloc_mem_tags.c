@@ -9,6 +9,13 @@
  * when passed to this function */
 INTERNAL_HIDDEN uint8_t _iso_alloc_get_mem_tag(void *p, iso_alloc_zone_t *zone) {
 #if MEMORY_TAGGING
+    /* The chunk may be in any member of a private zone */
+    iso_alloc_zone_t *member = _private_zone_member(zone, p);
+
+    if(member != NULL) {
+        zone = member;
+    }
+
     void *user_pages_start = UNMASK_USER_PTR(zone);
 
     if(user_pages_start > p || (user_pages_start + ZONE_USER_SIZE) < p) {
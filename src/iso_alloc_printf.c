@@ -38,28 +38,38 @@ INTERNAL_HIDDEN int8_t *_fmt(uint64_t n, uint32_t base) {
     return ptr;
 }
 
-INTERNAL_HIDDEN void _iso_alloc_printf(int32_t fd, const char *f, ...) {
-    if(UNLIKELY(f == NULL)) {
-        return;
+/* Formats f into out without ever writing past size bytes.
+ * Returns the length of the formatted string, which is
+ * always NUL terminated */
+INTERNAL_HIDDEN size_t _iso_alloc_vsnprintf(char *out, size_t size, const char *f, va_list arg) {
+    if(UNLIKELY(f == NULL || size == 0)) {
+        return 0;
     }
 
     uint64_t i;
     uint32_t j;
     char *s;
-    va_list arg;
-    va_start(arg, f);
-    char out[65535];
     char *p = out;
-    __builtin_memset(p, 0x0, sizeof(out));
+    const char *end = out + size - 1;
+
+#define FMT_PUT(c)   \
+    if(p < end) {    \
+        *p = c;      \
+        p++;         \
+    }
+
+#define FMT_PUTS(str)                          \
+    for(const char *c = str; *c != '\0'; c++) { \
+        FMT_PUT(*c);                           \
+    }
 
     for(const char *idx = f; *idx != '\0'; idx++) {
-        if(p >= (char *) (out + sizeof(out))) {
+        if(p >= end) {
             break;
         }
 
         while(*idx != '%' && *idx != '\0') {
-            *p = *idx;
-            p++;
+            FMT_PUT(*idx);
 
             if(*idx == '\n') {
                 break;
@@ -77,21 +87,17 @@ INTERNAL_HIDDEN void _iso_alloc_printf(int32_t fd, const char *f, ...) {
         if(*idx == 'x' || *idx == 'p') {
             i = va_arg(arg, int64_t);
             s = (char *) _fmt(i, 16);
-            __builtin_strncpy(p, s, strlen(s));
-            p += strlen(s);
+            FMT_PUTS(s);
         } else if(*idx == 'd' || *idx == 'u') {
             j = va_arg(arg, int32_t);
 
             if(0 > j) {
                 j = -j;
-                *p = '-';
-                p++;
+                FMT_PUT('-');
             }
 
             s = (char *) _fmt(j, 10);
-
-            __builtin_strncpy(p, s, strlen(s));
-            p += strlen(s);
+            FMT_PUTS(s);
         } else if(*idx == 'l') {
             if(*(idx + 1) == 'd' || *(idx + 1) == 'u') {
                 idx++;
@@ -101,14 +107,11 @@ INTERNAL_HIDDEN void _iso_alloc_printf(int32_t fd, const char *f, ...) {
 
             if(0 > i) {
                 i = -i;
-                *p = '-';
-                p++;
+                FMT_PUT('-');
             }
 
             s = (char *) _fmt(i, 10);
-
-            __builtin_strncpy(p, s, strlen(s));
-            p += strlen(s);
+            FMT_PUTS(s);
         } else if(*idx == 's') {
             s = va_arg(arg, char *);
 
@@ -116,11 +119,26 @@ INTERNAL_HIDDEN void _iso_alloc_printf(int32_t fd, const char *f, ...) {
                 break;
             }
 
-            __builtin_strncpy(p, s, strlen(s));
-            p += strlen(s);
+            FMT_PUTS(s);
         }
     }
 
-    (void) !write(fd, out, strlen(out));
+#undef FMT_PUTS
+#undef FMT_PUT
+
+    *p = '\0';
+    return p - out;
+}
+
+INTERNAL_HIDDEN void _iso_alloc_printf(int32_t fd, const char *f, ...) {
+    if(UNLIKELY(f == NULL)) {
+        return;
+    }
+
+    va_list arg;
+    va_start(arg, f);
+    char out[65535];
+    size_t len = _iso_alloc_vsnprintf(out, sizeof(out), f, arg);
+    (void) !write(fd, out, len);
     va_end(arg);
 }
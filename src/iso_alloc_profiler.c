@@ -11,7 +11,9 @@
 #include "iso_alloc_profiler.h"
 #endif
 
-#include <dlfcn.h>
+#if HEAP_PROFILER && (__linux__ || __FreeBSD__)
+#include <link.h>
+#endif
 
 INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks_in_zone(iso_alloc_zone_t *zone) {
     LOCK_ROOT();
@@ -72,14 +74,15 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks(void) {
     uint64_t total_leaks = 0;
     uint64_t big_leaks = 0;
 
-    LOCK_ROOT();
+#if LEAK_REACHABILITY
+    /* Only chunks and big zones nothing points to are leaks */
+    return _iso_alloc_detect_unreachable();
+#endif
 
-    for(uint16_t i = 0; i < _root->zones_used; i++) {
-        iso_alloc_zone_t *zone = &_root->zones[i];
-        total_leaks += _iso_alloc_zone_leak_detector(zone, false);
-    }
+#if LEAK_DETECTOR || HEAP_PROFILER
+    total_leaks = _iso_alloc_scan_zones(ZONE_SCAN_LEAKS);
+#endif
 
-    UNLOCK_ROOT();
     LOCK_BIG_ZONE_USED();
 
     iso_alloc_big_zone_t *big = _root->big_zone_used;
@@ -106,67 +109,79 @@ INTERNAL_HIDDEN uint64_t _iso_alloc_detect_leaks(void) {
     return total_leaks + big_leaks;
 }
 
-/* This is the built-in leak detector. It works by scanning
- * the bitmap for every allocated zone and looking for
- * uncleared bits. This does not search for references from
- * a root like a GC, so if you purposefully did not free a
- * chunk then expect it to show up as leaked! */
-INTERNAL_HIDDEN uint64_t _iso_alloc_zone_leak_detector(iso_alloc_zone_t *zone, bool profile) {
-    uint32_t in_use = 0;
+/* Counts the chunks in use in a zone from its bitmap. The
+ * zone must be unmasked but bm can be a copy of its bitmap.
+ * A chunk is in use if its first bit is set. A chunk that has
+ * both bits set is either a canary chunk or was freed and
+ * then allocated again, only its canary tells them apart */
+INTERNAL_HIDDEN uint64_t _zone_bitmap_leaks(iso_alloc_zone_t *zone, const bitmap_index_t *bm, bool profile, uint64_t *was_used) {
+    uint64_t in_use = 0;
+    const int64_t bms = zone->bitmap_size / sizeof(bitmap_index_t);
 
-#if LEAK_DETECTOR || HEAP_PROFILER
-    if(zone == NULL) {
-        return 0;
-    }
+    for(bitmap_index_t i = 0; i < bms; i++) {
+        if(bm[i] == 0 || bm[i] == CANARY_UNWRITTEN_QWORD) {
+            continue;
+        }
 
-    UNMASK_ZONE_PTRS(zone);
+        const uint64_t used = bm[i] & USED_BIT_VECTOR;
+        const uint64_t freed = (bm[i] >> 1) & USED_BIT_VECTOR;
+        const uint64_t leaked = used & ~freed;
+        uint64_t reused = used & freed;
 
-    bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
-    uint32_t was_used = 0;
-    int64_t bms = zone->bitmap_size / sizeof(bitmap_index_t);
+        /* Chunk was used but is now free */
+        *was_used += __builtin_popcountll(freed & ~used);
+        in_use += __builtin_popcountll(leaked);
 
-    for(bitmap_index_t i = 0; i < bms; i++) {
-        for(int j = 0; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
+#if DEBUG
+        for(uint64_t m = leaked; profile == false && m != 0; m &= (m - 1)) {
+            bit_slot_t bit_slot = (i * BITS_PER_QWORD) + __builtin_ctzll(m);
+            const void *leak = POINTER_FROM_BITSLOT(zone, bit_slot);
+            LOG("Leaked chunk in zone[%d] of %d bytes detected at 0x%p (bit position = %d)", zone->index, zone->chunk_size, leak, bit_slot);
+        }
+#endif
+
+        while(reused != 0) {
+            bit_slot_t bit_slot = (i * BITS_PER_QWORD) + __builtin_ctzll(reused);
+            const void *leak = POINTER_FROM_BITSLOT(zone, bit_slot);
+            reused &= (reused - 1);
 
-            if(bm[i] == 0) {
+            if(check_canary_no_abort(zone, leak) != ERR) {
                 continue;
             }
 
-            int64_t bit = GET_BIT(bm[i], j);
-            int64_t bit_two = GET_BIT(bm[i], (j + 1));
-
-            /* Chunk was used but is now free */
-            if(bit == 0 && bit_two == 1) {
-                was_used++;
-            }
+            in_use++;
 
-            if(bit == 1) {
-                /* Theres no difference between a leaked and previously
-                 * used chunk (11) and a canary chunk (11). So in order
-                 * to accurately report on leaks we need to verify the
-                 * canary value. If it doesn't validate then we assume
-                 * its a true leak and increment the in_use counter */
-                bit_slot_t bit_slot = (i * BITS_PER_QWORD) + j;
-                const void *leak = (zone->user_pages_start + ((bit_slot >> 1) * zone->chunk_size));
-
-                if(bit_two == 1 && (check_canary_no_abort(zone, leak) != ERR)) {
-                    continue;
-                } else {
-                    in_use++;
-
-                    if(profile == false) {
-                        LOG("Leaked chunk (%d) in zone[%d] of %d bytes detected at 0x%p (bit position = %d)", in_use, zone->index, zone->chunk_size, leak, bit_slot);
-                    }
-                }
+            if(profile == false) {
+                LOG("Leaked chunk in zone[%d] of %d bytes detected at 0x%p (bit position = %d)", zone->index, zone->chunk_size, leak, bit_slot);
             }
         }
     }
 
     if(profile == false) {
         LOG("Zone[%d] Total number of %d byte chunks(%d) used and free'd (%d) (%d percent), in use = %d", zone->index, zone->chunk_size, zone->chunk_count,
-            was_used, (int32_t) ((float) was_used / zone->chunk_count) * 100, in_use);
+            *was_used, (int32_t) ((float) *was_used / zone->chunk_count) * 100, in_use);
+    }
+
+    return in_use;
+}
+
+/* This is the built-in leak detector. It works by scanning
+ * the bitmap for every allocated zone and looking for
+ * uncleared bits. This does not search for references from
+ * a root like a GC, so if you purposefully did not free a
+ * chunk then expect it to show up as leaked! */
+INTERNAL_HIDDEN uint64_t _iso_alloc_zone_leak_detector(iso_alloc_zone_t *zone, bool profile) {
+    uint64_t in_use = 0;
+
+#if LEAK_DETECTOR || HEAP_PROFILER
+    if(zone == NULL) {
+        return 0;
     }
 
+    uint64_t was_used = 0;
+
+    UNMASK_ZONE_PTRS(zone);
+    in_use = _zone_bitmap_leaks(zone, (bitmap_index_t *) zone->bitmap_start, profile, &was_used);
     MASK_ZONE_PTRS(zone);
 #endif
 
@@ -239,262 +254,715 @@ INTERNAL_HIDDEN uint64_t __iso_alloc_big_zone_mem_usage(iso_alloc_big_zone_t *he
 }
 
 #if HEAP_PROFILER
+/* One snapshot is written at a time, _profiler_writing
+ * guards the path and write buffer. No allocator lock is
+ * held while a snapshot is written */
+static char _profiler_path[PATH_MAX];
+static uint64_t _profiler_interval_ns;
+static uint64_t _profiler_next_snapshot;
+static profiler_writer_t _profiler_writer;
+static bool _profiler_writing;
+
+/* Set by a sampled allocation when a periodic snapshot
+ * is due. The next allocation writes it before it takes
+ * the root lock */
+bool _profiler_snapshot_due;
+
+zone_profiler_map_t _zone_profiler_map[SMALL_SIZE_MAX + 1];
+
+/* iso_alloc_traces_t and iso_free_traces_t are public
+ * structures defined in the public header iso_alloc.h */
+static profiler_table_t _alloc_bts = {.entry_size = sizeof(iso_alloc_traces_t)};
+static profiler_table_t _free_bts = {.entry_size = sizeof(iso_free_traces_t)};
+
+/* Sampling decisions and counters never take a lock. Only
+ * the rare sampled event takes this lock to update the
+ * backtrace tables. It's always acquired after the root */
+static bool _profiler_tables_busy;
+
+static iso_alloc_profiler_slot_t _profiler_slots[PROFILER_SLOTS];
+static uint32_t _profiler_next_slot;
+
+#if THREAD_SUPPORT
+static __thread iso_alloc_profiler_thread_t _profiler_thread;
+#else
+static iso_alloc_profiler_thread_t _profiler_thread;
+#endif
+
+INTERNAL_HIDDEN INLINE void _lock_profiler_tables(void) {
+    while(__atomic_test_and_set(&_profiler_tables_busy, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+INTERNAL_HIDDEN INLINE void _unlock_profiler_tables(void) {
+    __atomic_clear(&_profiler_tables_busy, __ATOMIC_RELEASE);
+}
+
+/* Draws from an exponential distribution with the given
+ * mean. -ln(u) is computed as ln(2) * (26 - log2(r)) for a
+ * 26 bit random r. log2 uses a quadratic fit of the mantissa
+ * which is accurate to about 0.5% and avoids libm */
+INTERNAL_HIDDEN INLINE int64_t _profiler_next_interval(uint64_t *seed, uint64_t mean) {
+    uint64_t r = (us_rand_uint64(seed) & ((1 << 26) - 1)) + 1;
+    int32_t ip = 63 - __builtin_clzll(r);
+    double f = ((double) r / (double) (1ULL << ip)) - 1.0;
+    double log2r = ip + f + (0.34 * f * (1.0 - f));
+    return (int64_t) ((26.0 - log2r) * 0.6931471805599453 * mean) + 1;
+}
+
+INTERNAL_HIDDEN iso_alloc_profiler_thread_t *_profiler_thread_init(void) {
+    iso_alloc_profiler_thread_t *pt = &_profiler_thread;
+    uint32_t idx = __atomic_fetch_add(&_profiler_next_slot, 1, __ATOMIC_RELAXED);
+    pt->seed = ((uint64_t) (uintptr_t) pt) ^ _iso_latency_now() ^ ((uint64_t) idx << 32);
+    pt->alloc_countdown = _profiler_next_interval(&pt->seed, _root->conf.profiler_sample_bytes);
+    pt->free_countdown = _profiler_next_interval(&pt->seed, _root->conf.profiler_odds);
+    pt->slot = &_profiler_slots[idx & (PROFILER_SLOTS - 1)];
+    return pt;
+}
+
+#define PROFILER_THREAD() \
+    (LIKELY(_profiler_thread.slot != NULL) ? &_profiler_thread : _profiler_thread_init())
+
+#define PROFILER_ADD(pt, field, v) \
+    __atomic_fetch_add(&pt->slot->field, (uint64_t) (v), __ATOMIC_RELAXED)
+
+/* The table and its buckets share a single mapping */
+INTERNAL_HIDDEN size_t _profiler_table_size(profiler_table_t *t, size_t capacity) {
+    return ROUND_UP_PAGE((capacity * 2 * sizeof(profiler_bucket_t)) + (capacity * t->entry_size));
+}
+
+INTERNAL_HIDDEN void _profiler_table_put(profiler_bucket_t *buckets, size_t mask, uint64_t hash, uint64_t index) {
+    size_t i = hash & mask;
+
+    while(buckets[i].index != 0) {
+        i = (i + 1) & mask;
+    }
+
+    buckets[i].hash = hash;
+    buckets[i].index = index;
+}
+
+/* Doubles the capacity of the table and rehashes every
+ * bucket into the new mapping. Fails if the table would
+ * grow past PROFILER_TABLE_MAX_BYTES */
+INTERNAL_HIDDEN bool _profiler_table_grow(profiler_table_t *t) {
+    size_t capacity = (t->capacity != 0) ? t->capacity * 2 : PROFILER_TABLE_INITIAL_SIZE;
+    size_t sz = _profiler_table_size(t, capacity);
+
+    if(sz > PROFILER_TABLE_MAX_BYTES) {
+        return false;
+    }
+
+    char *name = NULL;
+
+#if NAMED_MAPPINGS && (__ANDROID__ || KERNEL_VERSION_SEQ_5_17)
+    name = PROFILER_TABLE_NAME;
+#endif
+
+    profiler_bucket_t *buckets = (profiler_bucket_t *) mmap_rw_pages(sz, false, name);
+    void *entries = (void *) &buckets[capacity * 2];
+
+    if(t->buckets != NULL) {
+        for(size_t i = 0; i < t->capacity * 2; i++) {
+            if(t->buckets[i].index != 0) {
+                _profiler_table_put(buckets, (capacity * 2) - 1, t->buckets[i].hash, t->buckets[i].index);
+            }
+        }
+
+        __iso_memcpy(entries, t->entries, t->count * t->entry_size);
+        munmap(t->buckets, _profiler_table_size(t, t->capacity));
+    }
+
+    t->buckets = buckets;
+    t->entries = entries;
+    t->capacity = capacity;
+    return true;
+}
+
+/* Returns the trace recorded for this backtrace hash, adding
+ * a zeroed one if it hasn't been seen before. Returns NULL
+ * and counts the sample as overflow if the table is full */
+INTERNAL_HIDDEN void *_profiler_table_get(profiler_table_t *t, uint64_t hash) {
+    size_t mask = (t->capacity * 2) - 1;
+
+    if(t->buckets != NULL) {
+        for(size_t i = hash & mask; t->buckets[i].index != 0; i = (i + 1) & mask) {
+            if(t->buckets[i].hash == hash) {
+                return (void *) ((uintptr_t) t->entries + ((t->buckets[i].index - 1) * t->entry_size));
+            }
+        }
+    }
+
+    if(t->count == t->capacity) {
+        if(_profiler_table_grow(t) == false) {
+            t->overflow++;
+            return NULL;
+        }
+
+        mask = (t->capacity * 2) - 1;
+    }
+
+    _profiler_table_put(t->buckets, mask, hash, ++t->count);
+    return (void *) ((uintptr_t) t->entries + ((t->count - 1) * t->entry_size));
+}
+
+INTERNAL_HIDDEN void _profiler_table_reset(profiler_table_t *t) {
+    if(t->buckets != NULL) {
+        munmap(t->buckets, _profiler_table_size(t, t->capacity));
+    }
+
+    t->buckets = NULL;
+    t->entries = NULL;
+    t->capacity = 0;
+    t->count = 0;
+    t->overflow = 0;
+}
+
+/* Copies up to count traces in the order they were first
+ * seen and returns the total number of traces recorded */
+INTERNAL_HIDDEN size_t _profiler_table_copy(profiler_table_t *t, void *out, size_t count) {
+    _lock_profiler_tables();
+    size_t sz = t->count;
+
+    if(count > sz) {
+        count = sz;
+    }
+
+    if(count != 0) {
+        __iso_memcpy(out, t->entries, count * t->entry_size);
+    }
+
+    _unlock_profiler_tables();
+    return sz;
+}
 
 /* Returns a documented data structure that can
  * be used to interpret allocation patterns */
-INTERNAL_HIDDEN size_t _iso_get_alloc_traces(iso_alloc_traces_t *traces_out) {
-    LOCK_ROOT();
-    __iso_memcpy(traces_out, _alloc_bts, sizeof(iso_alloc_traces_t));
-    size_t sz = _alloc_bts_count;
-    UNLOCK_ROOT();
-    return sz;
+INTERNAL_HIDDEN size_t _iso_get_alloc_traces(iso_alloc_traces_t *traces_out, size_t count) {
+    return _profiler_table_copy(&_alloc_bts, traces_out, count);
 }
 
-INTERNAL_HIDDEN size_t _iso_get_free_traces(iso_free_traces_t *traces_out) {
-    LOCK_ROOT();
-    __iso_memcpy(traces_out, _free_bts, sizeof(iso_free_traces_t));
-    size_t sz = _free_bts_count;
-    UNLOCK_ROOT();
-    return sz;
+INTERNAL_HIDDEN size_t _iso_get_free_traces(iso_free_traces_t *traces_out, size_t count) {
+    return _profiler_table_copy(&_free_bts, traces_out, count);
 }
 
 INTERNAL_HIDDEN void _iso_alloc_reset_traces(void) {
-    LOCK_ROOT();
-    __iso_memset(_alloc_bts, 0x0, sizeof(_alloc_bts));
-    __iso_memset(_free_bts, 0x0, sizeof(_free_bts));
-    _alloc_bts_count = 0;
-    _free_bts_count = 0;
-    UNLOCK_ROOT();
+    _lock_profiler_tables();
+    _profiler_table_reset(&_alloc_bts);
+    _profiler_table_reset(&_free_bts);
+    _unlock_profiler_tables();
 }
 
-#define UPDATE_BT_HASH(frame, hash)                         \
-    if(__builtin_frame_address(frame)) {                    \
-        hash ^= (uint64_t) __builtin_return_address(frame); \
-    } else {                                                \
-        return hash;                                        \
+/* Walks the frame pointer chain. __builtin_return_address()
+ * with a nonzero argument follows frame pointers blindly and
+ * faults in frames built without them, so each step is checked.
+ * The next frame must be aligned, above the current one and
+ * within a sane distance of it or the walk stops. The first
+ * skip return addresses are dropped, the rest are mixed in
+ * order into the returned hash so the same addresses in a
+ * different order produce a different hash */
+INTERNAL_HIDDEN NO_INLINE uint64_t _iso_unwind(uint64_t *callers, int32_t skip) {
+    uintptr_t *fp = (uintptr_t *) __builtin_frame_address(0);
+    uint64_t hash = 0;
+    int32_t depth = 0;
+
+    while(depth < BACKTRACE_DEPTH && fp != NULL) {
+        uintptr_t *next = (uintptr_t *) fp[0];
+        uint64_t ret = (uint64_t) fp[1];
+
+        if(ret < 0x1000) {
+            break;
+        }
+
+        if(skip > 0) {
+            skip--;
+        } else {
+            callers[depth++] = ret;
+            hash = (hash + ret) * 0x9e3779b97f4a7c15;
+            hash ^= hash >> 29;
+        }
+
+        if(next <= fp || ((uintptr_t) next & (sizeof(uintptr_t) - 1)) != 0 ||
+           ((uintptr_t) next - (uintptr_t) fp) > (1 << 20)) {
+            break;
+        }
+
+        fp = next;
     }
 
-INTERNAL_HIDDEN INLINE uint64_t _get_backtrace_hash(void) {
-    uint64_t hash = 0;
-    UPDATE_BT_HASH(1, hash);
-    UPDATE_BT_HASH(2, hash);
-    UPDATE_BT_HASH(3, hash);
-    UPDATE_BT_HASH(4, hash);
-    UPDATE_BT_HASH(5, hash);
-    UPDATE_BT_HASH(6, hash);
-    UPDATE_BT_HASH(7, hash);
-    UPDATE_BT_HASH(8, hash);
     return hash;
 }
 
-#define SAVE_BACKTRACE_FRAME(frame, bts)                                          \
-    if(__builtin_frame_address(frame)) {                                          \
-        uint64_t r = (uint64_t) __builtin_return_address(frame);                  \
-        if(r > 0x1000) {                                                          \
-            bts->callers[frame - 1] = (uint64_t) __builtin_return_address(frame); \
-        }                                                                         \
-    } else {                                                                      \
-        return;                                                                   \
-    }
-
-INTERNAL_HIDDEN INLINE void _save_alloc_backtrace(iso_alloc_traces_t *abts) {
-    SAVE_BACKTRACE_FRAME(1, abts);
-    SAVE_BACKTRACE_FRAME(2, abts);
-    SAVE_BACKTRACE_FRAME(3, abts);
-    SAVE_BACKTRACE_FRAME(4, abts);
-    SAVE_BACKTRACE_FRAME(5, abts);
-    SAVE_BACKTRACE_FRAME(6, abts);
-    SAVE_BACKTRACE_FRAME(7, abts);
-    SAVE_BACKTRACE_FRAME(8, abts);
-    return;
-}
-
-INTERNAL_HIDDEN INLINE void _save_free_backtrace(iso_free_traces_t *fbts) {
-    SAVE_BACKTRACE_FRAME(1, fbts);
-    SAVE_BACKTRACE_FRAME(2, fbts);
-    SAVE_BACKTRACE_FRAME(3, fbts);
-    SAVE_BACKTRACE_FRAME(4, fbts);
-    SAVE_BACKTRACE_FRAME(5, fbts);
-    SAVE_BACKTRACE_FRAME(6, fbts);
-    SAVE_BACKTRACE_FRAME(7, fbts);
-    SAVE_BACKTRACE_FRAME(8, fbts);
-    return;
-}
-
-INTERNAL_HIDDEN void _iso_output_profile() {
-    _iso_alloc_printf(profiler_fd, "allocated=%d\n", _alloc_count);
-    _iso_alloc_printf(profiler_fd, "alloc_sampled=%d\n", _alloc_sampled_count);
-    _iso_alloc_printf(profiler_fd, "freed=%d\n", _free_count);
-    _iso_alloc_printf(profiler_fd, "free_sampled=%d\n", _free_sampled_count);
+INTERNAL_HIDDEN void _profiler_flush(profiler_writer_t *w) {
+    size_t off = 0;
+
+    while(off < w->used && w->fd != ERR) {
+        ssize_t r = write(w->fd, &w->buf[off], w->used - off);
+
+        if(r <= 0) {
+            break;
+        }
+
+        off += r;
+    }
+
+    w->used = 0;
+}
+
+/* Buffered replacement for _iso_alloc_printf. No line
+ * the profiler writes comes close to PROFILER_LINE_MAX */
+INTERNAL_HIDDEN void _profiler_write(profiler_writer_t *w, const char *f, ...) {
+    if((sizeof(w->buf) - w->used) < PROFILER_LINE_MAX) {
+        _profiler_flush(w);
+    }
+
+    va_list arg;
+    va_start(arg, f);
+    w->used += _iso_alloc_vsnprintf(&w->buf[w->used], sizeof(w->buf) - w->used, f, arg);
+    va_end(arg);
+}
+
+INTERNAL_HIDDEN bool _profiler_open(profiler_writer_t *w, char *path, size_t path_sz, const char *suffix) {
+    size_t len = strlen(_profiler_path);
+    size_t slen = strlen(suffix);
+
+    if(len + slen + sizeof(PROFILER_TMP_SUFFIX) > path_sz) {
+        return false;
+    }
+
+    __iso_memcpy(path, _profiler_path, len);
+    __iso_memcpy(&path[len], suffix, slen);
+    __iso_memcpy(&path[len + slen], PROFILER_TMP_SUFFIX, sizeof(PROFILER_TMP_SUFFIX));
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    w->used = 0;
+    return w->fd != ERR;
+}
+
+/* Flushes and closes the temporary file and renames it over
+ * the previous snapshot so readers, and a process killed
+ * mid write, always leave a complete profile behind */
+INTERNAL_HIDDEN void _profiler_close(profiler_writer_t *w, char *path) {
+    _profiler_flush(w);
+    close(w->fd);
+    w->fd = ERR;
+
+    char final[PATH_MAX];
+    size_t len = strlen(path) - (sizeof(PROFILER_TMP_SUFFIX) - 1);
+    __iso_memcpy(final, path, len);
+    final[len] = '\0';
+
+    if(rename(path, final) == ERR) {
+        LOG("Could not rename profile %s", path);
+    }
+}
+
+#if __linux__ || __FreeBSD__
+/* Writes a mapping line for every executable segment
+ * of every loaded object. Addresses in the profile minus
+ * the base of the mapping containing them can be handed
+ * to addr2line along with the path */
+INTERNAL_HIDDEN int _profiler_write_mapping(struct dl_phdr_info *info, size_t size, void *data) {
+    profiler_writer_t *w = (profiler_writer_t *) data;
+    const char *path = info->dlpi_name;
+    char exe[PATH_MAX];
+
+    /* The main executable has no name */
+    if(path == NULL || path[0] == '\0') {
+        ssize_t r = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        exe[(r > 0) ? r : 0] = '\0';
+        path = exe;
+    }
+
+    for(int32_t i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if(ph->p_type != PT_LOAD || (ph->p_flags & PF_X) == 0) {
+            continue;
+        }
+
+        uint64_t start = info->dlpi_addr + ph->p_vaddr;
+        _profiler_write(w, "mapping=0x%x-0x%x,base=0x%x,path=%s\n", start, start + ph->p_memsz,
+                        (uint64_t) info->dlpi_addr, path);
+    }
+
+    return 0;
+}
+#endif
+
+/* Copies a backtrace table into a private mapping so it can
+ * be written out without holding the table lock. Returns
+ * NULL if the table is empty or the copy can't be mapped */
+INTERNAL_HIDDEN void *_profiler_table_snapshot(profiler_table_t *t, size_t *count, uint64_t *overflow, size_t *map_size) {
+    _lock_profiler_tables();
+    size_t n = t->count;
+    *overflow = t->overflow;
+    _unlock_profiler_tables();
+
+    *count = 0;
+    *map_size = 0;
+
+    if(n == 0) {
+        return NULL;
+    }
+
+    void *out = mmap_rw_pages(ROUND_UP_PAGE(n * t->entry_size), false, NULL);
+
+    if(out == NULL) {
+        return NULL;
+    }
+
+    *map_size = ROUND_UP_PAGE(n * t->entry_size);
+
+    /* The table may have been reset since it was sized */
+    size_t total = _profiler_table_copy(t, out, n);
+    *count = (total < n) ? total : n;
+    return out;
+}
+
+/* Recounts the zones of each chunk size and copies every
+ * size with zones or usage samples into out. The root is
+ * only locked for the copy. Returns the number of sizes */
+INTERNAL_HIDDEN size_t _profiler_zone_snapshot(zone_profile_entry_t *out, size_t max) {
+    size_t n = 0;
+
+    LOCK_ROOT();
+
+    for(int i = 0; i <= SMALL_SIZE_MAX; i++) {
+        _zone_profiler_map[i].total = 0;
+    }
 
     for(uint16_t i = 0; i < _root->zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
         _zone_profiler_map[zone->chunk_size].total++;
     }
 
-    for(size_t i = 0; i < _alloc_bts_count; i++) {
-        iso_alloc_traces_t *abts = &_alloc_bts[i];
-        _iso_alloc_printf(profiler_fd, "alloc_backtrace=%d,backtrace_hash=0x%x,calls=%d,lower_bound_size=%d,upper_bound_size=%d\n",
-                          i, abts->backtrace_hash, abts->call_count, abts->lower_bound_size, abts->upper_bound_size);
+    for(int i = 0; i <= SMALL_SIZE_MAX && n < max; i++) {
+        const uint64_t count = __atomic_load_n(&_zone_profiler_map[i].count, __ATOMIC_RELAXED);
 
-        for(int j = 0; j < BACKTRACE_DEPTH; j++) {
-            if(abts->callers[j] < 0x1000) {
-                continue;
-            }
+        if(_zone_profiler_map[i].total != 0 || count != 0) {
+            out[n].size = i;
+            out[n].total = _zone_profiler_map[i].total;
+            out[n].count = count;
+            n++;
+        }
+    }
+
+    UNLOCK_ROOT();
+    return n;
+}
+
+/* Writes a snapshot of the profile. The profile file holds
+ * raw return addresses and the mappings needed to symbolize
+ * them offline, nothing is symbolized in process. A second
+ * file holds the allocation stacks in the folded format read
+ * by flamegraph.pl, weighted by estimated bytes allocated.
+ * Must be called without the root locked. The backtrace
+ * tables and zone counts are copied out under their locks
+ * and the files are written after they are released. Taking
+ * the loader lock in dl_iterate_phdr with the root locked
+ * would deadlock against a thread calling malloc in dlopen */
+INTERNAL_HIDDEN void _iso_write_profile(void) {
+    iso_alloc_profiler_slot_t total = {0};
+    profiler_writer_t *w = &_profiler_writer;
+    char path[PATH_MAX];
+
+    while(__atomic_test_and_set(&_profiler_writing, __ATOMIC_ACQUIRE)) {
+    }
+
+    for(int32_t i = 0; i < PROFILER_SLOTS; i++) {
+        iso_alloc_profiler_slot_t *ps = &_profiler_slots[i];
+        total.alloc_count += __atomic_load_n(&ps->alloc_count, __ATOMIC_RELAXED);
+        total.alloc_bytes += __atomic_load_n(&ps->alloc_bytes, __ATOMIC_RELAXED);
+        total.alloc_sampled_count += __atomic_load_n(&ps->alloc_sampled_count, __ATOMIC_RELAXED);
+        total.alloc_sample_points += __atomic_load_n(&ps->alloc_sample_points, __ATOMIC_RELAXED);
+        total.free_count += __atomic_load_n(&ps->free_count, __ATOMIC_RELAXED);
+        total.free_sampled_count += __atomic_load_n(&ps->free_sampled_count, __ATOMIC_RELAXED);
+    }
+
+    size_t alloc_count, free_count, alloc_map_size, free_map_size;
+    uint64_t alloc_overflow, free_overflow;
+    iso_alloc_traces_t *abts = (iso_alloc_traces_t *) _profiler_table_snapshot(&_alloc_bts, &alloc_count, &alloc_overflow, &alloc_map_size);
+    iso_free_traces_t *fbts = (iso_free_traces_t *) _profiler_table_snapshot(&_free_bts, &free_count, &free_overflow, &free_map_size);
+
+    /* Chunk sizes are multiples of SZ_ALIGNMENT */
+    const size_t zone_max = (SMALL_SIZE_MAX / SZ_ALIGNMENT) + 1;
+    const size_t zone_map_size = ROUND_UP_PAGE(zone_max * sizeof(zone_profile_entry_t));
+    zone_profile_entry_t *zones = (zone_profile_entry_t *) mmap_rw_pages(zone_map_size, false, NULL);
+    size_t zone_count = 0;
+
+    if(zones != NULL) {
+        zone_count = _profiler_zone_snapshot(zones, zone_max);
+    }
+
+    if(_profiler_open(w, path, sizeof(path), "") == false) {
+        LOG("Cannot open file descriptor for %s", _profiler_path);
+        goto done;
+    }
+
+    _profiler_write(w, "allocated=%lu\n", total.alloc_count);
+    _profiler_write(w, "allocated_bytes=%lu\n", total.alloc_bytes);
+    _profiler_write(w, "sample_interval_bytes=%d\n", _root->conf.profiler_sample_bytes);
+    _profiler_write(w, "alloc_sampled=%lu\n", total.alloc_sampled_count);
+    _profiler_write(w, "alloc_sampled_bytes=%lu\n", total.alloc_sample_points * _root->conf.profiler_sample_bytes);
+    _profiler_write(w, "freed=%lu\n", total.free_count);
+    _profiler_write(w, "free_sampled=%lu\n", total.free_sampled_count);
+
+#if LOCK_PROFILER
+    const char *lock_names[ISO_ALLOC_LOCKS] = {"root", "big_zone_free", "big_zone_used", "sanity_cache"};
+    iso_alloc_lock_profile_t lock_profile;
+    _iso_alloc_get_lock_profile(&lock_profile);
+
+    for(int32_t i = 0; i < ISO_ALLOC_LOCKS; i++) {
+        iso_alloc_lock_stats_t *ls = &lock_profile.locks[i];
+        _profiler_write(w, "lock=%s,acquisitions=%lu,contended=%lu,total_wait_ns=%lu,max_wait_ns=%lu,max_wait_holder=%s\n",
+                        lock_names[i], ls->acquisitions, ls->contended, ls->total_wait_ns, ls->max_wait_ns,
+                        ls->max_wait_holder ? ls->max_wait_holder : "none");
+    }
+#endif
+
+#if __linux__ || __FreeBSD__
+    dl_iterate_phdr(_profiler_write_mapping, w);
+#endif
+
+    _profiler_write(w, "alloc_backtraces=%lu\n", alloc_count);
+    _profiler_write(w, "alloc_backtrace_overflow=%lu\n", alloc_overflow);
+    _profiler_write(w, "free_backtraces=%lu\n", free_count);
+    _profiler_write(w, "free_backtrace_overflow=%lu\n", free_overflow);
 
-            Dl_info dl;
-            dladdr((void *) abts->callers[j], &dl);
+    for(size_t i = 0; i < alloc_count; i++) {
+        _profiler_write(w, "alloc_backtrace=%d,backtrace_hash=0x%x,calls=%d,lower_bound_size=%d,upper_bound_size=%d,estimated_bytes=%lu\n",
+                        i, abts[i].backtrace_hash, abts[i].call_count, abts[i].lower_bound_size, abts[i].upper_bound_size, abts[i].estimated_bytes);
 
-            if(dl.dli_sname != NULL) {
-                _iso_alloc_printf(profiler_fd, "\t0x%x -> %s %s\n", abts->callers[j], dl.dli_sname, dl.dli_fname);
-            } else {
-                _iso_alloc_printf(profiler_fd, "\t0x%x -> [?]\n", abts->callers[j]);
+        for(int j = 0; j < BACKTRACE_DEPTH; j++) {
+            if(abts[i].callers[j] >= 0x1000) {
+                _profiler_write(w, "\t0x%x\n", abts[i].callers[j]);
             }
         }
     }
 
-    for(size_t i = 0; i < _free_bts_count; i++) {
-        iso_free_traces_t *fbts = &_free_bts[i];
-        _iso_alloc_printf(profiler_fd, "free_backtrace=%d,backtrace_hash=0x%x,calls=%d\n",
-                          i, fbts->backtrace_hash, fbts->call_count);
+    for(size_t i = 0; i < free_count; i++) {
+        _profiler_write(w, "free_backtrace=%d,backtrace_hash=0x%x,calls=%d\n",
+                        i, fbts[i].backtrace_hash, fbts[i].call_count);
 
         for(int j = 0; j < BACKTRACE_DEPTH; j++) {
-            if(fbts->callers[j] < 0x1000) {
-                continue;
+            if(fbts[i].callers[j] >= 0x1000) {
+                _profiler_write(w, "\t0x%x\n", fbts[i].callers[j]);
             }
+        }
+    }
+
+    for(size_t i = 0; i < zone_count; i++) {
+        _profiler_write(w, "%d,%d,%d\n", zones[i].size, zones[i].total, zones[i].count);
+    }
 
-            Dl_info dl;
-            dladdr((void *) fbts->callers[j], &dl);
+    _profiler_close(w, path);
 
-            if(dl.dli_sname != NULL) {
-                _iso_alloc_printf(profiler_fd, "\t0x%x -> %s %s\n", fbts->callers[j], dl.dli_sname, dl.dli_fname);
-            } else {
-                _iso_alloc_printf(profiler_fd, "\t0x%x -> [?]\n", fbts->callers[j]);
+    if(_profiler_open(w, path, sizeof(path), PROFILER_FOLDED_SUFFIX) == false) {
+        LOG("Cannot open file descriptor for %s%s", _profiler_path, PROFILER_FOLDED_SUFFIX);
+        goto done;
+    }
+
+    /* Folded stacks are written outermost frame first */
+    for(size_t i = 0; i < alloc_count; i++) {
+        const char *sep = "";
+
+        for(int j = BACKTRACE_DEPTH - 1; j >= 0; j--) {
+            if(abts[i].callers[j] >= 0x1000) {
+                _profiler_write(w, "%s0x%x", sep, abts[i].callers[j]);
+                sep = ";";
             }
         }
+
+        _profiler_write(w, " %lu\n", abts[i].estimated_bytes);
     }
 
-    for(int i = 0; i < SMALL_SIZE_MAX; i++) {
-        if(_zone_profiler_map[i].count != 0) {
-            _iso_alloc_printf(profiler_fd, "%d,%d,%d\n", i, _zone_profiler_map[i].total, _zone_profiler_map[i].count);
-        }
+    _profiler_close(w, path);
+
+done:
+    if(abts != NULL) {
+        munmap(abts, alloc_map_size);
+    }
+
+    if(fbts != NULL) {
+        munmap(fbts, free_map_size);
     }
 
-    if(profiler_fd != ERR) {
-        close(profiler_fd);
-        profiler_fd = ERR;
+    if(zones != NULL) {
+        munmap(zones, zone_map_size);
     }
+
+    __atomic_clear(&_profiler_writing, __ATOMIC_RELEASE);
+}
+
+INTERNAL_HIDDEN void _iso_alloc_write_profile(void) {
+    _iso_write_profile();
 }
 
+/* Called when the process exits, before the root is locked */
+INTERNAL_HIDDEN void _iso_output_profile(void) {
+    _iso_write_profile();
+}
+
+/* Called before the root is locked */
 INTERNAL_HIDDEN void _iso_alloc_profile(size_t size) {
-    _alloc_count++;
+    iso_alloc_profiler_thread_t *pt = PROFILER_THREAD();
+    PROFILER_ADD(pt, alloc_count, 1);
+    PROFILER_ADD(pt, alloc_bytes, size);
+
+    pt->alloc_countdown -= size;
 
-    /* Don't run the profiler on every allocation */
-    if(LIKELY((us_rand_uint64(&_root->seed) % PROFILER_ODDS) != 1)) {
+    if(LIKELY(pt->alloc_countdown > 0)) {
         return;
     }
 
-    _alloc_sampled_count++;
+    /* A large allocation may cover several sample
+     * points and is weighted by all of them */
+    uint64_t points = 0;
 
-    for(uint16_t i = 0; i < _root->zones_used; i++) {
-        uint32_t used = 0;
+    while(pt->alloc_countdown <= 0) {
+        pt->alloc_countdown += _profiler_next_interval(&pt->seed, _root->conf.profiler_sample_bytes);
+        points++;
+    }
+
+    PROFILER_ADD(pt, alloc_sampled_count, 1);
+    PROFILER_ADD(pt, alloc_sample_points, points);
+
+    /* Zone usage comes from the live chunk count. The zone
+     * array is never unmapped so it's read without the root
+     * lock, a zone changing under the read only skews this
+     * sample. Scanning every zone bitmap here made the cost
+     * of a sample grow with the size of the heap */
+    const uint16_t zones_used = __atomic_load_n(&_root->zones_used, __ATOMIC_RELAXED);
+
+    for(uint16_t i = 0; i < zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
+        const uint32_t chunk_size = __atomic_load_n(&zone->chunk_size, __ATOMIC_RELAXED);
+        const uint32_t chunk_count = __atomic_load_n(&zone->chunk_count, __ATOMIC_RELAXED);
+        uint32_t used = 100;
 
-        /* For the purposes of the profiler we don't care about
-         * the differences between canary and leaked chunks.
-         * So lets just use the full count */
-        if(zone->is_full) {
-            used = zone->chunk_count;
-        } else {
-            used = _iso_alloc_zone_leak_detector(zone, true);
+        if(chunk_count == 0 || chunk_size > SMALL_SIZE_MAX) {
+            continue;
         }
 
-        used = (int32_t) ((float) (used / zone->chunk_count) * 100.0);
+        if(__atomic_load_n(&zone->is_full, __ATOMIC_RELAXED) == false) {
+            used = (__atomic_load_n(&zone->af_count, __ATOMIC_RELAXED) * 100) / chunk_count;
+        }
 
         if(used > CHUNK_USAGE_THRESHOLD) {
-            _zone_profiler_map[zone->chunk_size].count++;
+            __atomic_fetch_add(&_zone_profiler_map[chunk_size].count, 1, __ATOMIC_RELAXED);
         }
     }
 
-    if(_alloc_bts_count < BACKTRACE_DEPTH_SZ) {
-        iso_alloc_traces_t *abts = NULL;
-        uint16_t hash = (_get_backtrace_hash() & HG_SIZE);
+    /* Skip the unwinder and this function so the first
+     * caller recorded is the IsoAlloc API that was called */
+    uint64_t callers[BACKTRACE_DEPTH] = {0};
+    uint64_t hash = _iso_unwind(callers, 2);
 
-        /* Take the backtrace hash and determine if its already been seen */
-        for(size_t i = 0; i < _alloc_bts_count; i++) {
-            if(_alloc_bts[i].backtrace_hash == hash) {
-                abts = &_alloc_bts[i];
+    _lock_profiler_tables();
 
-                if(abts->lower_bound_size == 0 || size < abts->lower_bound_size) {
-                    abts->lower_bound_size = size;
-                }
+    iso_alloc_traces_t *abts = (iso_alloc_traces_t *) _profiler_table_get(&_alloc_bts, hash);
 
-                if(abts->upper_bound_size == 0 || size > abts->upper_bound_size) {
-                    abts->upper_bound_size = size;
-                }
+    if(abts != NULL) {
+        /* We haven't seen this backtrace before */
+        if(abts->call_count == 0) {
+            abts->backtrace_hash = hash;
+            __iso_memcpy(abts->callers, callers, sizeof(callers));
+        }
 
-                abts->call_count++;
-                break;
-            }
+        if(abts->lower_bound_size == 0 || size < abts->lower_bound_size) {
+            abts->lower_bound_size = size;
         }
 
-        /* We haven't seen this backtrace before */
-        if(abts == NULL) {
-            abts = &_alloc_bts[_alloc_bts_count];
-            abts->backtrace_hash = hash;
+        if(abts->upper_bound_size == 0 || size > abts->upper_bound_size) {
+            abts->upper_bound_size = size;
+        }
+
+        abts->call_count++;
+        abts->estimated_bytes += points * _root->conf.profiler_sample_bytes;
+    }
+
+    _unlock_profiler_tables();
 
-            _save_alloc_backtrace(abts);
-            _alloc_bts_count++;
+    /* Only the thread that moves the deadline forward marks
+     * the snapshot due, the caller writes it right after */
+    if(_profiler_interval_ns != 0) {
+        const uint64_t now = _iso_latency_now();
+        uint64_t next = __atomic_load_n(&_profiler_next_snapshot, __ATOMIC_RELAXED);
+
+        if(now >= next && __atomic_compare_exchange_n(&_profiler_next_snapshot, &next, now + _profiler_interval_ns, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&_profiler_snapshot_due, true, __ATOMIC_RELEASE);
         }
     }
 }
 
 INTERNAL_HIDDEN void _iso_free_profile(void) {
-    _free_count++;
+    iso_alloc_profiler_thread_t *pt = PROFILER_THREAD();
+    PROFILER_ADD(pt, free_count, 1);
 
-    /* Don't run the profiler on every allocation */
-    if(LIKELY((us_rand_uint64(&_root->seed) % PROFILER_ODDS) != 1)) {
+    if(LIKELY(--pt->free_countdown > 0)) {
         return;
     }
 
-    _free_sampled_count++;
+    pt->free_countdown = _profiler_next_interval(&pt->seed, _root->conf.profiler_odds);
+    PROFILER_ADD(pt, free_sampled_count, 1);
 
-    if(_free_bts_count < BACKTRACE_DEPTH_SZ) {
-        iso_free_traces_t *fbts = NULL;
-        uint16_t hash = (_get_backtrace_hash() & HG_SIZE);
+    uint64_t callers[BACKTRACE_DEPTH] = {0};
+    uint64_t hash = _iso_unwind(callers, 2);
 
-        /* Take the backtrace hash and determine if its already been seen */
-        for(size_t i = 0; i < _free_bts_count; i++) {
-            if(_free_bts[i].backtrace_hash == hash) {
-                fbts = &_free_bts[i];
-                fbts->call_count++;
-                break;
-            }
-        }
+    _lock_profiler_tables();
+
+    iso_free_traces_t *fbts = (iso_free_traces_t *) _profiler_table_get(&_free_bts, hash);
 
+    if(fbts != NULL) {
         /* We haven't seen this backtrace before */
-        if(fbts == NULL) {
-            fbts = &_free_bts[_free_bts_count];
+        if(fbts->call_count == 0) {
             fbts->backtrace_hash = hash;
-
-            _save_free_backtrace(fbts);
-            _free_bts_count++;
+            __iso_memcpy(fbts->callers, callers, sizeof(callers));
         }
+
+        fbts->call_count++;
     }
+
+    _unlock_profiler_tables();
 }
 
 INTERNAL_HIDDEN void _initialize_profiler(void) {
-    /* We don't need thread safety for this file descriptor
-     * as long as we guarantee to never use it if the root
-     * is not locked */
-    if(getenv(PROFILER_ENV_STR) != NULL) {
-        profiler_fd = open(getenv(PROFILER_ENV_STR), O_RDWR | O_CREAT | O_SYNC, 0666);
-    } else {
-        profiler_fd = open(PROFILER_FILE_PATH, O_RDWR | O_CREAT | O_SYNC, 0666);
+    const char *path = getenv(PROFILER_ENV_STR);
+
+    if(path == NULL) {
+        path = PROFILER_FILE_PATH;
     }
 
-    if(profiler_fd == ERR) {
-        LOG_AND_ABORT("Cannot open file descriptor for %s", PROFILER_FILE_PATH);
+    size_t len = strlen(path);
+
+    if(len >= sizeof(_profiler_path)) {
+        LOG_AND_ABORT("Profiler path %s is too long", path);
     }
+
+    __iso_memcpy(_profiler_path, path, len + 1);
+    _profiler_writer.fd = ERR;
+
+    /* Fail early if the profile can't be written */
+    int32_t fd = open(_profiler_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if(fd == ERR) {
+        LOG_AND_ABORT("Cannot open file descriptor for %s", _profiler_path);
+    }
+
+    close(fd);
+
+    /* The interval is read without strtoul
+     * because it may call malloc */
+    const char *interval = getenv(PROFILER_INTERVAL_ENV_STR);
+    uint64_t seconds = 0;
+
+    while(interval != NULL && *interval >= '0' && *interval <= '9') {
+        seconds = (seconds * 10) + (*interval - '0');
+        interval++;
+    }
+
+    _profiler_interval_ns = seconds * 1000000000;
+    _profiler_next_snapshot = _iso_latency_now() + _profiler_interval_ns;
 }
 #endif
@@ -23,16 +23,17 @@ INTERNAL_HIDDEN void _verify_all_zones(void) {
 INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone_t *zone) {
     return;
 }
-#else
-/* Verify the integrity of all canary chunks and the
- * canary written to all free chunks. This function
- * either aborts or returns nothing */
-INTERNAL_HIDDEN void verify_all_zones(void) {
-    LOCK_ROOT();
-    _verify_all_zones();
-    UNLOCK_ROOT();
+
+INTERNAL_HIDDEN int64_t _verify_zone_bitmap(iso_alloc_zone_t *zone, const bitmap_index_t *bm, bool abort_on_fail) {
+    return OK;
 }
 
+#if INCREMENTAL_VERIFY
+INTERNAL_HIDDEN void _verify_zones_incremental(void) {
+    return;
+}
+#endif
+#else
 INTERNAL_HIDDEN void verify_zone(iso_alloc_zone_t *zone) {
     LOCK_ROOT();
     _verify_zone(zone);
@@ -69,6 +70,18 @@ INTERNAL_HIDDEN void _verify_big_zone_list(iso_alloc_big_zone_t *head) {
     }
 }
 
+/* Verifies both big zone lists, each under its own lock.
+ * Callers may hold the root lock, it's always taken first */
+INTERNAL_HIDDEN void _verify_big_zones(void) {
+    LOCK_BIG_ZONE_USED();
+    _verify_big_zone_list(_root->big_zone_used);
+    UNLOCK_BIG_ZONE_USED();
+
+    LOCK_BIG_ZONE_FREE();
+    _verify_big_zone_list(_root->big_zone_free);
+    UNLOCK_BIG_ZONE_FREE();
+}
+
 INTERNAL_HIDDEN void _verify_all_zones(void) {
     const uint16_t zones_used = _root->zones_used;
 
@@ -83,14 +96,78 @@ INTERNAL_HIDDEN void _verify_all_zones(void) {
     }
 
     /* Root is locked already */
-    _verify_big_zone_list(_root->big_zone_used);
-    _verify_big_zone_list(_root->big_zone_free);
+    _verify_big_zones();
 }
 
-INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone_t *zone) {
-    UNMASK_ZONE_PTRS(zone);
+/* Verify the integrity of all canary chunks and the
+ * canary written to all free chunks. This function
+ * either aborts or returns nothing. Zones are checked
+ * against a snapshot of their bitmaps so the root lock
+ * is only held while the snapshot is taken */
+INTERNAL_HIDDEN void verify_all_zones(void) {
+    _iso_alloc_scan_zones(ZONE_SCAN_VERIFY);
+
+    _verify_big_zones();
+}
+
+/* Checks the canaries of every chunk with its second bit
+ * set in bitmap qword i. Returns the number of chunks that
+ * were checked, or ERR on a bad canary if abort_on_fail
+ * is not set */
+INTERNAL_HIDDEN INLINE int64_t _verify_bitmap_qword(iso_alloc_zone_t *zone, bitmap_index_t bits, bitmap_index_t i, bool abort_on_fail) {
+    /* One bit per chunk, at the position of its first bit */
+    uint64_t freed = (bits >> 1) & USED_BIT_VECTOR;
+    int64_t checked = 0;
+
+    if(bits == CANARY_UNWRITTEN_QWORD) {
+        const void *p = POINTER_FROM_BITSLOT(zone, (i << BITS_PER_QWORD_SHIFT));
+
+        if(abort_on_fail == true) {
+            check_unwritten_canary(zone, p);
+        } else if(check_unwritten_canary_no_abort(zone, p) == ERR) {
+            return ERR;
+        }
+
+        return 1;
+    }
+
+    while(freed != 0) {
+        const bit_slot_t bit_slot = (i << BITS_PER_QWORD_SHIFT) + __builtin_ctzll(freed);
+        const void *p = POINTER_FROM_BITSLOT(zone, bit_slot);
+        freed &= (freed - 1);
+        checked++;
+
+        if(abort_on_fail == true) {
+            check_canary(zone, p);
+        } else if(check_canary_no_abort(zone, p) == ERR) {
+            return ERR;
+        }
+    }
+
+    return checked;
+}
+
+/* Every chunk with its second bit set is either a free
+ * chunk or a canary chunk. Either way it should have a
+ * set of canaries we can verify. The zone must be unmasked
+ * but bm can be a copy of its bitmap. Returns ERR on the
+ * first bad canary unless abort_on_fail is set */
+INTERNAL_HIDDEN int64_t _verify_zone_bitmap(iso_alloc_zone_t *zone, const bitmap_index_t *bm, bool abort_on_fail) {
+    for(bitmap_index_t i = 0; i < zone->max_bitmap_idx; i++) {
+        if(_verify_bitmap_qword(zone, bm[i], i, abort_on_fail) == ERR) {
+            return ERR;
+        }
+    }
+
+    return OK;
+}
+
+/* Checks the zone links and that every bit slot waiting in
+ * the free bit slot cache is a free chunk. A corrupted cache
+ * would hand out a chunk that is still in use. The zone
+ * must be unmasked */
+INTERNAL_HIDDEN void _verify_zone_metadata(iso_alloc_zone_t *zone) {
     const bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
-    bit_slot_t bit_slot;
 
     if(zone->next_sz_index > _root->zones_used) {
         LOG_AND_ABORT("Detected corruption in zone[%d] next_sz_index=%d", zone->index, zone->next_sz_index);
@@ -103,22 +180,95 @@ INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone_t *zone) {
         }
     }
 
-    for(bitmap_index_t i = 0; i < zone->max_bitmap_idx; i++) {
-        bit_slot_t bsl = bm[i];
-        for(int64_t j = 1; j < BITS_PER_QWORD; j += BITS_PER_CHUNK) {
-            /* If this bit is set it is either a free chunk or
-             * a canary chunk. Either way it should have a set
-             * of canaries we can verify */
-            if((GET_BIT(bsl, j)) == 1) {
-                bit_slot = (i << BITS_PER_QWORD_SHIFT) + j;
-                const void *p = POINTER_FROM_BITSLOT(zone, bit_slot);
-                check_canary(zone, p);
-            }
+    for(free_bit_slot_t i = zone->free_bit_slots_usable; i < zone->free_bit_slots_index && i < ZONE_FREE_LIST_SZ; i++) {
+        const bit_slot_t bit_slot = zone->free_bit_slots[i];
+
+        if(UNLIKELY(bit_slot < 0 || bit_slot >= ((bit_slot_t) zone->chunk_count * BITS_PER_CHUNK) ||
+                    (GET_BIT(bm[bit_slot >> BITS_PER_QWORD_SHIFT], WHICH_BIT(bit_slot))) == 1)) {
+            LOG_AND_ABORT("Zone[%d] free bit slot cache entry %d holds bad bit slot %ld", zone->index, i, bit_slot);
         }
     }
+}
 
+INTERNAL_HIDDEN void _verify_zone(iso_alloc_zone_t *zone) {
+    UNMASK_ZONE_PTRS(zone);
+    _verify_zone_metadata(zone);
+    _verify_zone_bitmap(zone, (bitmap_index_t *) zone->bitmap_start, true);
     MASK_ZONE_PTRS(zone);
 }
+
+#if INCREMENTAL_VERIFY
+/* Verifies the next slice of the heap, picking up where the
+ * last call stopped. The slice is bounded by time rather than
+ * work so its share of the time between slices holds however
+ * costly a canary check is. A zone's metadata is checked when
+ * its bitmap is started. After the last zone the big zone
+ * lists are verified and the next call starts again from the
+ * first zone. The root must be locked */
+INTERNAL_HIDDEN void _verify_zones_incremental(void) {
+    uint64_t now = _iso_latency_now();
+    uint64_t slice = (now - _root->verify_last_ns) / VERIFY_TIME_DIVISOR;
+
+    /* Too little time has passed, the next call gets it */
+    if(slice < VERIFY_SLICE_MIN_NS) {
+        return;
+    }
+
+    if(slice > VERIFY_SLICE_MAX_NS) {
+        slice = VERIFY_SLICE_MAX_NS;
+    }
+
+    const uint64_t deadline = now + slice;
+
+    while(now < deadline) {
+        int64_t budget = VERIFY_BUDGET;
+
+        while(budget > 0) {
+            iso_alloc_zone_t *zone = &_root->zones[_root->verify_zone];
+
+            if(_root->verify_zone >= _root->zones_used || zone->bitmap_start == NULL) {
+                _root->verify_zone = 0;
+                _root->verify_bitmap_idx = 0;
+                _verify_big_zones();
+                _root->verify_last_ns = _iso_latency_now();
+                return;
+            }
+
+            UNMASK_ZONE_PTRS(zone);
+
+            const bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+            bitmap_index_t i = _root->verify_bitmap_idx;
+            int64_t metadata_cost = 0;
+
+            if(i == 0) {
+                _verify_zone_metadata(zone);
+                metadata_cost = zone->free_bit_slots_index - zone->free_bit_slots_usable;
+            }
+
+            /* At least one qword is checked so a large free bit
+             * slot cache can't keep the slice from moving forward */
+            for(; i < zone->max_bitmap_idx && budget > 0; i++) {
+                budget -= 1 + _verify_bitmap_qword(zone, bm[i], i, true);
+            }
+
+            budget -= metadata_cost;
+
+            MASK_ZONE_PTRS(zone);
+
+            if(i >= zone->max_bitmap_idx) {
+                _root->verify_zone++;
+                i = 0;
+            }
+
+            _root->verify_bitmap_idx = i;
+        }
+
+        now = _iso_latency_now();
+    }
+
+    _root->verify_last_ns = now;
+}
+#endif
 #endif
 
 #if ALLOC_SANITY
@@ -133,7 +283,9 @@ pthread_mutex_t sane_cache_mutex;
 
 uint64_t _sanity_canary;
 int32_t _sane_sampled;
-uint8_t _sane_cache[SANE_CACHE_SIZE];
+void *_sane_region;
+uint16_t _sane_free_slots[MAX_SANE_SAMPLES];
+uint16_t _sane_free_count;
 _sane_allocation_t _sane_allocations[MAX_SANE_SAMPLES];
 
 #if UNINIT_READ_SANITY
@@ -301,108 +453,145 @@ INTERNAL_HIDDEN INLINE void check_sanity_canary(_sane_allocation_t *sane_alloc)
     }
 }
 
+/* Reserves every slot up front so sampling an allocation
+ * never calls mmap. The whole region starts out PROT_NONE
+ * and a slot is only readable while it holds a sample */
+INTERNAL_HIDDEN void _iso_alloc_initialize_sanity(void) {
+    _sane_region = mmap_pages(SANE_REGION_SIZE, false, SAMPLED_ALLOC_NAME, PROT_NONE);
+
+    for(uint32_t i = 0; i < MAX_SANE_SAMPLES; i++) {
+        _sane_free_slots[i] = i;
+    }
+
+    _sane_free_count = MAX_SANE_SAMPLES;
+    _sanity_canary = us_rand_uint64(&_root->seed);
+}
+
+/* Checks whether p could be a sampled allocation without
+ * taking the sanity lock. The region never moves so this
+ * is a single range check */
+INTERNAL_HIDDEN bool _iso_alloc_maybe_sampled(const void *p) {
+    return ((uintptr_t) p - (uintptr_t) _sane_region) < SANE_REGION_SIZE;
+}
+
 /* Callers of this function should hold the sanity cache lock */
 INTERNAL_HIDDEN _sane_allocation_t *_get_sane_alloc(void *p) {
-    if(_sane_cache[SANE_CACHE_IDX(p)] == 0) {
+    const uint64_t page = ((uintptr_t) p - (uintptr_t) _sane_region) >> g_page_size_shift;
+
+    /* Even pages are the guard pages between slots */
+    if(page >= ((MAX_SANE_SAMPLES * 2) + 1) || (page & 1) == 0) {
         return NULL;
     }
 
-    void *pa = NULL;
-
-    if(IS_PAGE_ALIGNED((uintptr_t) p)) {
-        pa = (void *) ROUND_DOWN_PAGE((uintptr_t) p);
-    } else {
-        pa = p;
-    }
+    _sane_allocation_t *sane_alloc = &_sane_allocations[page >> 1];
 
-    for(uint32_t i = 0; i < MAX_SANE_SAMPLES; i++) {
-        if(_sane_allocations[i].address == pa) {
-            return &_sane_allocations[i];
-        }
+    if(sane_alloc->address == NULL) {
+        return NULL;
     }
 
-    return NULL;
+    return sane_alloc;
 }
 
 INTERNAL_HIDDEN int32_t _iso_alloc_free_sane_sample(void *p) {
+    if(LIKELY(_iso_alloc_maybe_sampled(p) == false)) {
+        return ERR;
+    }
+
     LOCK_SANITY_CACHE();
     _sane_allocation_t *sane_alloc = _get_sane_alloc(p);
 
-    if(sane_alloc != NULL) {
-        check_sanity_canary(sane_alloc);
-        unmap_guarded_pages(sane_alloc->address, g_page_size);
-        memset(sane_alloc, 0x0, sizeof(_sane_allocation_t));
-        _sane_cache[SANE_CACHE_IDX(p)]--;
-        _sane_sampled--;
-        UNLOCK_SANITY_CACHE();
-        return OK;
+    /* Nothing but samples is ever returned from the region */
+    if(UNLIKELY(sane_alloc == NULL)) {
+        LOG_AND_ABORT("Freeing %p which is not a live sampled allocation", p);
+    }
+
+    void *user_ptr = sane_alloc->address;
+
+    if(sane_alloc->right_aligned == true) {
+        user_ptr = (sane_alloc->address + g_page_size) - sane_alloc->orig_size;
     }
 
+    if(UNLIKELY(user_ptr != p)) {
+        LOG_AND_ABORT("Freeing %p which points inside of sampled allocation %p", p, user_ptr);
+    }
+
+    check_sanity_canary(sane_alloc);
+
+#if UNINIT_READ_SANITY
+    /* The page may still be registered if it was never written
+     * to. Discard it so the next sample in this slot faults */
+    struct uffdio_range range = {.start = (uint64_t) sane_alloc->address, .len = g_page_size};
+    ioctl(_uf_fd, UFFDIO_UNREGISTER, &range);
+#endif
+
+    /* Drop the sample's contents with the page, the slot
+     * stays inaccessible until it's reused so any dangling
+     * pointer to it faults */
+    dont_need_pages(sane_alloc->address, g_page_size);
+    mprotect_pages(sane_alloc->address, g_page_size, PROT_NONE);
+    _sane_free_slots[_sane_free_count++] = sane_alloc - _sane_allocations;
+    memset(sane_alloc, 0x0, sizeof(_sane_allocation_t));
+    _sane_sampled--;
     UNLOCK_SANITY_CACHE();
-    return ERR;
+    return OK;
 }
 
 INTERNAL_HIDDEN void *_iso_alloc_sample(const size_t size) {
 #if UNINIT_READ_SANITY
-    if(_page_fault_thread == 0 || LIKELY((us_rand_uint64(&_root->seed) % SANITY_SAMPLE_ODDS) != 1)) {
+    if(_page_fault_thread == 0 || LIKELY((us_rand_uint64(&_root->seed) % _root->conf.sanity_sample_odds) != 0)) {
 #else
-    if(LIKELY((us_rand_uint64(&_root->seed) % SANITY_SAMPLE_ODDS) != 1)) {
+    if(LIKELY((us_rand_uint64(&_root->seed) % _root->conf.sanity_sample_odds) != 0)) {
 #endif
         return NULL;
     }
 
-    _sane_allocation_t *sane_alloc = NULL;
-
     LOCK_SANITY_CACHE();
     UNLOCK_ROOT();
 
-    /* Find the first free slot in our sampled storage */
-    for(uint32_t i = 0; i < MAX_SANE_SAMPLES; i++) {
-        if(_sane_allocations[i].address == 0) {
-            sane_alloc = &_sane_allocations[i];
-            break;
-        }
-    }
-
     /* There are no available slots in the cache */
-    if(sane_alloc == NULL) {
+    if(_sane_free_count == 0) {
         LOG_AND_ABORT("There are no free slots in the cache, there should be %d", _sane_sampled);
     }
 
+    /* Take a random free slot so a freed slot isn't
+     * immediately handed back out, which would hide
+     * a use after free of the previous sample */
+    const uint32_t idx = us_rand_uint64(&_root->seed) % _sane_free_count;
+    const uint16_t slot = _sane_free_slots[idx];
+    _sane_free_slots[idx] = _sane_free_slots[--_sane_free_count];
+
+    _sane_allocation_t *sane_alloc = &_sane_allocations[slot];
     sane_alloc->orig_size = size;
-    void *p = mmap_guarded_rw_pages(g_page_size, false, SAMPLED_ALLOC_NAME);
 
-    if(p == NULL) {
-        LOG_AND_ABORT("Cannot allocate pages for sampled allocation");
-    }
+    void *p = SANE_SLOT_ADDR(slot);
+    mprotect_pages(p, g_page_size, PROT_READ | PROT_WRITE);
+    sane_alloc->address = p;
 
-    /* We may right align the mapping to catch overflows */
-    if((us_rand_uint64(&_root->seed) % 2) == 1) {
+    /* We may right align the allocation to catch overflows */
+    if(size != 0 && (us_rand_uint64(&_root->seed) % 2) == 1) {
         p = (p + g_page_size) - sane_alloc->orig_size;
         sane_alloc->right_aligned = true;
-        sane_alloc->address = (void *) ROUND_DOWN_PAGE((uintptr_t) p);
-    } else {
-        sane_alloc->address = p;
     }
 
+    _sane_sampled++;
+
 #if UNINIT_READ_SANITY
     struct uffdio_register reg = {0};
-    reg.range.start = (uint64_t) ROUND_DOWN_PAGE((uintptr_t) p);
+    reg.range.start = (uint64_t) sane_alloc->address;
     reg.range.len = g_page_size;
     reg.mode = UFFDIO_REGISTER_MODE_MISSING;
-#endif
 
-    _sane_cache[SANE_CACHE_IDX(p)]++;
-    _sane_sampled++;
-
-#if UNINIT_READ_SANITY
     if((ioctl(_uf_fd, UFFDIO_REGISTER, &reg)) == ERR) {
         LOG_AND_ABORT("Failed to register address %p", p);
     }
 #endif
 
 #if !UNINIT_READ_SANITY
+    /* The canary only has to surround the allocation. The
+     * allocation itself starts out zeroed so nothing from
+     * the last sample in this slot is handed back out */
     write_sanity_canary(sane_alloc->address);
+    __iso_memset(p, 0x0, size);
 #endif
 
     UNLOCK_SANITY_CACHE();
@@ -3,13 +3,64 @@
 
 #include "iso_alloc_internal.h"
 
+/* mincore fills in a byte per page. The vector is sized
+ * for the smallest page size any supported platform uses */
+#define SEARCH_MIN_PAGE_SIZE 4096
+
+/* Returns the first word in the page at p that equals n.
+ * Pointers are stored 8 byte aligned so only aligned words
+ * are compared, 4 at a time */
+INTERNAL_HIDDEN INLINE uint64_t *_search_page(uint64_t *p, const uint64_t n) {
+    const uint64_t *end = p + (g_page_size / sizeof(uint64_t));
+
+#if USE_AVX2
+    const __m256i v = _mm256_set1_epi64x((int64_t) n);
+
+    for(; p < end; p += 4) {
+        const __m256i w = _mm256_load_si256((const __m256i *) p);
+
+        if(UNLIKELY(_mm256_movemask_epi8(_mm256_cmpeq_epi64(w, v)) != 0)) {
+            break;
+        }
+    }
+#elif USE_NEON && __aarch64__
+    const uint64x2_t v = vdupq_n_u64(n);
+
+    for(; p < end; p += 4) {
+        const uint64x2_t m = vorrq_u64(vceqq_u64(vld1q_u64(p), v), vceqq_u64(vld1q_u64(p + 2), v));
+
+        if(UNLIKELY((vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) != 0)) {
+            break;
+        }
+    }
+#else
+    for(; p < end; p += 4) {
+        if(UNLIKELY(((p[0] == n) | (p[1] == n) | (p[2] == n) | (p[3] == n)) != 0)) {
+            break;
+        }
+    }
+#endif
+
+    if(LIKELY(p == end)) {
+        return NULL;
+    }
+
+    for(int32_t i = 0; i < 4; i++) {
+        if(p[i] == n) {
+            return &p[i];
+        }
+    }
+
+    return NULL;
+}
+
 /* Search all zones for either the first instance of a pointer
  * value and return it or overwrite the first potentially
  * dangling pointer with the address of an unmapped page */
 INTERNAL_HIDDEN void *_iso_alloc_ptr_search(void *n, bool poison) {
-    uint8_t *search = NULL;
-    uint8_t *end = NULL;
     const size_t zones_used = _root->zones_used;
+    const size_t zone_pages = ZONE_USER_SIZE >> g_page_size_shift;
+    uint8_t resident[ZONE_USER_SIZE / SEARCH_MIN_PAGE_SIZE];
 
 #if MEMORY_TAGGING || (ARM_MTE == 1)
     /* It should be safe to clear these upper bits even
@@ -19,23 +70,32 @@ INTERNAL_HIDDEN void *_iso_alloc_ptr_search(void *n, bool poison) {
 
     for(int32_t i = 0; i < zones_used; i++) {
         iso_alloc_zone_t *zone = &_root->zones[i];
+        uint8_t *search = UNMASK_USER_PTR(zone);
 
-        search = UNMASK_USER_PTR(zone);
-        end = search + ZONE_USER_SIZE;
+        /* Pages that were never touched or were returned to the
+         * kernel can't hold a pointer. A zone that can't be
+         * queried is no longer mapped and is skipped entirely */
+        if(mincore(search, ZONE_USER_SIZE, (void *) resident) == ERR) {
+            continue;
+        }
+
+        for(size_t page = 0; page < zone_pages; page++) {
+            if((resident[page] & 1) == 0) {
+                continue;
+            }
+
+            uint64_t *found = _search_page((uint64_t *) (search + (page << g_page_size_shift)), (uint64_t) n);
+
+            if(found == NULL) {
+                continue;
+            }
 
-        while(search <= (uint8_t *) (end - sizeof(uint64_t))) {
-            if(LIKELY((uint64_t) * (uint64_t *) search != (uint64_t) n)) {
-                search++;
-            } else {
-                if(poison == false) {
-                    return search;
-                } else {
 #if UAF_PTR_PAGE
-                    *(uint64_t *) search = (uint64_t) (_root->uaf_ptr_page);
-                    return search;
-#endif
-                }
+            if(poison == true) {
+                *found = (uint64_t) (_root->uaf_ptr_page);
             }
+#endif
+            return found;
         }
     }
 
@@ -129,3 +189,713 @@ INTERNAL_HIDDEN void _iso_alloc_search_stack(uint8_t *stack_start) {
     }
 }
 #endif
+
+#if LEAK_REACHABILITY
+#if !__linux__
+#error "LEAK_REACHABILITY is only supported on Linux and Android"
+#endif
+
+#include <fcntl.h>
+#include <link.h>
+#include <setjmp.h>
+#include <sys/uio.h>
+
+/* Size of the buffer memory outside of zones is copied
+ * into before it is scanned. A second buffer of the same
+ * size holds lines read from /proc/self/maps */
+#define REACH_SCRATCH_SZ 65536
+
+/* Writable segments of loaded objects are collected before
+ * the root lock is taken. dl_iterate_phdr holds the loader
+ * lock and a thread in dlopen may be waiting on the heap */
+#define REACH_MAX_SEGMENTS 512
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} reach_range_t;
+
+/* Bitmaps are copied so the scan runs without the root
+ * lock. The generation tells whether the zone was reset
+ * or destroyed while the scan was running */
+typedef struct {
+    uintptr_t start;
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    bitmap_index_t *bm;
+    bitmap_index_t *mark;
+    uint32_t generation;
+    uint16_t index;
+} reach_zone_t;
+
+/* Big zones in use are traced like chunks */
+typedef struct {
+    uintptr_t start;
+    size_t size;
+    iso_alloc_big_zone_t *meta;
+    bool marked;
+} reach_big_t;
+
+typedef struct {
+    reach_zone_t *zones;
+    uint32_t zone_count;
+    uintptr_t low;
+    uintptr_t high;
+    reach_big_t *bigs;
+    uint32_t big_count;
+    uintptr_t big_low;
+    uintptr_t big_high;
+    reach_range_t *skip;
+    uint32_t skip_count;
+    uintptr_t *stack;
+    size_t stack_used;
+    uint8_t *scratch;
+    void *mapping;
+    size_t mapping_size;
+    reach_range_t current_stack;
+    reach_range_t segments[REACH_MAX_SEGMENTS];
+    uint32_t segment_count;
+} reach_scan_t;
+
+INTERNAL_HIDDEN INLINE uintptr_t _reach_untag(uintptr_t p) {
+#if MEMORY_TAGGING || (ARM_MTE == 1)
+    return p & TAGGED_PTR_MASK;
+#else
+    return p;
+#endif
+}
+
+INTERNAL_HIDDEN reach_zone_t *_reach_find_zone(reach_scan_t *scan, uintptr_t p) {
+    if(p < scan->low || p >= scan->high) {
+        return NULL;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = scan->zone_count;
+
+    while((hi - lo) > 1) {
+        const uint32_t mid = lo + ((hi - lo) >> 1);
+
+        if(scan->zones[mid].start <= p) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    reach_zone_t *z = &scan->zones[lo];
+
+    if(p < z->start || p >= (z->start + ((uintptr_t) z->chunk_size * z->chunk_count))) {
+        return NULL;
+    }
+
+    return z;
+}
+
+INTERNAL_HIDDEN reach_big_t *_reach_find_big(reach_scan_t *scan, uintptr_t p) {
+    if(scan->big_count == 0 || p < scan->big_low || p >= scan->big_high) {
+        return NULL;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = scan->big_count;
+
+    while((hi - lo) > 1) {
+        const uint32_t mid = lo + ((hi - lo) >> 1);
+
+        if(scan->bigs[mid].start <= p) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    reach_big_t *b = &scan->bigs[lo];
+
+    if(p < b->start || p >= (b->start + b->size)) {
+        return NULL;
+    }
+
+    return b;
+}
+
+/* Marks the in use chunk or big zone that p points into,
+ * including interior pointers, and queues it to be scanned.
+ * Mark bits sit in the same position as the chunk's in use bit */
+INTERNAL_HIDDEN INLINE void _reach_mark(reach_scan_t *scan, uintptr_t p) {
+    p = _reach_untag(p);
+
+    reach_zone_t *z = _reach_find_zone(scan, p);
+
+    if(z == NULL) {
+        reach_big_t *b = _reach_find_big(scan, p);
+
+        if(b != NULL && b->marked == false) {
+            b->marked = true;
+            scan->stack[scan->stack_used++] = b->start;
+        }
+
+        return;
+    }
+
+    const uint64_t chunk = (p - z->start) / z->chunk_size;
+    const bit_slot_t bit_slot = chunk * BITS_PER_CHUNK;
+    const bitmap_index_t i = bit_slot >> BITS_PER_QWORD_SHIFT;
+    const bitmap_index_t bit = 1ULL << (bit_slot & (BITS_PER_QWORD - 1));
+
+    if((z->bm[i] & bit) == 0 || (z->mark[i] & bit) != 0) {
+        return;
+    }
+
+    z->mark[i] |= bit;
+    scan->stack[scan->stack_used++] = z->start + (chunk * z->chunk_size);
+}
+
+INTERNAL_HIDDEN void _reach_scan_words(reach_scan_t *scan, const uint64_t *p, size_t words) {
+    for(size_t i = 0; i < words; i++) {
+        _reach_mark(scan, p[i]);
+    }
+}
+
+/* Memory outside of zones can be unmapped by another thread
+ * at any time, so it is copied with process_vm_readv which
+ * fails instead of faulting. Only resident pages are read */
+INTERNAL_HIDDEN void _reach_scan_range(reach_scan_t *scan, uintptr_t start, uintptr_t end) {
+    const pid_t pid = getpid();
+    uint8_t resident[REACH_SCRATCH_SZ / SEARCH_MIN_PAGE_SIZE];
+
+    start = (start + (sizeof(uint64_t) - 1)) & ~(sizeof(uint64_t) - 1);
+
+    while(start < end) {
+        const uintptr_t page = start & ~((uintptr_t) g_page_size - 1);
+        uintptr_t batch_end = page + REACH_SCRATCH_SZ;
+
+        if(batch_end > end) {
+            batch_end = end;
+        }
+
+        if(mincore((void *) page, batch_end - page, resident) == ERR) {
+            start = batch_end;
+            continue;
+        }
+
+        /* Runs of resident pages are copied in one call */
+        while(start < batch_end) {
+            const bool is_resident = (resident[(start - page) >> g_page_size_shift] & 1) != 0;
+            uintptr_t run_end = (start & ~((uintptr_t) g_page_size - 1)) + g_page_size;
+
+            while(run_end < batch_end && ((resident[(run_end - page) >> g_page_size_shift] & 1) != 0) == is_resident) {
+                run_end += g_page_size;
+            }
+
+            if(run_end > batch_end) {
+                run_end = batch_end;
+            }
+
+            if(is_resident == true) {
+                struct iovec local = {.iov_base = scan->scratch, .iov_len = run_end - start};
+                struct iovec remote = {.iov_base = (void *) start, .iov_len = run_end - start};
+                const ssize_t r = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+
+                if(r > 0) {
+                    _reach_scan_words(scan, (const uint64_t *) scan->scratch, r / sizeof(uint64_t));
+                }
+            }
+
+            start = run_end;
+        }
+    }
+}
+
+/* Scans every chunk and big zone reachable from what has
+ * been marked so far. Zone pages can be read directly, a
+ * zone destroyed during the scan stays mapped until it ends.
+ * A big zone can be freed at any time so it is copied */
+INTERNAL_HIDDEN void _reach_drain(reach_scan_t *scan) {
+    while(scan->stack_used != 0) {
+        const uintptr_t p = scan->stack[--scan->stack_used];
+        reach_zone_t *z = _reach_find_zone(scan, p);
+
+        if(z != NULL) {
+            _reach_scan_words(scan, (const uint64_t *) p, z->chunk_size / sizeof(uint64_t));
+        } else {
+            reach_big_t *b = _reach_find_big(scan, p);
+            _reach_scan_range(scan, b->start, b->start + b->size);
+        }
+    }
+}
+
+/* Scans start to end around the ranges that must not be
+ * roots. A skipped range can share a line of /proc/self/maps
+ * with its neighbours, so only the range itself is left out */
+INTERNAL_HIDDEN void _reach_scan_unskipped(reach_scan_t *scan, uintptr_t start, uintptr_t end) {
+    for(uint32_t i = 0; i < scan->skip_count && start < end; i++) {
+        const reach_range_t *r = &scan->skip[i];
+
+        if(r->end <= start) {
+            continue;
+        }
+
+        if(r->start >= end) {
+            break;
+        }
+
+        if(r->start > start) {
+            _reach_scan_range(scan, start, r->start);
+        }
+
+        start = r->end;
+    }
+
+    if(start < end) {
+        _reach_scan_range(scan, start, end);
+    }
+}
+
+INTERNAL_HIDDEN int _reach_collect_segments(struct dl_phdr_info *info, size_t size, void *data) {
+    reach_scan_t *scan = (reach_scan_t *) data;
+
+    for(int32_t i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if(ph->p_type != PT_LOAD || (ph->p_flags & PF_W) == 0) {
+            continue;
+        }
+
+        if(scan->segment_count == REACH_MAX_SEGMENTS) {
+            LOG("Too many writable segments to scan for pointers");
+            return 1;
+        }
+
+        scan->segments[scan->segment_count].start = info->dlpi_addr + ph->p_vaddr;
+        scan->segments[scan->segment_count].end = info->dlpi_addr + ph->p_vaddr + ph->p_memsz;
+        scan->segment_count++;
+    }
+
+    return 0;
+}
+
+INTERNAL_HIDDEN uintptr_t _reach_parse_hex(const char **s) {
+    uintptr_t v = 0;
+
+    while(true) {
+        const char c = **s;
+
+        if(c >= '0' && c <= '9') {
+            v = (v << 4) | (c - '0');
+        } else if(c >= 'a' && c <= 'f') {
+            v = (v << 4) | (c - 'a' + 10);
+        } else {
+            return v;
+        }
+
+        (*s)++;
+    }
+}
+
+/* Every anonymous writable mapping is a root. This covers
+ * the stacks and TLS of other threads, the brk heap and
+ * memory from other allocators or mmap. Zone user pages
+ * and big zones in use are only reached by tracing. Their
+ * meta data, the zone meta data and the scan's own mapping
+ * point at them and are skipped. The mapping holding
+ * the current stack is recorded so only its live part is
+ * scanned. A line is 'start-end perms offset dev inode path' */
+INTERNAL_HIDDEN void _reach_scan_line(reach_scan_t *scan, const char *line, uintptr_t sp) {
+    const uintptr_t start = _reach_parse_hex(&line);
+    line++;
+    const uintptr_t end = _reach_parse_hex(&line);
+    line++;
+
+    if(line[0] != 'r' || line[1] != 'w') {
+        return;
+    }
+
+    /* Skip perms, offset, dev and inode to reach the path */
+    for(int32_t field = 0; field < 4; field++) {
+        while(*line != ' ' && *line != '\0') {
+            line++;
+        }
+
+        while(*line == ' ') {
+            line++;
+        }
+    }
+
+    /* File backed data is covered by the segment scan */
+    if(*line != '\0' && *line != '[') {
+        return;
+    }
+
+    if(sp >= start && sp < end) {
+        scan->current_stack.start = sp;
+        scan->current_stack.end = end;
+        return;
+    }
+
+    /* Mappings holding zone user pages are traced instead */
+    reach_zone_t *z = _reach_find_zone(scan, start);
+
+    if(z != NULL) {
+        return;
+    }
+
+    for(uint32_t i = 0; i < scan->zone_count; i++) {
+        if(scan->zones[i].start >= start && scan->zones[i].start < end) {
+            return;
+        }
+    }
+
+    _reach_scan_unskipped(scan, start, end);
+}
+
+INTERNAL_HIDDEN void _reach_scan_maps(reach_scan_t *scan, uintptr_t sp) {
+    const int32_t fd = open("/proc/self/maps", O_RDONLY);
+
+    if(fd == ERR) {
+        LOG("Could not open /proc/self/maps");
+        return;
+    }
+
+    /* Lines are parsed from the second half of the scratch
+     * buffer, the first half is where mappings are copied */
+    char *buf = (char *) scan->scratch + REACH_SCRATCH_SZ;
+    const size_t buf_size = REACH_SCRATCH_SZ - 1;
+    size_t used = 0;
+
+    while(true) {
+        const ssize_t r = read(fd, buf + used, buf_size - used);
+
+        if(r <= 0) {
+            break;
+        }
+
+        used += r;
+        buf[used] = '\0';
+
+        char *line = buf;
+        char *nl;
+
+        while((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+            _reach_scan_line(scan, line, sp);
+            line = nl + 1;
+        }
+
+        used -= (line - buf);
+        __iso_memmove(buf, line, used);
+    }
+
+    close(fd);
+}
+
+/* Scans from the frame of this function to the top of the
+ * stack. It must not be inlined so the registers spilled by
+ * its caller are part of what is scanned. The scan state
+ * lives in the caller's frame and holds zone addresses so
+ * it is skipped */
+INTERNAL_HIDDEN NO_INLINE void _reach_scan_current_stack(reach_scan_t *scan) {
+    uintptr_t sp = (uintptr_t) &sp & ~(sizeof(uint64_t) - 1);
+    const uintptr_t skip_start = (uintptr_t) scan;
+    const uintptr_t skip_end = (uintptr_t) (scan + 1);
+
+    if(scan->current_stack.end <= sp) {
+        return;
+    }
+
+    if(skip_start > sp && skip_end <= scan->current_stack.end) {
+        _reach_scan_words(scan, (const uint64_t *) sp, (skip_start - sp) / sizeof(uint64_t));
+        sp = skip_end;
+    }
+
+    _reach_scan_words(scan, (const uint64_t *) sp, (scan->current_stack.end - sp) / sizeof(uint64_t));
+}
+
+INTERNAL_HIDDEN void _reach_add_skip(reach_scan_t *scan, uintptr_t start, uintptr_t end) {
+    scan->skip[scan->skip_count].start = start;
+    scan->skip[scan->skip_count].end = end;
+    scan->skip_count++;
+}
+
+/* Called with the root lock held. Everything the scan needs
+ * to know about zones and big zones is copied into a single
+ * mapping so the scan itself can run without any lock */
+INTERNAL_HIDDEN bool _reach_init(reach_scan_t *scan) {
+    size_t bitmaps_size = 0;
+    size_t chunks = 0;
+    uint32_t count = 0;
+
+    for(uint16_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+
+        if(zone->bitmap_start == NULL || zone->user_pages_start == NULL) {
+            break;
+        }
+
+        bitmaps_size += zone->bitmap_size;
+        chunks += zone->chunk_count;
+        count++;
+    }
+
+    if(count == 0) {
+        return false;
+    }
+
+    LOCK_BIG_ZONE_USED();
+
+    const uint32_t big_count = _root->big_zone_used_count;
+
+    /* The scan's own mapping, the zone meta data and the user
+     * pages and meta data page of each big zone are skipped.
+     * The mark stack never holds a chunk or big zone twice */
+    const uint32_t skip_count = (big_count * 2) + 2;
+    scan->mapping_size = ROUND_UP_PAGE((REACH_SCRATCH_SZ * 2) + (count * sizeof(reach_zone_t)) + (big_count * sizeof(reach_big_t)) +
+                                       (skip_count * sizeof(reach_range_t)) + (bitmaps_size * 2) + ((chunks + big_count) * sizeof(uintptr_t)));
+    scan->mapping = mmap_rw_pages(scan->mapping_size, false, LEAK_SCAN_NAME);
+
+    if(scan->mapping == NULL) {
+        UNLOCK_BIG_ZONE_USED();
+        return false;
+    }
+
+    scan->scratch = (uint8_t *) scan->mapping;
+    scan->zones = (reach_zone_t *) (scan->scratch + (REACH_SCRATCH_SZ * 2));
+    scan->bigs = (reach_big_t *) &scan->zones[count];
+    scan->skip = (reach_range_t *) &scan->bigs[big_count];
+    uint8_t *bm = (uint8_t *) &scan->skip[skip_count];
+    uint8_t *mark = bm + bitmaps_size;
+    scan->stack = (uintptr_t *) (mark + bitmaps_size);
+
+    for(uint32_t i = 0; i < count; i++) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+        reach_zone_t *z = &scan->zones[i];
+
+        z->start = (uintptr_t) UNMASK_USER_PTR(zone);
+        z->chunk_size = zone->chunk_size;
+        z->chunk_count = zone->chunk_count;
+        z->bm = (bitmap_index_t *) bm;
+        z->mark = (bitmap_index_t *) mark;
+        z->generation = _root->zone_generations[zone->index];
+        z->index = zone->index;
+        __iso_memcpy(bm, UNMASK_BITMAP_PTR(zone), zone->bitmap_size);
+        bm += zone->bitmap_size;
+        mark += zone->bitmap_size;
+    }
+
+    _reach_add_skip(scan, (uintptr_t) scan->mapping, (uintptr_t) scan->mapping + scan->mapping_size);
+    _reach_add_skip(scan, (uintptr_t) _root->zones, (uintptr_t) _root->zones + _root->zones_size);
+
+    iso_alloc_big_zone_t *big = _root->big_zone_used;
+
+    if(big != NULL) {
+        big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_used);
+    }
+
+    while(big != NULL && scan->big_count < big_count) {
+        reach_big_t *b = &scan->bigs[scan->big_count];
+        b->start = _reach_untag((uintptr_t) big->user_pages_start);
+        b->size = big->size;
+        b->meta = big;
+        b->marked = false;
+        scan->big_count++;
+
+        _reach_add_skip(scan, b->start, b->start + b->size);
+        _reach_add_skip(scan, ROUND_DOWN_PAGE((uintptr_t) big), ROUND_DOWN_PAGE((uintptr_t) big) + g_page_size);
+
+        if(big->next != NULL) {
+            big = UNMASK_BIG_ZONE_NEXT(big->next);
+        } else {
+            big = NULL;
+        }
+    }
+
+    UNLOCK_BIG_ZONE_USED();
+
+    /* Sorted by address so a pointer can be matched to its
+     * zone with a binary search. Zones are mostly created in
+     * address order so an insertion sort is cheap */
+    for(uint32_t i = 1; i < count; i++) {
+        reach_zone_t z = scan->zones[i];
+        uint32_t j = i;
+
+        while(j > 0 && scan->zones[j - 1].start > z.start) {
+            scan->zones[j] = scan->zones[j - 1];
+            j--;
+        }
+
+        scan->zones[j] = z;
+    }
+
+    for(uint32_t i = 1; i < scan->big_count; i++) {
+        reach_big_t b = scan->bigs[i];
+        uint32_t j = i;
+
+        while(j > 0 && scan->bigs[j - 1].start > b.start) {
+            scan->bigs[j] = scan->bigs[j - 1];
+            j--;
+        }
+
+        scan->bigs[j] = b;
+    }
+
+    for(uint32_t i = 1; i < scan->skip_count; i++) {
+        reach_range_t r = scan->skip[i];
+        uint32_t j = i;
+
+        while(j > 0 && scan->skip[j - 1].start > r.start) {
+            scan->skip[j] = scan->skip[j - 1];
+            j--;
+        }
+
+        scan->skip[j] = r;
+    }
+
+    scan->zone_count = count;
+    scan->low = scan->zones[0].start;
+    scan->high = scan->zones[count - 1].start + ZONE_USER_SIZE;
+
+    if(scan->big_count != 0) {
+        scan->big_low = scan->bigs[0].start;
+        scan->big_high = scan->bigs[scan->big_count - 1].start + scan->bigs[scan->big_count - 1].size;
+    }
+
+    return true;
+}
+
+/* Called with the root lock held once the scan is done.
+ * Zones that were reset or destroyed while it ran are left
+ * out and a chunk is only counted if it is still in use. A
+ * chunk with both bits set is a leak only if its canary is bad */
+INTERNAL_HIDDEN uint64_t _reach_count_unmarked(reach_scan_t *scan) {
+    uint64_t leaks = 0;
+
+    for(uint32_t z = 0; z < scan->zone_count; z++) {
+        reach_zone_t *rz = &scan->zones[z];
+
+        if(_root->zone_generations[rz->index] != rz->generation) {
+            continue;
+        }
+
+        iso_alloc_zone_t *zone = &_root->zones[rz->index];
+        const int64_t bms = zone->bitmap_size / sizeof(bitmap_index_t);
+
+        UNMASK_ZONE_PTRS(zone);
+
+        const bitmap_index_t *bm = (bitmap_index_t *) zone->bitmap_start;
+
+        for(bitmap_index_t i = 0; i < bms; i++) {
+            if(rz->bm[i] == CANARY_UNWRITTEN_QWORD || bm[i] == CANARY_UNWRITTEN_QWORD) {
+                continue;
+            }
+
+            const uint64_t freed = (bm[i] >> 1) & USED_BIT_VECTOR;
+            uint64_t unreachable = rz->bm[i] & bm[i] & ~rz->mark[i] & USED_BIT_VECTOR;
+
+            while(unreachable != 0) {
+                const bit_slot_t bit_slot = (i * BITS_PER_QWORD) + __builtin_ctzll(unreachable);
+                const uint64_t bit = unreachable & -unreachable;
+                const void *leak = POINTER_FROM_BITSLOT(zone, bit_slot);
+                unreachable &= (unreachable - 1);
+
+                if((freed & bit) != 0 && check_canary_no_abort(zone, leak) != ERR) {
+                    continue;
+                }
+
+                leaks++;
+                LOG("Unreachable chunk in zone[%d] of %d bytes detected at 0x%p (bit position = %d)", zone->index, zone->chunk_size, leak, bit_slot);
+            }
+        }
+
+        MASK_ZONE_PTRS(zone);
+    }
+
+    return leaks;
+}
+
+/* Returns the bytes held by big zones that were in use for
+ * the whole scan and never marked, like the leak detector
+ * does for every big zone in use */
+INTERNAL_HIDDEN uint64_t _reach_count_unmarked_big(reach_scan_t *scan) {
+    uint64_t big_leaks = 0;
+
+    LOCK_BIG_ZONE_USED();
+
+    iso_alloc_big_zone_t *big = _root->big_zone_used;
+
+    if(big != NULL) {
+        big = UNMASK_BIG_ZONE_NEXT(_root->big_zone_used);
+    }
+
+    while(big != NULL) {
+        reach_big_t *b = _reach_find_big(scan, _reach_untag((uintptr_t) big->user_pages_start));
+
+        if(b != NULL && b->meta == big && b->marked == false) {
+            big_leaks += big->size;
+            LOG("Big zone leaked %lu bytes", big->size);
+        }
+
+        if(big->next != NULL) {
+            big = UNMASK_BIG_ZONE_NEXT(big->next);
+        } else {
+            big = NULL;
+        }
+    }
+
+    UNLOCK_BIG_ZONE_USED();
+
+    LOG("Total leaked in big zones: bytes (%lu) megabytes (%lu)", big_leaks, (big_leaks / MEGABYTE_SIZE));
+    return big_leaks;
+}
+
+/* A conservative mark phase like a garbage collector would
+ * run. Roots are the registers and stack of the calling
+ * thread, the writable segments of every loaded object and
+ * every anonymous writable mapping, which includes the
+ * stacks of other threads. Any word that points into an in
+ * use chunk or big zone marks it and it is scanned in turn.
+ * The root lock is only held to copy the zone bitmaps and
+ * to count what was never marked. Other threads are not
+ * stopped, a pointer they move while the scan runs can be
+ * missed. Returns the number of in use chunks that were not
+ * marked plus the bytes held by big zones that were not */
+INTERNAL_HIDDEN uint64_t _iso_alloc_detect_unreachable(void) {
+    reach_scan_t scan;
+    __iso_memset(&scan, 0x0, sizeof(scan));
+
+    dl_iterate_phdr(_reach_collect_segments, &scan);
+
+    /* Spill callee saved registers into this frame */
+    jmp_buf regs;
+    __builtin_unwind_init();
+    setjmp(regs);
+
+    LOCK_ROOT();
+
+    if(_reach_init(&scan) == false) {
+        UNLOCK_ROOT();
+        return 0;
+    }
+
+    /* Zones destroyed from here on stay mapped */
+    _zone_scan_begin();
+    UNLOCK_ROOT();
+
+    _reach_scan_maps(&scan, (uintptr_t) &regs);
+    _reach_scan_current_stack(&scan);
+
+    for(uint32_t i = 0; i < scan.segment_count; i++) {
+        _reach_scan_range(&scan, scan.segments[i].start, scan.segments[i].end);
+    }
+
+    _reach_drain(&scan);
+
+    LOCK_ROOT();
+    _zone_scan_end();
+    const uint64_t leaks = _reach_count_unmarked(&scan);
+    const uint64_t big_leaks = _reach_count_unmarked_big(&scan);
+    UNLOCK_ROOT();
+
+    munmap(scan.mapping, scan.mapping_size);
+    return leaks + big_leaks;
+}
+#endif
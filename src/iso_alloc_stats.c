@@ -0,0 +1,361 @@
+/* iso_alloc_stats.c - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if __linux__
+#include <fcntl.h>
+#endif
+
+#include <time.h>
+
+#if ALLOC_STATS
+#if THREAD_SUPPORT
+__thread iso_alloc_stats_slot_t *_stats_slot;
+#else
+iso_alloc_stats_slot_t *_stats_slot;
+#endif
+
+INTERNAL_HIDDEN void _iso_alloc_initialize_stats(void) {
+    size_t s = ROUND_UP_PAGE(STATS_SLOTS * sizeof(iso_alloc_stats_slot_t));
+    _root->stats_slots = mmap_guarded_rw_pages(s, true, NULL);
+
+    if(_root->stats_slots == NULL) {
+        LOG_AND_ABORT("Could not allocate pages for statistics counters");
+    }
+}
+
+/* Assigns the calling thread a counter slot. Threads
+ * are handed slots round robin so a slot may be shared
+ * once more than STATS_SLOTS threads have allocated */
+INTERNAL_HIDDEN iso_alloc_stats_slot_t *_iso_alloc_stats_slot(void) {
+    uint32_t idx = __atomic_fetch_add(&_root->stats_next_slot, 1, __ATOMIC_RELAXED);
+    _stats_slot = &_root->stats_slots[idx & (STATS_SLOTS - 1)];
+    return _stats_slot;
+}
+#endif
+
+/* CLOCK_MONOTONIC_RAW is serviced by the vDSO on Linux
+ * and isn't subject to NTP slewing, unlike rdtsc it needs
+ * no calibration and is stable across cores */
+INTERNAL_HIDDEN uint64_t _iso_latency_now(void) {
+    struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+#if LOCK_PROFILER && THREAD_SUPPORT
+iso_alloc_lock_prof_t _lock_profile[ISO_ALLOC_LOCKS];
+
+/* Called with the lock held */
+INTERNAL_HIDDEN INLINE void _lock_acquired(iso_alloc_lock_prof_t *lp, const char *site, uint64_t wait, const char *holder) {
+    lp->acquisitions++;
+
+    if(wait != 0) {
+        lp->contended++;
+        lp->total_wait_ns += wait;
+
+        if(wait > lp->max_wait_ns) {
+            lp->max_wait_ns = wait;
+            lp->max_wait_holder = holder;
+        }
+    }
+
+    __atomic_store_n(&lp->holder, site, __ATOMIC_RELAXED);
+}
+
+/* The holder is sampled before waiting. It names the
+ * last function to acquire the lock, which is almost
+ * always the one still holding it */
+#if USE_SPINLOCK
+INTERNAL_HIDDEN void _iso_spinlock_lock_profiled(atomic_flag *flag, int32_t lock, const char *site) {
+    iso_alloc_lock_prof_t *lp = &_lock_profile[lock];
+
+    if(LIKELY(atomic_flag_test_and_set(flag) == false)) {
+        _lock_acquired(lp, site, 0, NULL);
+        return;
+    }
+
+    const char *holder = __atomic_load_n(&lp->holder, __ATOMIC_RELAXED);
+    uint64_t start = _iso_latency_now();
+
+    do {
+    } while(atomic_flag_test_and_set(flag));
+
+    /* A wait too short to measure still counts as contended */
+    uint64_t wait = _iso_latency_now() - start;
+    _lock_acquired(lp, site, wait ? wait : 1, holder);
+}
+#else
+INTERNAL_HIDDEN void _iso_mutex_lock_profiled(pthread_mutex_t *mutex, int32_t lock, const char *site) {
+    iso_alloc_lock_prof_t *lp = &_lock_profile[lock];
+
+    if(LIKELY(pthread_mutex_trylock(mutex) == 0)) {
+        _lock_acquired(lp, site, 0, NULL);
+        return;
+    }
+
+    const char *holder = __atomic_load_n(&lp->holder, __ATOMIC_RELAXED);
+    uint64_t start = _iso_latency_now();
+    pthread_mutex_lock(mutex);
+
+    /* A wait too short to measure still counts as contended */
+    uint64_t wait = _iso_latency_now() - start;
+    _lock_acquired(lp, site, wait ? wait : 1, holder);
+}
+#endif
+#endif
+
+/* Reads the lock counters without taking any of the
+ * locks, so a profile taken under load is approximate */
+INTERNAL_HIDDEN void _iso_alloc_get_lock_profile(iso_alloc_lock_profile_t *profile) {
+    if(profile == NULL) {
+        return;
+    }
+
+    __iso_memset(profile, 0x0, sizeof(iso_alloc_lock_profile_t));
+
+#if LOCK_PROFILER && THREAD_SUPPORT
+    for(int32_t i = 0; i < ISO_ALLOC_LOCKS; i++) {
+        iso_alloc_lock_prof_t *lp = &_lock_profile[i];
+        iso_alloc_lock_stats_t *ls = &profile->locks[i];
+        ls->acquisitions = __atomic_load_n(&lp->acquisitions, __ATOMIC_RELAXED);
+        ls->contended = __atomic_load_n(&lp->contended, __ATOMIC_RELAXED);
+        ls->total_wait_ns = __atomic_load_n(&lp->total_wait_ns, __ATOMIC_RELAXED);
+        ls->max_wait_ns = __atomic_load_n(&lp->max_wait_ns, __ATOMIC_RELAXED);
+        ls->max_wait_holder = __atomic_load_n(&lp->max_wait_holder, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+/* Reads the resident set size from procfs without
+ * allocating memory. Returns 0 if it isn't available */
+INTERNAL_HIDDEN uint64_t _iso_alloc_resident_bytes(void) {
+#if __linux__
+    char buf[128];
+    int32_t fd = open("/proc/self/statm", O_RDONLY);
+
+    if(fd == ERR) {
+        return 0;
+    }
+
+    ssize_t r = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if(r <= 0) {
+        return 0;
+    }
+
+    buf[r] = '\0';
+
+    /* The second field is resident pages */
+    char *c = buf;
+
+    while(*c != ' ' && *c != '\0') {
+        c++;
+    }
+
+    uint64_t pages = 0;
+
+    while(*c == ' ') {
+        c++;
+    }
+
+    while(*c >= '0' && *c <= '9') {
+        pages = (pages * 10) + (*c - '0');
+        c++;
+    }
+
+    return pages * g_page_size;
+#else
+    return 0;
+#endif
+}
+
+/* Aggregates the per-thread counters. This never takes
+ * a lock so the values are a snapshot that may be
+ * slightly out of date with concurrent operations */
+INTERNAL_HIDDEN void _iso_alloc_get_stats(iso_alloc_stats_t *stats) {
+    if(stats == NULL) {
+        return;
+    }
+
+    __iso_memset(stats, 0x0, sizeof(iso_alloc_stats_t));
+
+    if(_root == NULL) {
+        return;
+    }
+
+#if ALLOC_STATS
+    for(int32_t i = 0; i < STATS_SLOTS; i++) {
+        iso_alloc_stats_slot_t *ss = &_root->stats_slots[i];
+        stats->allocated_bytes += __atomic_load_n(&ss->allocated_bytes, __ATOMIC_RELAXED);
+        stats->allocations += __atomic_load_n(&ss->allocations, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&ss->frees, __ATOMIC_RELAXED);
+        stats->zone_creations += __atomic_load_n(&ss->zone_creations, __ATOMIC_RELAXED);
+        stats->zone_retirements += __atomic_load_n(&ss->zone_retirements, __ATOMIC_RELAXED);
+        stats->big_allocations += __atomic_load_n(&ss->big_allocations, __ATOMIC_RELAXED);
+        stats->big_allocated_bytes += __atomic_load_n(&ss->big_allocated_bytes, __ATOMIC_RELAXED);
+        stats->big_zone_retirements += __atomic_load_n(&ss->big_zone_retirements, __ATOMIC_RELAXED);
+
+        for(int32_t j = 0; j < ISO_ALLOC_STATS_SIZE_CLASSES; j++) {
+            stats->active_chunks[j] += __atomic_load_n(&ss->active_chunks[j], __ATOMIC_RELAXED);
+        }
+    }
+#endif
+
+    stats->zones = __atomic_load_n(&_root->zones_used, __ATOMIC_RELAXED);
+    stats->quarantine_depth = __atomic_load_n(&_root->chunk_quarantine_count, __ATOMIC_RELAXED);
+    stats->mapped_bytes = (stats->zones * ZONE_USER_SIZE) + stats->big_allocated_bytes;
+    stats->resident_bytes = _iso_alloc_resident_bytes();
+}
+
+#if ALLOC_LATENCY
+#if THREAD_SUPPORT
+__thread iso_alloc_latency_slot_t *_latency_slot;
+#else
+iso_alloc_latency_slot_t *_latency_slot;
+#endif
+
+INTERNAL_HIDDEN void _iso_alloc_initialize_latency(void) {
+    size_t s = ROUND_UP_PAGE(LATENCY_SLOTS * sizeof(iso_alloc_latency_slot_t));
+    _root->latency_slots = mmap_guarded_rw_pages(s, true, NULL);
+
+    if(_root->latency_slots == NULL) {
+        LOG_AND_ABORT("Could not allocate pages for latency histograms");
+    }
+}
+
+INTERNAL_HIDDEN INLINE int32_t _latency_bucket(uint64_t ns) {
+    if(ns < LATENCY_SUB_BUCKETS) {
+        return (int32_t) ns;
+    }
+
+    int32_t msb = 63 - __builtin_clzll(ns);
+    int32_t idx = ((msb - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS) +
+                  ((ns >> (msb - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+
+    if(idx >= LATENCY_BUCKETS) {
+        return LATENCY_BUCKETS - 1;
+    }
+
+    return idx;
+}
+
+/* Returns the largest latency that falls in a bucket */
+INTERNAL_HIDDEN INLINE uint64_t _latency_bucket_value(int32_t idx) {
+    if(idx < LATENCY_SUB_BUCKETS) {
+        return idx;
+    }
+
+    int32_t msb = (idx / LATENCY_SUB_BUCKETS) + LATENCY_SUB_BUCKET_BITS - 1;
+    uint64_t sub = (idx & (LATENCY_SUB_BUCKETS - 1)) + LATENCY_SUB_BUCKETS + 1;
+    return (sub << (msb - LATENCY_SUB_BUCKET_BITS)) - 1;
+}
+
+INTERNAL_HIDDEN void _iso_latency_record(int32_t path, uint64_t start) {
+    uint64_t ns = _iso_latency_now() - start;
+
+    if(UNLIKELY(_latency_slot == NULL)) {
+        uint32_t idx = __atomic_fetch_add(&_root->latency_next_slot, 1, __ATOMIC_RELAXED);
+        _latency_slot = &_root->latency_slots[idx & (LATENCY_SLOTS - 1)];
+    }
+
+    __atomic_fetch_add(&_latency_slot->buckets[path][_latency_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&_latency_slot->max[path], __ATOMIC_RELAXED);
+
+    while(ns > max) {
+        if(__atomic_compare_exchange_n(&_latency_slot->max[path], &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+INTERNAL_HIDDEN INLINE uint64_t _latency_percentile(uint64_t *buckets, uint64_t count, uint64_t per_mille) {
+    /* Rank of the sample that marks the percentile, rounded up */
+    uint64_t rank = ((count * per_mille) + 999) / 1000;
+    uint64_t seen = 0;
+
+    for(int32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += buckets[i];
+
+        if(seen >= rank && seen != 0) {
+            return _latency_bucket_value(i);
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/* Merges the per-thread histograms one path at a time
+ * and computes percentiles from the merged result */
+INTERNAL_HIDDEN void _iso_alloc_get_latency(iso_alloc_latency_t *latency) {
+    if(latency == NULL) {
+        return;
+    }
+
+    __iso_memset(latency, 0x0, sizeof(iso_alloc_latency_t));
+
+    if(_root == NULL) {
+        return;
+    }
+
+#if ALLOC_LATENCY
+    uint64_t merged[LATENCY_BUCKETS];
+
+    for(int32_t p = 0; p < ISO_ALLOC_LATENCY_PATHS; p++) {
+        iso_alloc_latency_path_t *lp = &latency->paths[p];
+        __iso_memset(merged, 0x0, sizeof(merged));
+
+        for(int32_t i = 0; i < LATENCY_SLOTS; i++) {
+            iso_alloc_latency_slot_t *ls = &_root->latency_slots[i];
+
+            for(int32_t j = 0; j < LATENCY_BUCKETS; j++) {
+                uint64_t c = __atomic_load_n(&ls->buckets[p][j], __ATOMIC_RELAXED);
+                merged[j] += c;
+                lp->count += c;
+            }
+
+            uint64_t max = __atomic_load_n(&ls->max[p], __ATOMIC_RELAXED);
+
+            if(max > lp->max) {
+                lp->max = max;
+            }
+        }
+
+        if(lp->count == 0) {
+            continue;
+        }
+
+        lp->p50 = _latency_percentile(merged, lp->count, 500);
+        lp->p90 = _latency_percentile(merged, lp->count, 900);
+        lp->p99 = _latency_percentile(merged, lp->count, 990);
+        lp->p999 = _latency_percentile(merged, lp->count, 999);
+
+        /* Bucket upper bounds can overshoot the largest sample */
+        lp->p50 = (lp->p50 > lp->max) ? lp->max : lp->p50;
+        lp->p90 = (lp->p90 > lp->max) ? lp->max : lp->p90;
+        lp->p99 = (lp->p99 > lp->max) ? lp->max : lp->p99;
+        lp->p999 = (lp->p999 > lp->max) ? lp->max : lp->p999;
+    }
+#endif
+}
+
+INTERNAL_HIDDEN void _iso_alloc_dump_latency(int32_t fd) {
+    const char *names[ISO_ALLOC_LATENCY_PATHS] = {"cache_hit", "slow_scan", "new_zone",
+                                                  "big_reuse", "big_mmap", "free"};
+    iso_alloc_latency_t latency;
+    _iso_alloc_get_latency(&latency);
+
+    for(int32_t p = 0; p < ISO_ALLOC_LATENCY_PATHS; p++) {
+        iso_alloc_latency_path_t *lp = &latency.paths[p];
+        _iso_alloc_printf(fd, "%s count=%lu p50=%lu p90=%lu p99=%lu p99.9=%lu max=%lu\n",
+                          names[p], lp->count, lp->p50, lp->p90, lp->p99, lp->p999, lp->max);
+    }
+}
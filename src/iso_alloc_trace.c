@@ -0,0 +1,149 @@
+/* iso_alloc_trace.c - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if ALLOC_TRACE
+#include <fcntl.h>
+
+/* The trace file is mapped shared so events written by
+ * a thread go straight to the page cache. Threads claim
+ * TRACE_BUFFER_EVENTS slots at a time from the mapping
+ * and fill them without taking any lock */
+static iso_alloc_trace_header_t *_trace_header;
+static iso_alloc_trace_event_t *_trace_events;
+static int32_t _trace_fd = ERR;
+static uint64_t _trace_start;
+static uint64_t _trace_cursor;
+static uint64_t _trace_seq;
+static uint64_t _trace_dropped;
+static uint32_t _trace_threads;
+static uint32_t _trace_generation;
+static bool _trace_enabled;
+
+#if THREAD_SUPPORT
+static __thread iso_alloc_trace_event_t *_trace_buf;
+static __thread uint32_t _trace_buf_used;
+static __thread uint32_t _trace_buf_generation;
+static __thread uint16_t _trace_thread;
+#else
+static iso_alloc_trace_event_t *_trace_buf;
+static uint32_t _trace_buf_used;
+static uint32_t _trace_buf_generation;
+static uint16_t _trace_thread;
+#endif
+
+INTERNAL_HIDDEN void _iso_alloc_initialize_trace(void) {
+    const char *path = getenv(TRACE_ENV_STR);
+
+    if(path == NULL) {
+        path = TRACE_FILE_PATH;
+    }
+
+    _trace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if(_trace_fd == ERR) {
+        LOG_AND_ABORT("Cannot open file descriptor for %s", path);
+    }
+
+    const size_t sz = sizeof(iso_alloc_trace_header_t) + (TRACE_MAX_EVENTS * sizeof(iso_alloc_trace_event_t));
+
+    if(ftruncate(_trace_fd, sz) == ERR) {
+        LOG_AND_ABORT("Cannot size trace file %s", path);
+    }
+
+    void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, _trace_fd, 0);
+
+    if(p == MAP_FAILED) {
+        LOG_AND_ABORT("Cannot map trace file %s", path);
+    }
+
+    _trace_header = (iso_alloc_trace_header_t *) p;
+    _trace_events = (iso_alloc_trace_event_t *) ((uintptr_t) p + sizeof(iso_alloc_trace_header_t));
+    _trace_header->magic = TRACE_MAGIC;
+    _trace_header->version = TRACE_VERSION;
+    _trace_header->event_size = sizeof(iso_alloc_trace_event_t);
+
+    _trace_cursor = 0;
+    _trace_seq = 0;
+    _trace_dropped = 0;
+    _trace_threads = 0;
+    _trace_start = _iso_latency_now();
+    __atomic_add_fetch(&_trace_generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&_trace_enabled, true, __ATOMIC_RELEASE);
+}
+
+/* Claims the next block of event slots for the calling
+ * thread. Fails once the trace file is full or closed */
+INTERNAL_HIDDEN bool _trace_reserve(void) {
+    uint64_t idx = __atomic_fetch_add(&_trace_cursor, TRACE_BUFFER_EVENTS, __ATOMIC_RELAXED);
+
+    if(idx + TRACE_BUFFER_EVENTS > TRACE_MAX_EVENTS) {
+        _trace_buf = NULL;
+        return false;
+    }
+
+    uint32_t gen = __atomic_load_n(&_trace_generation, __ATOMIC_ACQUIRE);
+
+    if(_trace_buf_generation != gen) {
+        _trace_thread = __atomic_add_fetch(&_trace_threads, 1, __ATOMIC_RELAXED);
+        _trace_buf_generation = gen;
+    }
+
+    _trace_buf = &_trace_events[idx];
+    _trace_buf_used = 0;
+    return true;
+}
+
+INTERNAL_HIDDEN void _iso_trace_record(uint8_t op, void *p, void *old, size_t size, size_t chunk_size) {
+    if(UNLIKELY(__atomic_load_n(&_trace_enabled, __ATOMIC_ACQUIRE) == false)) {
+        return;
+    }
+
+    /* A buffer claimed before the trace was reopened
+     * belongs to the previous trace file */
+    if(UNLIKELY(_trace_buf == NULL || _trace_buf_used == TRACE_BUFFER_EVENTS ||
+                _trace_buf_generation != __atomic_load_n(&_trace_generation, __ATOMIC_RELAXED))) {
+        if(_trace_reserve() == false) {
+            __atomic_fetch_add(&_trace_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    iso_alloc_trace_event_t *e = &_trace_buf[_trace_buf_used++];
+    e->seq = __atomic_fetch_add(&_trace_seq, 1, __ATOMIC_RELAXED);
+    e->timestamp = _iso_latency_now() - _trace_start;
+    e->ptr_id = (uint64_t) p;
+    e->old_ptr_id = (uint64_t) old;
+    e->size = size;
+    e->chunk_size = chunk_size;
+    e->thread = _trace_thread;
+    e->op = op;
+}
+
+/* Truncates the trace file to the slots that were handed
+ * out. The mapping is left in place because other threads
+ * may still be writing into blocks they already own */
+INTERNAL_HIDDEN void _iso_alloc_close_trace(void) {
+    if(_trace_fd == ERR) {
+        return;
+    }
+
+    __atomic_store_n(&_trace_enabled, false, __ATOMIC_RELEASE);
+    uint64_t used = __atomic_exchange_n(&_trace_cursor, TRACE_MAX_EVENTS, __ATOMIC_ACQ_REL);
+
+    if(used > TRACE_MAX_EVENTS) {
+        used = TRACE_MAX_EVENTS;
+    }
+
+    _trace_header->threads = __atomic_load_n(&_trace_threads, __ATOMIC_RELAXED);
+    _trace_header->dropped = __atomic_load_n(&_trace_dropped, __ATOMIC_RELAXED);
+
+    if(ftruncate(_trace_fd, sizeof(iso_alloc_trace_header_t) + (used * sizeof(iso_alloc_trace_event_t))) == ERR) {
+        LOG("Could not truncate the trace file");
+    }
+
+    close(_trace_fd);
+    _trace_fd = ERR;
+}
+#endif
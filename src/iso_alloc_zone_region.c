@@ -0,0 +1,140 @@
+/* iso_alloc_zone_region.c - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+#if ZONE_REGION
+#if defined(MAP_NORESERVE)
+#define ZONE_REGION_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+#else
+#define ZONE_REGION_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+
+/* Reserves the zone region. Nothing in it is accessible
+ * until a zone is mapped into one of its slots. The base
+ * is aligned to ZONE_REGION_SPAN so a slot index is just
+ * the offset of a pointer shifted right */
+INTERNAL_HIDDEN void _zone_region_initialize(void) {
+    const size_t size = ZONE_REGION_SIZE + (ZONE_REGION_SPAN * 2);
+    void *hint = NULL;
+
+#if !ENABLE_ASAN
+    hint = (void *) (ROUND_DOWN_PAGE(rand_uint64()) & 0x3FFFFFFFF000);
+#endif
+
+    void *p = mmap(hint, size, PROT_NONE, ZONE_REGION_MAP_FLAGS, -1, 0);
+
+    if(p == MAP_FAILED) {
+        LOG_AND_ABORT("Could not reserve %lu bytes for the zone region", size);
+    }
+
+    uintptr_t base = ((uintptr_t) p + (ZONE_REGION_SPAN - 1)) & ~(ZONE_REGION_SPAN - 1);
+
+    /* Give back whatever is outside the aligned region
+     * and the trailing slot that holds the last guard page */
+    if(base != (uintptr_t) p) {
+        munmap(p, base - (uintptr_t) p);
+    }
+
+    uintptr_t end = base + ZONE_REGION_SIZE + ZONE_REGION_SPAN;
+    munmap((void *) end, ((uintptr_t) p + size) - end);
+
+    _root->zone_region = (void *) base;
+    name_mapping(_root->zone_region, ZONE_REGION_SIZE + ZONE_REGION_SPAN, ZONE_REGION_NAME);
+    __iso_memset(_root->zone_region_slots, 0xff, sizeof(_root->zone_region_slots));
+}
+
+INTERNAL_HIDDEN void _zone_region_destroy(void) {
+    munmap(_root->zone_region, ZONE_REGION_SIZE + ZONE_REGION_SPAN);
+}
+
+/* Maps size bytes at the top of a random free slot and
+ * returns the start of the mapping. The layout matches
+ * what mmap_rw_pages returns to _iso_new_zone, a guard
+ * page followed by the zone and then a guard page. Both
+ * guard pages are left as part of the PROT_NONE region */
+INTERNAL_HIDDEN void *_zone_region_map(size_t size, uint16_t zone_index, int32_t prot, const char *name) {
+    if(UNLIKELY(size > (ZONE_REGION_SPAN - g_page_size))) {
+        LOG_AND_ABORT("Zone of %lu bytes does not fit in a zone region slot", size);
+    }
+
+    uint64_t slot = us_rand_uint64(&_root->seed) % ZONE_REGION_SLOTS;
+
+    for(uint64_t i = 0; i < ZONE_REGION_SLOTS; i++) {
+        if(_root->zone_region_slots[slot] == ZONE_REGION_SLOT_FREE) {
+            break;
+        }
+
+        slot = (slot + 1) % ZONE_REGION_SLOTS;
+    }
+
+    if(UNLIKELY(_root->zone_region_slots[slot] != ZONE_REGION_SLOT_FREE)) {
+        LOG_AND_ABORT("No free slots left in the zone region");
+    }
+
+    void *slot_start = _root->zone_region + (slot << ZONE_REGION_SPAN_SHIFT);
+    void *p = slot_start + ZONE_REGION_SPAN - (size - g_page_size);
+    void *m = mmap(p + g_page_size, size - (g_page_size * 2), prot, ZONE_REGION_MAP_FLAGS | MAP_FIXED, -1, 0);
+
+    if(m == MAP_FAILED) {
+        LOG_AND_ABORT("Failed to map a zone into zone region slot %lu", slot);
+    }
+
+    if(name != NULL) {
+        name_mapping(m, size - (g_page_size * 2), name);
+    }
+
+    _root->zone_region_slots[slot] = zone_index;
+    return p;
+}
+
+/* Returns the slot of a zone to the region. The zone
+ * pointers must already be unmasked by the caller */
+INTERNAL_HIDDEN void _zone_region_unmap(iso_alloc_zone_t *zone) {
+    uint64_t slot = (zone->user_pages_start - _root->zone_region) >> ZONE_REGION_SPAN_SHIFT;
+    void *slot_start = _root->zone_region + (slot << ZONE_REGION_SPAN_SHIFT);
+
+    /* Nothing can find or reuse the slot until it's released */
+    _root->zone_region_slots[slot] = ZONE_REGION_SLOT_RETIRED;
+    _zone_scan_unmap(slot_start, ZONE_REGION_SPAN);
+}
+
+/* Called by _zone_scan_unmap once no scan can be reading
+ * the slot. Mapping over it discards its pages and makes
+ * the whole slot inaccessible again */
+INTERNAL_HIDDEN void _zone_region_release_slot(void *slot_start) {
+    uint64_t slot = (slot_start - _root->zone_region) >> ZONE_REGION_SPAN_SHIFT;
+
+    if(mmap(slot_start, ZONE_REGION_SPAN, PROT_NONE, ZONE_REGION_MAP_FLAGS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        LOG_AND_ABORT("Failed to unmap zone region slot %lu", slot);
+    }
+
+    _root->zone_region_slots[slot] = ZONE_REGION_SLOT_FREE;
+}
+
+/* Returns the zone that owns p without searching. Any
+ * pointer outside of the region or in a guard page
+ * between zones can't belong to a zone */
+INTERNAL_HIDDEN iso_alloc_zone_t *_zone_region_find(const void *p) {
+    const uintptr_t offset = (uintptr_t) p - (uintptr_t) _root->zone_region;
+
+    if(UNLIKELY(offset >= ZONE_REGION_SIZE)) {
+        return NULL;
+    }
+
+    const uint16_t zone_index = _root->zone_region_slots[offset >> ZONE_REGION_SPAN_SHIFT];
+
+    if(UNLIKELY(zone_index >= ZONE_REGION_SLOT_RETIRED)) {
+        return NULL;
+    }
+
+    iso_alloc_zone_t *zone = &_root->zones[zone_index];
+    void *user_pages_start = UNMASK_USER_PTR(zone);
+
+    if(LIKELY(user_pages_start <= p && (user_pages_start + ZONE_USER_SIZE) > p)) {
+        return zone;
+    }
+
+    return NULL;
+}
+#endif
@@ -0,0 +1,293 @@
+/* iso_alloc_zone_scan.c - A secure memory allocator
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc_internal.h"
+
+/* A copy of a zone and its bitmap taken under the root
+ * lock. The zone copy is unmasked and its bitmap_start
+ * still points at the live bitmap, only bm is read */
+typedef struct {
+    iso_alloc_zone_t zone;
+    bitmap_index_t *bm;
+    uint32_t generation;
+    bool failed;
+} zone_snapshot_t;
+
+typedef struct {
+    zone_snapshot_t *snapshots;
+    void *mapping;
+    size_t mapping_size;
+    uint32_t count;
+    uint32_t next;
+    uint32_t started;
+    uint32_t finished;
+    bool ready;
+    int32_t op;
+    uint64_t leaks;
+} zone_scan_t;
+
+INTERNAL_HIDDEN void _zone_unmap_now(void *start, size_t size) {
+#if ZONE_REGION
+    if(((uintptr_t) start - (uintptr_t) _root->zone_region) < ZONE_REGION_SIZE) {
+        _zone_region_release_slot(start);
+        return;
+    }
+#endif
+
+    munmap(start, size);
+}
+
+/* Unmaps the user pages of a destroyed zone, or queues
+ * them if a scan may still be reading them. Destroying a
+ * zone never waits on a scan. The root lock must be held */
+INTERNAL_HIDDEN void _zone_scan_unmap(void *start, size_t size) {
+    if(_root->zone_scans == 0) {
+        _zone_unmap_now(start, size);
+        return;
+    }
+
+    if(_root->deferred_unmap_count == _root->deferred_unmap_capacity) {
+        const uint32_t capacity = (_root->deferred_unmap_capacity == 0) ? (g_page_size / sizeof(zone_unmap_t)) : (_root->deferred_unmap_capacity * 2);
+        zone_unmap_t *unmaps = (zone_unmap_t *) mmap_rw_pages(capacity * sizeof(zone_unmap_t), false, NULL);
+
+        if(unmaps == NULL) {
+            LOG_AND_ABORT("Could not grow the deferred zone unmap list to %d entries", capacity);
+        }
+
+        if(_root->deferred_unmaps != NULL) {
+            __iso_memcpy(unmaps, _root->deferred_unmaps, _root->deferred_unmap_count * sizeof(zone_unmap_t));
+            munmap(_root->deferred_unmaps, _root->deferred_unmap_capacity * sizeof(zone_unmap_t));
+        }
+
+        _root->deferred_unmaps = unmaps;
+        _root->deferred_unmap_capacity = capacity;
+    }
+
+    _root->deferred_unmaps[_root->deferred_unmap_count].start = start;
+    _root->deferred_unmaps[_root->deferred_unmap_count].size = size;
+    _root->deferred_unmap_count++;
+}
+
+/* A scan holds a reference on every zone mapping from
+ * when it takes its snapshot until it ends. Both are
+ * called with the root lock held */
+INTERNAL_HIDDEN void _zone_scan_begin(void) {
+    _root->zone_scans++;
+}
+
+INTERNAL_HIDDEN void _zone_scan_end(void) {
+    if(--_root->zone_scans != 0) {
+        return;
+    }
+
+    for(uint32_t i = 0; i < _root->deferred_unmap_count; i++) {
+        _zone_unmap_now(_root->deferred_unmaps[i].start, _root->deferred_unmaps[i].size);
+    }
+
+    _root->deferred_unmap_count = 0;
+}
+
+/* Called with the root lock held before a zone's pages are
+ * reset, released or destroyed. A scan that read the zone
+ * while this happened sees a new generation and discards
+ * what it found. This is the write side of a seqlock */
+INTERNAL_HIDDEN void _zone_scan_invalidate(iso_alloc_zone_t *zone) {
+    __atomic_add_fetch(&_root->zone_generations[zone->index], 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* Returns true if the zone was reset, released or destroyed
+ * since its snapshot was taken. Reads of the zone's pages
+ * must come before this */
+INTERNAL_HIDDEN INLINE bool _zone_snapshot_stale(const zone_snapshot_t *s) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&_root->zone_generations[s->zone.index], __ATOMIC_RELAXED) != s->generation;
+}
+
+/* Pulls snapshots off the shared index until there are
+ * none left. Runs on the calling thread and every worker.
+ * Results for a zone that changed under the scan are
+ * dropped, its chunks were all freed or replaced */
+INTERNAL_HIDDEN void _zone_scan_run(zone_scan_t *scan) {
+    uint64_t leaks = 0;
+
+    while(true) {
+        const uint32_t i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED);
+
+        if(i >= scan->count) {
+            break;
+        }
+
+        zone_snapshot_t *s = &scan->snapshots[i];
+
+        if(scan->op == ZONE_SCAN_LEAKS) {
+            uint64_t was_used = 0;
+            const uint64_t zone_leaks = _zone_bitmap_leaks(&s->zone, s->bm, false, &was_used);
+
+            if(_zone_snapshot_stale(s) == false) {
+                leaks += zone_leaks;
+            }
+        } else if(_verify_zone_bitmap(&s->zone, s->bm, false) == ERR && _zone_snapshot_stale(s) == false) {
+            s->failed = true;
+        }
+    }
+
+    __atomic_add_fetch(&scan->leaks, leaks, __ATOMIC_RELAXED);
+}
+
+#if THREAD_SUPPORT
+INTERNAL_HIDDEN void *_zone_scan_worker(void *arg) {
+    zone_scan_t *scan = (zone_scan_t *) arg;
+
+    __atomic_add_fetch(&scan->started, 1, __ATOMIC_RELEASE);
+
+    while(__atomic_load_n(&scan->ready, __ATOMIC_ACQUIRE) == false) {
+        sched_yield();
+    }
+
+    _zone_scan_run(scan);
+    __atomic_add_fetch(&scan->finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+#endif
+
+/* Copies every zone and its bitmap into a single mapping.
+ * The root lock must be held. Returns false if there is
+ * nothing to scan or the mapping could not be created */
+INTERNAL_HIDDEN bool _zone_scan_snapshot(zone_scan_t *scan) {
+    uint32_t count = 0;
+    size_t size = 0;
+
+    for(uint16_t i = 0; i < _root->zones_used; i++) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+
+        if(zone->bitmap_start == NULL || zone->user_pages_start == NULL) {
+            break;
+        }
+
+        size += sizeof(zone_snapshot_t) + zone->bitmap_size;
+        count++;
+    }
+
+    if(count == 0) {
+        return false;
+    }
+
+    scan->mapping_size = ROUND_UP_PAGE(size);
+    scan->mapping = mmap_rw_pages(scan->mapping_size, true, ZONE_SCAN_NAME);
+
+    if(scan->mapping == NULL) {
+        return false;
+    }
+
+    scan->snapshots = (zone_snapshot_t *) scan->mapping;
+
+    /* Bitmap sizes are multiples of a qword so every
+     * copy is aligned for bitmap_index_t */
+    uint8_t *bm = (uint8_t *) scan->mapping + (sizeof(zone_snapshot_t) * count);
+
+    for(uint32_t i = 0; i < count; i++) {
+        iso_alloc_zone_t *zone = &_root->zones[i];
+        zone_snapshot_t *s = &scan->snapshots[i];
+
+        UNMASK_ZONE_PTRS(zone);
+        __iso_memcpy(&s->zone, zone, sizeof(iso_alloc_zone_t));
+        __iso_memcpy(bm, zone->bitmap_start, zone->bitmap_size);
+        MASK_ZONE_PTRS(zone);
+
+        s->bm = (bitmap_index_t *) bm;
+        s->generation = _root->zone_generations[i];
+        bm += s->zone.bitmap_size;
+    }
+
+    scan->count = count;
+    return true;
+}
+
+/* Runs a leak or verify scan over every zone. The root lock
+ * is only held while the bitmaps are copied, the chunks are
+ * read without it. A zone destroyed during the scan keeps
+ * its user pages mapped until the scan ends, and a zone
+ * reset during the scan is skipped. Chunks can still be
+ * allocated and freed under the scan so a zone that fails
+ * verification is checked again under the lock before
+ * aborting. Returns the number of leaked chunks */
+INTERNAL_HIDDEN uint64_t _iso_alloc_scan_zones(int32_t op) {
+    zone_scan_t scan;
+    __iso_memset(&scan, 0x0, sizeof(scan));
+    scan.op = op;
+
+#if THREAD_SUPPORT
+    pthread_t workers[ZONE_SCAN_WORKERS];
+    uint32_t worker_count = __atomic_load_n(&_root->zones_used, __ATOMIC_RELAXED) / ZONE_SCAN_ZONES_PER_WORKER;
+
+    if(worker_count > ZONE_SCAN_WORKERS) {
+        worker_count = ZONE_SCAN_WORKERS;
+    }
+
+    /* Workers are started before the root lock is taken
+     * because creating a thread may allocate. Each one waits
+     * for the snapshot before touching any zone */
+    for(uint32_t i = 0; i < worker_count; i++) {
+        if(pthread_create(&workers[i], NULL, _zone_scan_worker, &scan) != 0) {
+            worker_count = i;
+            break;
+        }
+    }
+
+    while(__atomic_load_n(&scan.started, __ATOMIC_ACQUIRE) != worker_count) {
+        sched_yield();
+    }
+#endif
+
+    LOCK_ROOT();
+    const bool snapshot = _zone_scan_snapshot(&scan);
+
+    if(snapshot == true) {
+        _zone_scan_begin();
+    }
+
+    UNLOCK_ROOT();
+
+#if THREAD_SUPPORT
+    __atomic_store_n(&scan.ready, true, __ATOMIC_RELEASE);
+#endif
+
+    _zone_scan_run(&scan);
+
+#if THREAD_SUPPORT
+    while(__atomic_load_n(&scan.finished, __ATOMIC_ACQUIRE) != worker_count) {
+        sched_yield();
+    }
+#endif
+
+#if THREAD_SUPPORT
+    for(uint32_t i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+#endif
+
+    if(snapshot == false) {
+        return 0;
+    }
+
+    LOCK_ROOT();
+    _zone_scan_end();
+
+    if(op == ZONE_SCAN_VERIFY) {
+        for(uint32_t i = 0; i < scan.count; i++) {
+            zone_snapshot_t *s = &scan.snapshots[i];
+
+            /* A zone that changed since the snapshot was
+             * taken has nothing left to check */
+            if(s->failed == true && _zone_snapshot_stale(s) == false) {
+                _verify_zone(&_root->zones[i]);
+            }
+        }
+    }
+
+    UNLOCK_ROOT();
+
+    munmap(scan.mapping, scan.mapping_size);
+    return scan.leaks;
+}
@@ -21,6 +21,130 @@
  */
 #if MALLOC_HOOK
 
+#if ALLOC_TRACE
+/* With ALLOC_TRACE enabled every event is recorded after
+ * the allocator returns a chunk and before a chunk is freed.
+ * This keeps the sequence numbers in the trace consistent
+ * with address reuse across threads */
+static void *trace_alloc(size_t s) {
+    void *p = iso_alloc(s);
+
+    if(p != NULL) {
+        _iso_trace_record(TRACE_OP_MALLOC, p, NULL, s, iso_chunksz(p));
+    }
+
+    return p;
+}
+
+static void *trace_calloc(size_t n, size_t s) {
+    void *p = iso_calloc(n, s);
+
+    if(p != NULL) {
+        _iso_trace_record(TRACE_OP_CALLOC, p, NULL, n * s, iso_chunksz(p));
+    }
+
+    return p;
+}
+
+static void trace_free(void *p) {
+    if(p != NULL) {
+        _iso_trace_record(TRACE_OP_FREE, p, NULL, 0, 0);
+    }
+
+    iso_free(p);
+}
+
+/* This mirrors iso_realloc but records the event between
+ * allocating the new chunk and freeing the old one. Neither
+ * address can be handed to another thread in that window */
+static void *trace_realloc(void *p, size_t s) {
+    if(s == 0) {
+        trace_free(p);
+        return NULL;
+    }
+
+    void *r = iso_alloc(s);
+
+    if(r == NULL) {
+        return r;
+    }
+
+    size_t chunk_size = iso_chunksz(p);
+
+    if(p != NULL) {
+        _iso_alloc_memcpy(r, p, (s > chunk_size) ? chunk_size : s);
+    }
+
+    _iso_trace_record(TRACE_OP_REALLOC, r, p, s, iso_chunksz(r));
+
+#if PERM_FREE_REALLOC
+    iso_free_permanently(p);
+#else
+    iso_free_size(p, chunk_size);
+#endif
+
+    return r;
+}
+
+static void *trace_reallocarray(void *p, size_t n, size_t s) {
+    size_t res;
+
+    /* Same checks as iso_reallocarray */
+    if(__builtin_mul_overflow(n, s, &res) || res > BIG_SZ_MAX) {
+        return NULL;
+    }
+
+    return trace_realloc(p, res);
+}
+
+#define hook_alloc trace_alloc
+#define hook_free trace_free
+#define hook_realloc trace_realloc
+
+EXTERNAL_API void *__libc_malloc(size_t s) {
+    return trace_alloc(s);
+}
+
+EXTERNAL_API void *malloc(size_t s) {
+    return trace_alloc(s);
+}
+
+EXTERNAL_API void __libc_free(void *p) {
+    trace_free(p);
+}
+
+EXTERNAL_API void free(void *p) {
+    trace_free(p);
+}
+
+EXTERNAL_API void *__libc_calloc(size_t n, size_t s) {
+    return trace_calloc(n, s);
+}
+
+EXTERNAL_API void *calloc(size_t n, size_t s) {
+    return trace_calloc(n, s);
+}
+
+EXTERNAL_API void *__libc_realloc(void *p, size_t s) {
+    return trace_realloc(p, s);
+}
+
+EXTERNAL_API void *realloc(void *p, size_t s) {
+    return trace_realloc(p, s);
+}
+
+EXTERNAL_API void *__libc_reallocarray(void *p, size_t n, size_t s) {
+    return trace_reallocarray(p, n, s);
+}
+
+EXTERNAL_API void *reallocarray(void *p, size_t n, size_t s) {
+    return trace_reallocarray(p, n, s);
+}
+#else
+#define hook_alloc iso_alloc
+#define hook_free iso_free
+#define hook_realloc iso_realloc
+
 /* malloc/free/calloc/realloc and their __libc_ variants are
  * direct linker aliases for the iso_ equivalents on GCC >= 9
  * and Clang >= 10 (see iso_alloc_hook.h). This propagates all
@@ -46,6 +170,7 @@ EXTERNAL_API void *realloc(void *p, size_t s) ISO_FORWARD2(iso_realloc, p, s)
 
 EXTERNAL_API void *__libc_reallocarray(void *p, size_t n, size_t s) ISO_FORWARD3(iso_reallocarray, p, n, s)
 EXTERNAL_API void *reallocarray(void *p, size_t n, size_t s) ISO_FORWARD3(iso_reallocarray, p, n, s)
+#endif
 
 EXTERNAL_API int __posix_memalign(void **r, size_t a, size_t s) {
     if(is_pow2(a) == false) {
@@ -57,7 +182,7 @@ EXTERNAL_API int __posix_memalign(void **r, size_t a, size_t s) {
         s = a;
     }
 
-    *r = iso_alloc(s);
+    *r = hook_alloc(s);
 
     if(*r != NULL) {
         return 0;
@@ -72,17 +197,17 @@ EXTERNAL_API int posix_memalign(void **r, size_t alignment, size_t s) {
 
 EXTERNAL_API void *__libc_memalign(size_t alignment, size_t s) {
     /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    return hook_alloc(s);
 }
 
 EXTERNAL_API void *aligned_alloc(size_t alignment, size_t s) {
     /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    return hook_alloc(s);
 }
 
 EXTERNAL_API void *memalign(size_t alignment, size_t s) {
     /* All iso_alloc allocations are 8 byte aligned */
-    return iso_alloc(s);
+    return hook_alloc(s);
 }
 
 #if __ANDROID__ || __FreeBSD__
@@ -103,16 +228,16 @@ EXTERNAL_API size_t malloc_usable_size(void *ptr) ISO_FORWARD1(iso_chunksz, ptr)
 #endif
 
 static void *libc_malloc(size_t s, const void *caller) {
-    return iso_alloc(s);
+    return hook_alloc(s);
 }
 static void *libc_realloc(void *ptr, size_t s, const void *caller) {
-    return iso_realloc(ptr, s);
+    return hook_realloc(ptr, s);
 }
 static void libc_free(void *ptr, const void *caller) {
-    iso_free(ptr);
+    hook_free(ptr);
 }
 static void *libc_memalign(size_t alignment, size_t s, const void *caller) {
-    return iso_alloc(s);
+    return hook_alloc(s);
 }
 
 #if !__ANDROID__
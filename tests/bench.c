@@ -0,0 +1,390 @@
+/* iso_alloc bench.c
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <sched.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/* Multithreaded allocator benchmark. Each workload is
+ * run with 1..N threads and reports throughput along
+ * with current and peak RSS. The same source is built
+ * against system malloc with MALLOC_PERF_TEST */
+#if MALLOC_PERF_TEST
+#define alloc_mem malloc
+#define free_mem free
+#define ALLOCATOR_NAME "malloc"
+#else
+#define alloc_mem iso_alloc
+#define free_mem iso_free
+#define ALLOCATOR_NAME "IsoAlloc"
+#endif
+
+#define MAX_THREADS 64
+#define LARSON_SLOTS 1024
+#define LARSON_ROUNDS 16
+#define RING_SIZE 256
+#define XMALLOC_BATCH 64
+#define RANDOM_SLOTS 4096
+
+typedef struct {
+    int32_t id;
+    int32_t threads;
+    uint64_t ops;
+    uint64_t seed;
+} bench_thread_t;
+
+typedef struct xmalloc_batch {
+    struct xmalloc_batch *next;
+    void *ptrs[XMALLOC_BATCH];
+} xmalloc_batch_t;
+
+typedef struct {
+    void *ring[RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} __attribute__((aligned(64))) spsc_ring_t;
+
+static uint64_t ops_per_thread = 200000;
+
+static void *larson_slots[MAX_THREADS][LARSON_SLOTS];
+static uint32_t barrier_count;
+static uint32_t barrier_generation;
+
+static spsc_ring_t rings[MAX_THREADS];
+
+static pthread_mutex_t xmalloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static xmalloc_batch_t *xmalloc_batches;
+
+/* Per-thread xorshift so rand() locking doesn't
+ * show up in the results */
+static inline uint64_t bench_rand(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    return x;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static uint64_t rss_bytes(void) {
+    uint64_t size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if(f == NULL) {
+        return 0;
+    }
+
+    if(fscanf(f, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t peak_rss_bytes(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#if __APPLE__
+    return ru.ru_maxrss;
+#else
+    return ru.ru_maxrss * 1024;
+#endif
+}
+
+static void *alloc_touch(size_t size) {
+    uint8_t *p = (uint8_t *) alloc_mem(size);
+
+    if(p == NULL) {
+        LOG_AND_ABORT("Failed to allocate %ld bytes", size);
+    }
+
+    p[0] = 0x41;
+    return p;
+}
+
+/* Generation counting barrier, pthread_barrier_t
+ * isn't available on every platform we support */
+static void barrier_wait(int32_t threads) {
+    uint32_t gen = __atomic_load_n(&barrier_generation, __ATOMIC_ACQUIRE);
+
+    if(__atomic_add_fetch(&barrier_count, 1, __ATOMIC_ACQ_REL) == (uint32_t) threads) {
+        __atomic_store_n(&barrier_count, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&barrier_generation, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    while(__atomic_load_n(&barrier_generation, __ATOMIC_ACQUIRE) == gen) {
+        sched_yield();
+    }
+}
+
+/* Larson style server churn. Each thread replaces random
+ * objects in a working set with new ones of a random size.
+ * Between rounds every working set moves to the next thread
+ * so objects are freed by a thread that didn't allocate them */
+static void *larson(void *arg) {
+    bench_thread_t *bt = (bench_thread_t *) arg;
+    uint64_t per_round = ops_per_thread / LARSON_ROUNDS;
+
+    for(int32_t i = 0; i < LARSON_SLOTS; i++) {
+        larson_slots[bt->id][i] = alloc_touch(16 + (bench_rand(&bt->seed) % 497));
+    }
+
+    for(int32_t r = 0; r < LARSON_ROUNDS; r++) {
+        barrier_wait(bt->threads);
+        void **slots = larson_slots[(bt->id + r) % bt->threads];
+
+        for(uint64_t i = 0; i < per_round; i++) {
+            uint32_t idx = bench_rand(&bt->seed) % LARSON_SLOTS;
+            free_mem(slots[idx]);
+            slots[idx] = alloc_touch(16 + (bench_rand(&bt->seed) % 497));
+            bt->ops += 2;
+        }
+    }
+
+    barrier_wait(bt->threads);
+
+    for(int32_t i = 0; i < LARSON_SLOTS; i++) {
+        free_mem(larson_slots[bt->id][i]);
+    }
+
+    return NULL;
+}
+
+static bool ring_push(spsc_ring_t *r, void *p) {
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    if(head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+        return false;
+    }
+
+    r->ring[head % RING_SIZE] = p;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void *ring_pop(spsc_ring_t *r) {
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    if(tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    void *p = r->ring[tail % RING_SIZE];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+/* Every thread produces into its own ring and frees
+ * the objects produced by the previous thread. With a
+ * single thread it consumes its own ring */
+static void *producer_consumer(void *arg) {
+    bench_thread_t *bt = (bench_thread_t *) arg;
+    spsc_ring_t *out = &rings[bt->id];
+    spsc_ring_t *in = &rings[(bt->id + bt->threads - 1) % bt->threads];
+    uint64_t produced = 0, consumed = 0;
+    void *pending = NULL;
+
+    while(produced < ops_per_thread || consumed < ops_per_thread) {
+        bool progress = false;
+
+        if(produced < ops_per_thread) {
+            if(pending == NULL) {
+                pending = alloc_touch(16 + (bench_rand(&bt->seed) % 1009));
+            }
+
+            if(ring_push(out, pending) == true) {
+                pending = NULL;
+                produced++;
+                progress = true;
+            }
+        }
+
+        if(consumed < ops_per_thread) {
+            void *p = ring_pop(in);
+
+            if(p != NULL) {
+                free_mem(p);
+                consumed++;
+                progress = true;
+            }
+        }
+
+        /* Don't burn the neighbor's timeslice when
+         * there are more threads than CPUs */
+        if(progress == false) {
+            sched_yield();
+        }
+    }
+
+    bt->ops = produced + consumed;
+    return NULL;
+}
+
+/* xmalloc style. Threads allocate batches of objects and
+ * publish them on a shared list, then free whichever batch
+ * is at the head of that list, usually another thread's */
+static void *xmalloc(void *arg) {
+    bench_thread_t *bt = (bench_thread_t *) arg;
+    uint64_t batches = ops_per_thread / (XMALLOC_BATCH * 2);
+
+    for(uint64_t b = 0; b < batches; b++) {
+        xmalloc_batch_t *batch = (xmalloc_batch_t *) alloc_touch(sizeof(xmalloc_batch_t));
+
+        for(int32_t i = 0; i < XMALLOC_BATCH; i++) {
+            batch->ptrs[i] = alloc_touch(8 + (bench_rand(&bt->seed) % 121));
+        }
+
+        pthread_mutex_lock(&xmalloc_mutex);
+        batch->next = xmalloc_batches;
+        xmalloc_batches = batch;
+        batch = xmalloc_batches->next;
+        xmalloc_batches->next = (batch != NULL) ? batch->next : NULL;
+        pthread_mutex_unlock(&xmalloc_mutex);
+
+        if(batch != NULL) {
+            for(int32_t i = 0; i < XMALLOC_BATCH; i++) {
+                free_mem(batch->ptrs[i]);
+            }
+
+            free_mem(batch);
+        }
+
+        bt->ops += (XMALLOC_BATCH + 1) * 2;
+    }
+
+    return NULL;
+}
+
+/* A size distribution skewed towards small objects
+ * with a tail that reaches the big zone path */
+static size_t random_size(uint64_t *seed) {
+    uint64_t r = bench_rand(seed);
+    uint32_t pct = r % 100;
+    r >>= 8;
+
+    if(pct < 80) {
+        return 16 + (r % 241);
+    } else if(pct < 95) {
+        return 256 + (r % 3841);
+    } else if(pct < 99) {
+        return 4096 + (r % 61441);
+    }
+
+    return 65536 + (r % 983041);
+}
+
+static void *random_sizes(void *arg) {
+    bench_thread_t *bt = (bench_thread_t *) arg;
+    void **slots = (void **) calloc(RANDOM_SLOTS, sizeof(void *));
+
+    for(uint64_t i = 0; i < ops_per_thread; i++) {
+        uint32_t idx = bench_rand(&bt->seed) % RANDOM_SLOTS;
+
+        if(slots[idx] != NULL) {
+            free_mem(slots[idx]);
+            bt->ops++;
+        }
+
+        slots[idx] = alloc_touch(random_size(&bt->seed));
+        bt->ops++;
+    }
+
+    for(int32_t i = 0; i < RANDOM_SLOTS; i++) {
+        if(slots[i] != NULL) {
+            free_mem(slots[i]);
+            bt->ops++;
+        }
+    }
+
+    free(slots);
+    return NULL;
+}
+
+static void run_workload(const char *name, void *(*fn)(void *), int32_t threads) {
+    pthread_t t[MAX_THREADS];
+    bench_thread_t bt[MAX_THREADS];
+
+    xmalloc_batches = NULL;
+    memset(rings, 0x0, sizeof(rings));
+
+    uint64_t start = now_ns();
+
+    for(int32_t i = 0; i < threads; i++) {
+        bt[i].id = i;
+        bt[i].threads = threads;
+        bt[i].ops = 0;
+        bt[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        pthread_create(&t[i], NULL, fn, &bt[i]);
+    }
+
+    uint64_t ops = 0;
+
+    for(int32_t i = 0; i < threads; i++) {
+        pthread_join(t[i], NULL);
+        ops += bt[i].ops;
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    /* Batches still on the shared list belong to nobody */
+    while(xmalloc_batches != NULL) {
+        xmalloc_batch_t *batch = xmalloc_batches;
+        xmalloc_batches = batch->next;
+
+        for(int32_t i = 0; i < XMALLOC_BATCH; i++) {
+            free_mem(batch->ptrs[i]);
+        }
+
+        free_mem(batch);
+    }
+
+    fprintf(stdout, "%-18s %-8s threads=%-3d ops/sec=%-12.0f rss=%luKB peak_rss=%luKB\n", name, ALLOCATOR_NAME,
+            threads, (double) ops / ((double) elapsed / 1000000000.0), rss_bytes() / 1024, peak_rss_bytes() / 1024);
+}
+
+/* Usage: bench [max threads] [operations per thread] */
+int main(int argc, char *argv[]) {
+    int32_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+
+    if(argc > 2) {
+        ops_per_thread = strtoull(argv[2], NULL, 10);
+    }
+
+    if(max_threads < 1) {
+        max_threads = 1;
+    } else if(max_threads > MAX_THREADS) {
+        max_threads = MAX_THREADS;
+    }
+
+    for(int32_t i = 1; i <= max_threads; i++) {
+        run_workload("larson", larson, i);
+    }
+
+    for(int32_t i = 1; i <= max_threads; i++) {
+        run_workload("producer_consumer", producer_consumer, i);
+    }
+
+    for(int32_t i = 1; i <= max_threads; i++) {
+        run_workload("xmalloc", xmalloc, i);
+    }
+
+    for(int32_t i = 1; i <= max_threads; i++) {
+        run_workload("random_sizes", random_sizes, i);
+    }
+
+    return 0;
+}
@@ -35,6 +35,16 @@ int main(int argc, char *argv[]) {
         LOG_AND_ABORT("Failed to allocate a big zone of %d bytes", ZONE_USER_SIZE + (ZONE_USER_SIZE / 4));
     }
 
+    /* Looking up the size of a big zone must not
+     * remove it from the list of in use big zones */
+    if(iso_chunksz(r) < ZONE_USER_SIZE + (ZONE_USER_SIZE / 4) || iso_chunksz(q) < ZONE_USER_SIZE + (ZONE_USER_SIZE / 2)) {
+        LOG_AND_ABORT("Big zone chunk size is smaller than requested");
+    }
+
+    if(iso_chunksz(r) == 0 || iso_chunksz(q) == 0) {
+        LOG_AND_ABORT("Big zone lost after iso_chunksz");
+    }
+
     iso_free_permanently(r);
     iso_free(q);
 
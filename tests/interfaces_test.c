@@ -73,6 +73,11 @@ int main(int argc, char *argv[]) {
         LOG_AND_ABORT("Could not create a zone");
     }
 
+    /* Kernels built without CONFIG_ANON_VMA_NAME reject the name */
+    if(iso_alloc_name_zone(zone, "private zone") != 0 && errno != EINVAL) {
+        LOG_AND_ABORT("Could not name private zone");
+    }
+
     p = iso_alloc_from_zone(zone);
 
     if(p == NULL) {
@@ -103,6 +108,15 @@ int main(int argc, char *argv[]) {
     void *sz = iso_alloc(8192);
     iso_free_size(sz, 8192);
 
+    /* Sized frees of chunks that landed in their own size
+     * class and of ones that were placed in a larger zone */
+    for(size_t i = 1; i <= 1024; i++) {
+        void *szp = iso_alloc(i);
+        iso_free_size(szp, i);
+    }
+
+    iso_flush_caches();
+
     uint8_t *ap = NULL;
     int rr = 0;
     rr = posix_memalign((void **) &ap, 16, 64);
@@ -118,29 +132,139 @@ int main(int argc, char *argv[]) {
     free(ap);
 
 #if HEAP_PROFILER
-    iso_alloc_traces_t at[BACKTRACE_DEPTH_SZ];
-    size_t alloc_trace_count = iso_get_alloc_traces(at);
+    iso_alloc_traces_t at[128];
+    size_t alloc_trace_count = iso_get_alloc_traces(at, 128);
 
-    for(int32_t i = 0; i < alloc_trace_count; i++) {
+    for(int32_t i = 0; i < alloc_trace_count && i < 128; i++) {
         iso_alloc_traces_t *abts = &at[i];
         LOG("alloc_backtrace=%d,backtrace_hash=0x%x,calls=%d,lower_bound_size=%d,upper_bound_size=%d,0x%x,0x%x,0x%x,0x%x,0x%x,0x%x,0x%x,0x%x\n",
             i, abts->backtrace_hash, abts->call_count, abts->lower_bound_size, abts->upper_bound_size, abts->callers[0], abts->callers[1],
             abts->callers[2], abts->callers[3], abts->callers[4], abts->callers[5], abts->callers[6], abts->callers[7]);
     }
 
-    iso_free_traces_t ft[BACKTRACE_DEPTH_SZ];
-    size_t free_trace_count = iso_get_free_traces(ft);
+    iso_free_traces_t ft[128];
+    size_t free_trace_count = iso_get_free_traces(ft, 128);
 
-    for(int32_t i = 0; i < free_trace_count; i++) {
+    for(int32_t i = 0; i < free_trace_count && i < 128; i++) {
         iso_free_traces_t *fbts = &ft[i];
         LOG("free_backtrace=%d,backtrace_hash=0x%x,calls=%d,0x%x,0x%x,0x%x,0x%x,0x%x,0x%x,0x%x,0x%x\n",
             i, fbts->backtrace_hash, fbts->call_count, fbts->callers[0], fbts->callers[1], fbts->callers[2], fbts->callers[3],
             fbts->callers[4], fbts->callers[5], fbts->callers[6], fbts->callers[7]);
     }
 
+    iso_alloc_write_profile();
     iso_alloc_reset_traces();
 #endif
 
+    iso_alloc_stats_t stats;
+    p = iso_alloc(128);
+    void *big = iso_alloc(SMALL_SIZE_MAX * 2);
+    iso_alloc_get_stats(&stats);
+
+#if ALLOC_STATS
+    uint64_t active_chunks = 0;
+
+    for(int32_t i = 0; i < ISO_ALLOC_STATS_SIZE_CLASSES; i++) {
+        active_chunks += stats.active_chunks[i];
+    }
+
+    if(stats.allocations == 0 || stats.allocated_bytes < 128 || active_chunks == 0) {
+        LOG_AND_ABORT("iso_alloc_get_stats did not count small allocations");
+    }
+
+    if(stats.big_allocations == 0 || stats.big_allocated_bytes < (SMALL_SIZE_MAX * 2)) {
+        LOG_AND_ABORT("iso_alloc_get_stats did not count big allocations");
+    }
+
+    if(stats.zone_creations < stats.zones) {
+        LOG_AND_ABORT("iso_alloc_get_stats created %lu zones but %lu are in use", stats.zone_creations, stats.zones);
+    }
+#endif
+
+    if(stats.zones == 0) {
+        LOG_AND_ABORT("iso_alloc_get_stats found no zones");
+    }
+
+    iso_free(p);
+    iso_free(big);
+
+#if ALLOC_STATS
+    /* Chunks left in a private zone that is reset or
+     * destroyed must not stay in the counters */
+    iso_alloc_stats_t before, after;
+    iso_flush_caches();
+    iso_alloc_get_stats(&before);
+
+    iso_alloc_zone_handle *stats_zone = iso_alloc_new_zone(256);
+
+    for(int32_t i = 0; i < 16; i++) {
+        p = iso_alloc_from_zone(stats_zone);
+    }
+
+    iso_alloc_zone_reset(stats_zone, false);
+
+    for(int32_t i = 0; i < 16; i++) {
+        p = iso_alloc_from_zone(stats_zone);
+    }
+
+    iso_alloc_destroy_zone(stats_zone);
+    iso_alloc_get_stats(&after);
+
+    for(int32_t i = 0; i < ISO_ALLOC_STATS_SIZE_CLASSES; i++) {
+        if(after.active_chunks[i] != before.active_chunks[i]) {
+            LOG_AND_ABORT("iso_alloc_get_stats still counts chunks from a reset or destroyed zone");
+        }
+    }
+
+    if(after.allocated_bytes != before.allocated_bytes) {
+        LOG_AND_ABORT("iso_alloc_get_stats still counts bytes from a reset or destroyed zone");
+    }
+#endif
+
+    iso_alloc_latency_t latency;
+    iso_alloc_get_latency(&latency);
+
+#if ALLOC_LATENCY
+    uint64_t small_allocs = latency.paths[ISO_ALLOC_LATENCY_CACHE_HIT].count +
+                            latency.paths[ISO_ALLOC_LATENCY_SLOW_SCAN].count +
+                            latency.paths[ISO_ALLOC_LATENCY_NEW_ZONE].count;
+    uint64_t big_allocs = latency.paths[ISO_ALLOC_LATENCY_BIG_REUSE].count +
+                          latency.paths[ISO_ALLOC_LATENCY_BIG_MMAP].count;
+
+    if(small_allocs == 0 || big_allocs == 0 || latency.paths[ISO_ALLOC_LATENCY_FREE].count == 0) {
+        LOG_AND_ABORT("iso_alloc_get_latency did not record all allocator paths");
+    }
+
+    for(int32_t i = 0; i < ISO_ALLOC_LATENCY_PATHS; i++) {
+        iso_alloc_latency_path_t *lp = &latency.paths[i];
+
+        if(lp->p50 > lp->p99 || lp->p99 > lp->p999 || (lp->count != 0 && lp->max == 0)) {
+            LOG_AND_ABORT("iso_alloc_get_latency returned inconsistent percentiles for path %d", i);
+        }
+    }
+
+    iso_alloc_dump_latency(STDOUT_FILENO);
+#else
+    if(latency.paths[ISO_ALLOC_LATENCY_CACHE_HIT].count != 0) {
+        LOG_AND_ABORT("iso_alloc_get_latency recorded latency with ALLOC_LATENCY disabled");
+    }
+#endif
+
+    iso_alloc_lock_profile_t lock_profile;
+    iso_alloc_get_lock_profile(&lock_profile);
+
+#if LOCK_PROFILER && THREAD_SUPPORT
+    iso_alloc_lock_stats_t *root_lock = &lock_profile.locks[ISO_ALLOC_LOCK_ROOT];
+
+    if(root_lock->acquisitions == 0 || root_lock->contended > root_lock->acquisitions) {
+        LOG_AND_ABORT("iso_alloc_get_lock_profile returned bad root lock counters");
+    }
+
+    if(lock_profile.locks[ISO_ALLOC_LOCK_BIG_ZONE_FREE].acquisitions == 0) {
+        LOG_AND_ABORT("iso_alloc_get_lock_profile did not count big zone free list acquisitions");
+    }
+#endif
+
     iso_flush_caches();
     iso_verify_zones();
 
@@ -4,6 +4,40 @@
 #include "iso_alloc.h"
 #include "iso_alloc_internal.h"
 
+#define DROPPED_CHUNKS 64
+#define BIG_SZ (SMALL_SIZE_MAX * 4)
+
+/* These chunks and the big zone are only referenced from
+ * a chunk that is freed, a reachability scan reports every
+ * one of them. The chunk held by the second big zone is only
+ * referenced from it, a reachability scan must follow it */
+NO_INLINE int32_t drop_references(void **big) {
+    void **refs = (void **) iso_alloc(sizeof(void *) * (DROPPED_CHUNKS + 1));
+
+    for(int32_t i = 0; i < DROPPED_CHUNKS; i++) {
+        refs[i] = iso_alloc(128);
+    }
+
+    refs[DROPPED_CHUNKS] = iso_alloc(BIG_SZ);
+    *big = iso_alloc(BIG_SZ);
+    *(void **) *big = iso_alloc(128);
+
+    iso_free(refs);
+    iso_flush_caches();
+    return DROPPED_CHUNKS;
+}
+
+/* Clears the stack below the caller so no stale copy
+ * of a dropped pointer is left for the scan to find */
+NO_INLINE void scrub_stack(void) {
+    uint8_t stack[65536];
+    memset(stack, 0x0, sizeof(stack));
+    __asm__ __volatile__(""
+                         :
+                         : "r"(stack)
+                         : "memory");
+}
+
 int main(int argc, char *argv[]) {
     void *p[16];
     int32_t leak = 0;
@@ -19,14 +53,29 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    void *big = NULL;
+    int32_t dropped = drop_references(&big);
+    scrub_stack();
+
     for(int32_t i = 0; i < 16; i++) {
         LOG("p[%d] (%p) = %p", i, &p[i], p[i]);
     }
 
     iso_verify_zones();
-    int32_t r = iso_alloc_detect_leaks();
+    int64_t r = iso_alloc_detect_leaks();
+
+    LOG("Total leaks detected: %ld %p of %d and %d bytes in big zones", r, p, leak + dropped + 1, BIG_SZ * 2);
 
-    LOG("Total leaks detected: %d %p of %d", r, p, leak);
+#if LEAK_REACHABILITY
+    /* Chunks still referenced from p or the second big zone
+     * are not leaks. This test is expected to return non zero */
+    if(r != (dropped + BIG_SZ)) {
+        LOG("Reachability scan found %ld leaks but %d chunks and %d big zone bytes were dropped", r, dropped, BIG_SZ);
+        return 0;
+    }
+#endif
 
-    return r;
+    /* Keeps the second big zone referenced until the scan is done */
+    LOG("Big zone %p", big);
+    return r != 0;
 }
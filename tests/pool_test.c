@@ -33,6 +33,170 @@ int allocate(size_t array_size, size_t allocation_size) {
     return OK;
 }
 
+/* Allocating past the capacity of a private zone
+ * links another zone of the same size behind it */
+int grow(size_t allocation_size) {
+    iso_alloc_zone_handle *zone = iso_alloc_new_zone(allocation_size);
+    size_t total_chunks = iso_zone_chunk_count(zone);
+    void *last = NULL;
+
+    for(int i = 0; i < (total_chunks * 2); i++) {
+        last = iso_alloc_from_zone(zone);
+
+        if(last == NULL) {
+            LOG_AND_ABORT("Private zone did not grow after %d allocations of %ld bytes", i, allocation_size);
+        }
+    }
+
+    if(iso_zone_chunk_count(zone) <= total_chunks || iso_zone_owns_ptr(zone, last) == false) {
+        LOG_AND_ABORT("Private zone of %ld byte chunks has the wrong capacity", allocation_size);
+    }
+
+    iso_free_from_zone(last, zone);
+    iso_verify_zone(zone);
+    iso_alloc_destroy_zone(zone);
+
+    return OK;
+}
+
+/* A zone can be reused as a pool by resetting it
+ * instead of destroying and recreating it */
+int reset(size_t allocation_size, bool release_pages) {
+    iso_alloc_zone_handle *zone = iso_alloc_new_zone(allocation_size);
+    size_t total_chunks = iso_zone_chunk_count(zone);
+
+    for(int r = 0; r < 4; r++) {
+        for(int i = 0; i < total_chunks; i++) {
+            void *p = iso_alloc_from_zone(zone);
+
+            if(p == NULL) {
+                LOG_AND_ABORT("Failed to allocate %ld bytes after %d allocations and %d resets", allocation_size, i, r);
+            }
+
+            memset(p, 0x41, allocation_size);
+        }
+
+        iso_alloc_zone_reset(zone, release_pages);
+        iso_verify_zone(zone);
+
+        if(iso_alloc_detect_zone_leaks(zone) != 0) {
+            LOG_AND_ABORT("Zone of %ld byte chunks has leaks after a reset", allocation_size);
+        }
+    }
+
+    iso_alloc_destroy_zone(zone);
+
+    return OK;
+}
+
+/* Arenas bump allocate variable sized objects and free
+ * all of them at once with a reset or destroy */
+int arena(size_t span_size) {
+    iso_alloc_arena_handle *arena = iso_alloc_new_arena(span_size);
+
+    if(arena == NULL) {
+        LOG_AND_ABORT("Failed to create an arena with %ld byte spans", span_size);
+    }
+
+    for(int r = 0; r < 4; r++) {
+        for(int i = 1; i < 4096; i++) {
+            size_t alignment = 1 << (i % 13);
+            size_t size = (i * 37) % 2048;
+
+            /* Force an oversized span every so often */
+            if((i % 1024) == 0) {
+                size = SMALL_SIZE_MAX * 4;
+            }
+
+            uint8_t *p = iso_alloc_from_arena(arena, size, alignment);
+
+            if(p == NULL || ((uintptr_t) p & (alignment - 1)) != 0) {
+                LOG_AND_ABORT("Arena returned %p for %ld bytes aligned to %ld", p, size, alignment);
+            }
+
+            memset(p, 0x41, size);
+        }
+
+        iso_alloc_arena_reset(arena);
+    }
+
+    iso_alloc_destroy_arena(arena);
+
+    return OK;
+}
+
+/* Every other chunk is kept referenced from here, the rest
+ * are dropped and a reachability scan reports each of them */
+static void *kept[128];
+
+NO_INLINE int64_t populate(iso_alloc_zone_handle **zones, size_t count) {
+    int64_t live = 0;
+
+    for(int i = 0; i < count; i++) {
+        size_t size = allocation_sizes[i % (sizeof(allocation_sizes) / sizeof(uint32_t))];
+        zones[i] = iso_alloc_new_zone(size);
+
+        if(zones[i] == NULL) {
+            LOG_AND_ABORT("Failed to create private zone %d", i);
+        }
+
+        void *p = iso_alloc_from_zone(zones[i]);
+        iso_free_from_zone(iso_alloc_from_zone(zones[i]), zones[i]);
+        memset(p, 0x41, size);
+        live++;
+
+        if((i % 2) == 0) {
+            kept[i / 2] = p;
+        }
+    }
+
+    return live;
+}
+
+/* Clears the stack below the caller so no stale copy
+ * of a dropped pointer is left for the scan to find */
+NO_INLINE void scrub_stack(void) {
+    uint8_t stack[65536];
+    memset(stack, 0x0, sizeof(stack));
+    __asm__ __volatile__(""
+                         :
+                         : "r"(stack)
+                         : "memory");
+}
+
+/* Leak detection and zone verification scan every zone,
+ * enough private zones are created here that the scan
+ * is split across worker threads */
+int scan(void) {
+    iso_alloc_zone_handle *zones[256];
+    int64_t live = populate(zones, sizeof(zones) / sizeof(zones[0]));
+    scrub_stack();
+
+    iso_verify_zones();
+    int64_t leaks = iso_alloc_detect_leaks();
+
+#if LEAK_REACHABILITY
+    /* Only the chunks that were dropped are reported */
+    if(leaks != (live - (sizeof(kept) / sizeof(kept[0])))) {
+        LOG_AND_ABORT("Reachability scan found %ld leaks but %ld chunks were dropped", leaks, live - (sizeof(kept) / sizeof(kept[0])));
+    }
+#elif LEAK_DETECTOR
+    if(leaks < live) {
+        LOG_AND_ABORT("Leak detector found %ld leaks but %ld chunks are still allocated", leaks, live);
+    }
+#endif
+
+    for(int i = 0; i < (sizeof(kept) / sizeof(kept[0])); i++) {
+        iso_free_from_zone(kept[i], zones[i * 2]);
+    }
+
+    for(int i = 0; i < (sizeof(zones) / sizeof(zones[0])); i++) {
+        iso_alloc_destroy_zone(zones[i]);
+    }
+
+    return OK;
+}
+
 int main(int argc, char *argv[]) {
     for(int i = 0; i < sizeof(array_sizes) / sizeof(uint32_t); i++) {
         for(int z = 0; z < sizeof(allocation_sizes) / sizeof(uint32_t); z++) {
@@ -44,5 +208,14 @@ int main(int argc, char *argv[]) {
         allocate(array_sizes[i], 0);
     }
 
+    for(int z = 0; z < sizeof(allocation_sizes) / sizeof(uint32_t); z++) {
+        grow(allocation_sizes[z]);
+        reset(allocation_sizes[z], (z % 2) == 0);
+    }
+
+    arena(0);
+    arena(4096);
+    scan();
+
     return 0;
 }
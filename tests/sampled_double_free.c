@@ -0,0 +1,30 @@
+/* iso_alloc sampled_double_free.c
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* See sampled_free.c, with ALLOC_SANITY disabled this
+ * is a double free of a regular chunk */
+#define SAMPLE_SZ 200
+#define SAMPLED_CHUNK_SZ 224
+#define SAMPLE_TRIES 200000
+
+int main(int argc, char *argv[]) {
+    void *p = NULL;
+
+    for(int32_t i = 0; i < SAMPLE_TRIES; i++) {
+        p = iso_alloc(SAMPLE_SZ);
+
+        if(iso_chunksz(p) == SAMPLED_CHUNK_SZ) {
+            break;
+        }
+
+        iso_free(p);
+    }
+
+    iso_free(p);
+    iso_free(p);
+    iso_flush_caches();
+    return OK;
+}
@@ -0,0 +1,50 @@
+/* iso_alloc sampled_free.c
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* Requests are rounded up to SZ_ALIGNMENT before they are
+ * sampled, so a sampled 200 byte chunk reports 224 bytes
+ * while a chunk from the 256 byte zone reports 256. With
+ * ALLOC_SANITY disabled nothing is sampled and this only
+ * exercises the regular free paths */
+#define SAMPLE_SZ 200
+#define SAMPLED_CHUNK_SZ 224
+#define SAMPLE_TRIES 200000
+
+int main(int argc, char *argv[]) {
+    size_t sampled = 0;
+
+    for(int32_t i = 0; i < SAMPLE_TRIES; i++) {
+        uint8_t *p = iso_alloc(SAMPLE_SZ);
+
+        if(p == NULL) {
+            LOG_AND_ABORT("Failed to allocate %d bytes", SAMPLE_SZ);
+        }
+
+        memset(p, 0x41, SAMPLE_SZ);
+
+        if(iso_chunksz(p) != SAMPLED_CHUNK_SZ) {
+            iso_free(p);
+            continue;
+        }
+
+        /* Alternate between the plain and sized free paths,
+         * both must release the sample's slot */
+        if((sampled++ & 1) == 0) {
+            iso_free(p);
+        } else {
+            iso_free_size(p, SAMPLE_SZ);
+        }
+    }
+
+#if ALLOC_SANITY
+    if(sampled == 0) {
+        LOG_AND_ABORT("No allocation was sampled in %d tries", SAMPLE_TRIES);
+    }
+#endif
+
+    iso_verify_zones();
+    return OK;
+}
@@ -0,0 +1,62 @@
+/* iso_alloc sampled_reuse.c
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#define _GNU_SOURCE 1
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+
+/* Fills every sample slot, frees one after writing to it
+ * and samples again. The only free slot is the one just
+ * released, the new sample must not see the old bytes.
+ * The test runs itself again with a sanity_sample_odds
+ * of 1 so every allocation is sampled */
+#define SAMPLE_SZ 200
+#define SAMPLED_CHUNK_SZ 224
+
+int main(int argc, char *argv[]) {
+#if ALLOC_SANITY
+    if(getenv(CONF_ENV_STR) == NULL) {
+        setenv(CONF_ENV_STR, "sanity_sample_odds=1", 1);
+        execv("/proc/self/exe", argv);
+        LOG_AND_ABORT("Failed to run %s again", argv[0]);
+    }
+
+    uint8_t *samples[MAX_SANE_SAMPLES];
+
+    for(int32_t i = 0; i < MAX_SANE_SAMPLES; i++) {
+        samples[i] = iso_alloc(SAMPLE_SZ);
+
+        if(iso_chunksz(samples[i]) != SAMPLED_CHUNK_SZ) {
+            LOG_AND_ABORT("Allocation %d at 0x%p was not sampled", i, samples[i]);
+        }
+    }
+
+    uint8_t *p = samples[MAX_SANE_SAMPLES / 2];
+    memset(p, 0x41, SAMPLE_SZ);
+    iso_free(p);
+
+    p = iso_alloc(SAMPLE_SZ);
+    samples[MAX_SANE_SAMPLES / 2] = p;
+
+    if(iso_chunksz(p) != SAMPLED_CHUNK_SZ) {
+        LOG_AND_ABORT("Allocation at 0x%p did not reuse the free sample slot", p);
+    }
+
+    for(int32_t i = 0; i < SAMPLE_SZ; i++) {
+        if(p[i] != 0) {
+            LOG_AND_ABORT("Reused sample 0x%p has 0x%x at offset %d", p, p[i], i);
+        }
+    }
+
+    for(int32_t i = 0; i < MAX_SANE_SAMPLES; i++) {
+        iso_free(samples[i]);
+    }
+#else
+    uint8_t *p = iso_alloc(SAMPLE_SZ);
+    memset(p, 0x41, SAMPLE_SZ);
+    iso_free(p);
+#endif
+
+    return OK;
+}
@@ -4,11 +4,14 @@
 #include <memory>
 #include <array>
 #include <vector>
+#include <list>
+#include <map>
 #if THREAD_SUPPORT
 #include <thread>
 #endif
 #include "iso_alloc.h"
 #include "iso_alloc_internal.h"
+#include "iso_alloc.hpp"
 
 using namespace std;
 
@@ -96,6 +99,56 @@ int allocate(size_t array_size, size_t allocation_size) {
     return OK;
 }
 
+int zone_allocators() {
+    auto arena = std::make_shared<iso::zone_arena>();
+    iso::allocator<uint64_t> a(arena);
+    std::list<uint64_t, iso::allocator<uint64_t>> l(a);
+    std::map<uint32_t, uint32_t, std::less<uint32_t>, iso::allocator<std::pair<const uint32_t, uint32_t>>> m(a);
+    std::vector<uint8_t, iso::allocator<uint8_t>> v(a);
+
+    for(uint32_t i = 0; i < 65536; i++) {
+        l.push_back(i);
+        m[i] = i;
+        v.push_back(i & 0xff);
+    }
+
+    if(l.get_allocator() != m.get_allocator()) {
+        LOG_AND_ABORT("Allocators sharing an arena should compare equal");
+    }
+
+    uint32_t i = 0;
+
+    for(auto it = m.begin(); it != m.end(); it++, i++) {
+        if(it->first != i || it->second != i || v[i] != (i & 0xff)) {
+            LOG_AND_ABORT("Container backed by a private zone is corrupt at %d", i);
+        }
+    }
+
+    l.clear();
+    m.clear();
+
+#if ISO_ALLOC_PMR
+    iso::zone_memory_resource r;
+    std::pmr::vector<std::pmr::string> s(&r);
+
+    for(size_t z = 0; z < 1024; z++) {
+        s.emplace_back(z + 1, 'A');
+    }
+
+    for(size_t z = 0; z < s.size(); z++) {
+        if(s[z].size() != z + 1 || s[z][z] != 'A') {
+            LOG_AND_ABORT("pmr container backed by a private zone is corrupt");
+        }
+    }
+
+    s.clear();
+    s.shrink_to_fit();
+    r.release();
+#endif
+
+    return OK;
+}
+
 int main(int argc, char *argv[]) {
     char *a = (char *) iso_alloc(100);
     iso_free(a);
@@ -132,6 +185,8 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    zone_allocators();
+
     iso_verify_zones();
 
     return 0;
@@ -89,17 +89,58 @@ void *allocate(void *_type) {
     return OK;
 }
 
+#if THREAD_SUPPORT
+bool churn_done;
+
+/* Resets and destroys private zones while scans
+ * are reading them without the root lock */
+void *churn_zones(void *arg) {
+    for(int o = 0; o < times * 64; o++) {
+        iso_alloc_zone_handle *zone = iso_alloc_new_zone(ZONE_256);
+
+        for(int i = 0; i < 64; i++) {
+            memset(iso_alloc_from_zone(zone), 0x41, ZONE_256);
+        }
+
+        iso_alloc_zone_reset(zone, (o & 1) == 0);
+
+        for(int i = 0; i < 64; i++) {
+            memset(iso_alloc_from_zone(zone), 0x42, ZONE_256);
+        }
+
+        iso_alloc_destroy_zone(zone);
+    }
+
+    __atomic_store_n(&churn_done, true, __ATOMIC_RELEASE);
+    return OK;
+}
+
+void *scan_zones(void *arg) {
+    while(__atomic_load_n(&churn_done, __ATOMIC_ACQUIRE) == false) {
+        iso_verify_zones();
+    }
+
+    return OK;
+}
+#endif
+
 void run_test_threads(void) {
 #if THREAD_SUPPORT
     pthread_t t;
     pthread_t tt;
     pthread_t ttt;
+    pthread_t c;
+    pthread_t v;
     pthread_create(&t, NULL, allocate, (void *) &ALLOC);
     pthread_create(&tt, NULL, allocate, (void *) &REALLOC);
     pthread_create(&ttt, NULL, allocate, (void *) &CALLOC);
+    pthread_create(&c, NULL, churn_zones, NULL);
+    pthread_create(&v, NULL, scan_zones, NULL);
     pthread_join(t, NULL);
     pthread_join(tt, NULL);
     pthread_join(ttt, NULL);
+    pthread_join(c, NULL);
+    pthread_join(v, NULL);
 #endif
 }
 
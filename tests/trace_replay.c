@@ -0,0 +1,287 @@
+/* iso_alloc trace_replay.c
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#define _GNU_SOURCE 1
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Replays a trace recorded by an ALLOC_TRACE build of
+ * IsoAlloc. Events from every thread are put back in
+ * their global order and replayed on a single thread
+ * so the same trace always produces the same sequence
+ * of calls. Reports replay time and RSS. Built against
+ * system malloc with MALLOC_PERF_TEST, or any other
+ * allocator by LD_PRELOAD'ing it into that build */
+#if MALLOC_PERF_TEST
+#define alloc_mem malloc
+#define calloc_mem calloc
+#define realloc_mem realloc
+#define free_mem free
+#define ALLOCATOR_NAME "malloc"
+#else
+#define alloc_mem iso_alloc
+#define calloc_mem iso_calloc
+#define realloc_mem iso_realloc
+#define free_mem iso_free
+#define ALLOCATOR_NAME "IsoAlloc"
+#endif
+
+/* Maps trace pointer IDs to the pointers returned
+ * during replay. Open addressing with linear probing
+ * and backward shift deletion, ID 0 marks an empty slot */
+typedef struct {
+    uint64_t id;
+    void *p;
+    uint64_t size;
+} replay_obj_t;
+
+static replay_obj_t *objs;
+static uint64_t objs_mask;
+static uint64_t live_bytes;
+static uint64_t peak_live_bytes;
+static uint64_t unmatched;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static uint64_t rss_bytes(void) {
+    uint64_t size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if(f == NULL) {
+        return 0;
+    }
+
+    if(fscanf(f, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t peak_rss_bytes(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#if __APPLE__
+    return ru.ru_maxrss;
+#else
+    return ru.ru_maxrss * 1024;
+#endif
+}
+
+static inline uint64_t obj_hash(uint64_t id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return id & objs_mask;
+}
+
+static void obj_remove_slot(uint64_t i) {
+    uint64_t j = i;
+
+    live_bytes -= objs[i].size;
+    objs[i].id = 0;
+
+    /* Pull back any entry in the probe run that
+     * would no longer be reachable from its home */
+    while(true) {
+        j = (j + 1) & objs_mask;
+
+        if(objs[j].id == 0) {
+            return;
+        }
+
+        uint64_t h = obj_hash(objs[j].id);
+
+        if(((j - h) & objs_mask) >= ((j - i) & objs_mask)) {
+            objs[i] = objs[j];
+            objs[j].id = 0;
+            i = j;
+        }
+    }
+}
+
+static void *obj_remove(uint64_t id) {
+    for(uint64_t i = obj_hash(id);; i = (i + 1) & objs_mask) {
+        if(objs[i].id == 0) {
+            return NULL;
+        }
+
+        if(objs[i].id == id) {
+            void *p = objs[i].p;
+            obj_remove_slot(i);
+            return p;
+        }
+    }
+}
+
+static void obj_insert(uint64_t id, void *p, uint64_t size) {
+    uint64_t i = obj_hash(id);
+
+    for(; objs[i].id != 0; i = (i + 1) & objs_mask) {
+        /* The free for the previous object at this address
+         * is missing from the trace, drop it now */
+        if(objs[i].id == id) {
+            free_mem(objs[i].p);
+            live_bytes -= objs[i].size;
+            unmatched++;
+            break;
+        }
+    }
+
+    objs[i].id = id;
+    objs[i].p = p;
+    objs[i].size = size;
+    live_bytes += size;
+
+    if(live_bytes > peak_live_bytes) {
+        peak_live_bytes = live_bytes;
+    }
+}
+
+static void *touch(void *p, uint64_t size) {
+    if(p != NULL && size != 0) {
+        ((uint8_t *) p)[0] = 0x41;
+    }
+
+    return p;
+}
+
+static int event_cmp(const void *a, const void *b) {
+    const iso_alloc_trace_event_t *x = (const iso_alloc_trace_event_t *) a;
+    const iso_alloc_trace_event_t *y = (const iso_alloc_trace_event_t *) b;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static void replay(iso_alloc_trace_event_t *e) {
+    void *p;
+
+    switch(e->op) {
+    case TRACE_OP_MALLOC:
+        obj_insert(e->ptr_id, touch(alloc_mem(e->size), e->size), e->size);
+        break;
+    case TRACE_OP_CALLOC:
+        obj_insert(e->ptr_id, touch(calloc_mem(1, e->size), e->size), e->size);
+        break;
+    case TRACE_OP_REALLOC:
+        p = NULL;
+
+        if(e->old_ptr_id != 0) {
+            p = obj_remove(e->old_ptr_id);
+
+            if(p == NULL) {
+                unmatched++;
+            }
+        }
+
+        obj_insert(e->ptr_id, touch(realloc_mem(p, e->size), e->size), e->size);
+        break;
+    case TRACE_OP_FREE:
+        p = obj_remove(e->ptr_id);
+
+        if(p == NULL) {
+            unmatched++;
+        } else {
+            free_mem(p);
+        }
+
+        break;
+    }
+}
+
+/* Usage: trace_replay <trace file> */
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+        return -1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+
+    if(fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(iso_alloc_trace_header_t)) {
+        LOG_AND_ABORT("Could not open trace file %s", argv[1]);
+    }
+
+    /* A private mapping lets the events be sorted in place */
+    void *m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    if(m == MAP_FAILED) {
+        LOG_AND_ABORT("Could not map trace file %s", argv[1]);
+    }
+
+    close(fd);
+
+    iso_alloc_trace_header_t *hdr = (iso_alloc_trace_header_t *) m;
+
+    if(hdr->magic != TRACE_MAGIC || hdr->version != TRACE_VERSION || hdr->event_size != sizeof(iso_alloc_trace_event_t)) {
+        LOG_AND_ABORT("%s is not a trace file this tool can read", argv[1]);
+    }
+
+    iso_alloc_trace_event_t *events = (iso_alloc_trace_event_t *) ((uintptr_t) m + sizeof(iso_alloc_trace_header_t));
+    uint64_t slots = (st.st_size - sizeof(iso_alloc_trace_header_t)) / sizeof(iso_alloc_trace_event_t);
+    uint64_t count = 0;
+
+    /* Drop the slots threads reserved but never filled */
+    for(uint64_t i = 0; i < slots; i++) {
+        if(events[i].op != TRACE_OP_NONE) {
+            events[count++] = events[i];
+        }
+    }
+
+    qsort(events, count, sizeof(iso_alloc_trace_event_t), event_cmp);
+
+    uint64_t table_size = 1024;
+
+    while(table_size < (count * 2)) {
+        table_size <<= 1;
+    }
+
+    /* The ID table is mapped directly so it doesn't
+     * show up in the heap being measured */
+    objs = (replay_obj_t *) mmap(NULL, table_size * sizeof(replay_obj_t), PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(objs == MAP_FAILED) {
+        LOG_AND_ABORT("Could not map %lu replay slots", table_size);
+    }
+
+    objs_mask = table_size - 1;
+
+    uint64_t rss_start = rss_bytes();
+    uint64_t start = now_ns();
+
+    for(uint64_t i = 0; i < count; i++) {
+        replay(&events[i]);
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    uint64_t rss_end = rss_bytes();
+    uint64_t trace_ns = (count != 0) ? events[count - 1].timestamp : 0;
+
+    fprintf(stdout, "%s trace=%s events=%lu threads=%u dropped=%lu unmatched=%lu\n", ALLOCATOR_NAME, argv[1], count,
+            hdr->threads, hdr->dropped, unmatched);
+    fprintf(stdout, "%s seconds=%f ops/sec=%.0f recorded_seconds=%f\n", ALLOCATOR_NAME, (double) elapsed / 1000000000.0,
+            (double) count / ((double) elapsed / 1000000000.0), (double) trace_ns / 1000000000.0);
+    fprintf(stdout, "%s rss_start=%luKB rss_end=%luKB peak_rss=%luKB live_end=%luKB peak_live=%luKB\n", ALLOCATOR_NAME,
+            rss_start / 1024, rss_end / 1024, peak_rss_bytes() / 1024, live_bytes / 1024, peak_live_bytes / 1024);
+
+    /* Release whatever the trace left live */
+    for(uint64_t i = 0; i < table_size; i++) {
+        if(objs[i].id != 0) {
+            free_mem(objs[i].p);
+        }
+    }
+
+    munmap(objs, table_size * sizeof(replay_obj_t));
+    munmap(m, st.st_size);
+    return 0;
+}
@@ -0,0 +1,576 @@
+/* iso_alloc workload.c
+ * Copyright 2023 - chris.rohlf@gmail.com */
+
+#include "iso_alloc.h"
+#include "iso_alloc_internal.h"
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+
+/* Synthetic workload driver. Reads a spec file describing
+ * a size distribution, an object lifetime distribution, a
+ * thread count and an operation mix, then replays that
+ * workload and reports throughput, per-operation latency
+ * percentiles and fragmentation (RSS versus live bytes).
+ * See tests/workloads/ for example spec files */
+#if MALLOC_PERF_TEST
+#define alloc_mem malloc
+#define realloc_mem realloc
+#define free_mem free
+#define ALLOCATOR_NAME "malloc"
+#else
+#define alloc_mem iso_alloc
+#define realloc_mem iso_realloc
+#define free_mem iso_free
+#define ALLOCATOR_NAME "IsoAlloc"
+#endif
+
+#define MAX_THREADS 64
+#define MAX_HIST_BUCKETS 32
+#define LAT_SUB_BUCKET_BITS 3
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BUCKET_BITS)
+#define LAT_BUCKETS 256
+
+#define OP_ALLOC 0
+#define OP_FREE 1
+#define OP_REALLOC 2
+#define OP_TYPES 3
+
+#define DIST_FIXED 0
+#define DIST_UNIFORM 1
+#define DIST_HIST 2
+#define DIST_LOGNORMAL 3
+#define DIST_EXPONENTIAL 4
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+    int32_t type;
+    double a;
+    double b;
+    int32_t count;
+    uint64_t values[MAX_HIST_BUCKETS];
+    double cdf[MAX_HIST_BUCKETS];
+} dist_t;
+
+typedef struct {
+    uint32_t threads;
+    uint64_t ops;
+    uint64_t max_live;
+    uint64_t max_size;
+    uint32_t alloc_weight;
+    uint32_t realloc_weight;
+    dist_t size;
+    dist_t lifetime;
+} spec_t;
+
+/* A live object, kept in a per-thread min-heap
+ * ordered by the operation tick it expires at */
+typedef struct {
+    uint64_t expires;
+    void *p;
+    size_t size;
+} live_obj_t;
+
+typedef struct {
+    int32_t id;
+    uint64_t seed;
+    uint64_t ops[OP_TYPES];
+    uint64_t latency[OP_TYPES][LAT_BUCKETS];
+    live_obj_t *heap;
+    uint64_t heap_count;
+} workload_thread_t;
+
+static spec_t spec;
+static uint64_t live_bytes;
+static uint32_t threads_running;
+
+static inline uint64_t wl_rand(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    return x;
+}
+
+/* Uniform double in (0, 1] */
+static inline double wl_rand_double(uint64_t *s) {
+    return ((wl_rand(s) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static uint64_t rss_bytes(void) {
+    uint64_t size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if(f == NULL) {
+        return 0;
+    }
+
+    if(fscanf(f, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* Same log-linear bucketing as the ALLOC_LATENCY histograms */
+static int32_t lat_bucket(uint64_t ns) {
+    if(ns < LAT_SUB_BUCKETS) {
+        return (int32_t) ns;
+    }
+
+    int32_t msb = 63 - __builtin_clzll(ns);
+    int32_t idx = ((msb - LAT_SUB_BUCKET_BITS + 1) * LAT_SUB_BUCKETS) +
+                  ((ns >> (msb - LAT_SUB_BUCKET_BITS)) & (LAT_SUB_BUCKETS - 1));
+
+    return idx >= LAT_BUCKETS ? LAT_BUCKETS - 1 : idx;
+}
+
+static uint64_t lat_bucket_value(int32_t idx) {
+    if(idx < LAT_SUB_BUCKETS) {
+        return idx;
+    }
+
+    int32_t msb = (idx / LAT_SUB_BUCKETS) + LAT_SUB_BUCKET_BITS - 1;
+    uint64_t sub = (idx & (LAT_SUB_BUCKETS - 1)) + LAT_SUB_BUCKETS + 1;
+    return (sub << (msb - LAT_SUB_BUCKET_BITS)) - 1;
+}
+
+static uint64_t lat_percentile(uint64_t *buckets, uint64_t count, double pct) {
+    uint64_t rank = (uint64_t) ceil(count * pct);
+    uint64_t seen = 0;
+
+    for(int32_t i = 0; i < LAT_BUCKETS; i++) {
+        seen += buckets[i];
+
+        if(seen >= rank && seen != 0) {
+            return lat_bucket_value(i);
+        }
+    }
+
+    return 0;
+}
+
+static uint64_t dist_sample(dist_t *d, uint64_t *seed) {
+    switch(d->type) {
+    case DIST_UNIFORM:
+        return d->a + (wl_rand(seed) % ((uint64_t) (d->b - d->a) + 1));
+    case DIST_LOGNORMAL: {
+        /* Box-Muller transform */
+        double u1 = wl_rand_double(seed);
+        double u2 = wl_rand_double(seed);
+        double z = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+        return (uint64_t) exp(d->a + (d->b * z));
+    }
+    case DIST_EXPONENTIAL:
+        return (uint64_t) (-log(wl_rand_double(seed)) * d->a);
+    case DIST_HIST: {
+        /* Pick a bucket by weight, then a value uniformly
+         * between the previous bucket and this one */
+        double r = wl_rand_double(seed);
+        int32_t i = 0;
+
+        while(i < d->count - 1 && r > d->cdf[i]) {
+            i++;
+        }
+
+        uint64_t lo = (i == 0) ? 1 : d->values[i - 1] + 1;
+        return lo + (wl_rand(seed) % (d->values[i] - lo + 1));
+    }
+    case DIST_FIXED:
+    default:
+        return d->a;
+    }
+}
+
+static double next_number(int32_t line) {
+    char *tok = strtok(NULL, " \t");
+
+    if(tok == NULL) {
+        LOG_AND_ABORT("Line %d: distribution is missing a parameter", line);
+    }
+
+    return strtod(tok, NULL);
+}
+
+/* Parses 'fixed N', 'uniform LO HI', 'lognormal MU SIGMA',
+ * 'exponential MEAN' or 'hist V:W V:W ...' */
+static void parse_dist(dist_t *d, char *s, int32_t line) {
+    char *type = strtok(s, " \t");
+
+    if(type == NULL) {
+        LOG_AND_ABORT("Line %d: missing distribution type", line);
+    }
+
+    memset(d, 0x0, sizeof(dist_t));
+
+    if(strcmp(type, "fixed") == 0) {
+        d->type = DIST_FIXED;
+        d->a = next_number(line);
+    } else if(strcmp(type, "uniform") == 0) {
+        d->type = DIST_UNIFORM;
+        d->a = next_number(line);
+        d->b = next_number(line);
+
+        if(d->b < d->a) {
+            LOG_AND_ABORT("Line %d: uniform upper bound is below the lower bound", line);
+        }
+    } else if(strcmp(type, "lognormal") == 0) {
+        d->type = DIST_LOGNORMAL;
+        d->a = next_number(line);
+        d->b = next_number(line);
+    } else if(strcmp(type, "exponential") == 0) {
+        d->type = DIST_EXPONENTIAL;
+        d->a = next_number(line);
+    } else if(strcmp(type, "hist") == 0) {
+        d->type = DIST_HIST;
+        double total = 0;
+        char *tok;
+
+        while((tok = strtok(NULL, " \t")) != NULL && d->count < MAX_HIST_BUCKETS) {
+            char *w = strchr(tok, ':');
+
+            if(w == NULL) {
+                LOG_AND_ABORT("Line %d: histogram buckets are value:weight", line);
+            }
+
+            *w = '\0';
+            d->values[d->count] = strtoull(tok, NULL, 10);
+
+            if(d->count != 0 && d->values[d->count] <= d->values[d->count - 1]) {
+                LOG_AND_ABORT("Line %d: histogram values must be increasing", line);
+            }
+
+            total += strtod(w + 1, NULL);
+            d->cdf[d->count] = total;
+            d->count++;
+        }
+
+        if(d->count == 0 || total <= 0) {
+            LOG_AND_ABORT("Line %d: empty histogram", line);
+        }
+
+        for(int32_t i = 0; i < d->count; i++) {
+            d->cdf[i] /= total;
+        }
+    } else {
+        LOG_AND_ABORT("Line %d: unknown distribution '%s'", line, type);
+    }
+}
+
+/* The spec file is 'key = value' lines, # starts a comment */
+static void parse_spec(const char *path) {
+    char buf[1024];
+    int32_t line = 0;
+    FILE *f = fopen(path, "r");
+
+    if(f == NULL) {
+        LOG_AND_ABORT("Could not open workload spec %s", path);
+    }
+
+    spec.threads = 1;
+    spec.ops = 1000000;
+    spec.max_live = 65536;
+    spec.max_size = 1048576;
+    spec.alloc_weight = 90;
+    spec.realloc_weight = 10;
+    spec.size.type = DIST_UNIFORM;
+    spec.size.a = 16;
+    spec.size.b = 1024;
+    spec.lifetime.type = DIST_EXPONENTIAL;
+    spec.lifetime.a = 1000;
+
+    while(fgets(buf, sizeof(buf), f) != NULL) {
+        line++;
+
+        char *c = strchr(buf, '#');
+
+        if(c != NULL) {
+            *c = '\0';
+        }
+
+        c = strchr(buf, '\n');
+
+        if(c != NULL) {
+            *c = '\0';
+        }
+
+        char *eq = strchr(buf, '=');
+
+        if(eq == NULL) {
+            continue;
+        }
+
+        *eq = '\0';
+        char *key = strtok(buf, " \t");
+        char *value = eq + 1;
+
+        if(key == NULL) {
+            continue;
+        }
+
+        if(strcmp(key, "threads") == 0) {
+            spec.threads = strtoul(value, NULL, 10);
+        } else if(strcmp(key, "ops") == 0) {
+            spec.ops = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "max_live") == 0) {
+            spec.max_live = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "max_size") == 0) {
+            spec.max_size = strtoull(value, NULL, 10);
+        } else if(strcmp(key, "alloc") == 0) {
+            spec.alloc_weight = strtoul(value, NULL, 10);
+        } else if(strcmp(key, "realloc") == 0) {
+            spec.realloc_weight = strtoul(value, NULL, 10);
+        } else if(strcmp(key, "size") == 0) {
+            parse_dist(&spec.size, value, line);
+        } else if(strcmp(key, "lifetime") == 0) {
+            parse_dist(&spec.lifetime, value, line);
+        } else {
+            LOG_AND_ABORT("Line %d: unknown key '%s'", line, key);
+        }
+    }
+
+    fclose(f);
+
+    if(spec.threads < 1 || spec.threads > MAX_THREADS) {
+        LOG_AND_ABORT("threads must be between 1 and %d", MAX_THREADS);
+    }
+
+    if(spec.max_live == 0 || (spec.alloc_weight + spec.realloc_weight) == 0) {
+        LOG_AND_ABORT("max_live and the operation mix must be non-zero");
+    }
+}
+
+static void heap_push(workload_thread_t *wt, live_obj_t o) {
+    uint64_t i = wt->heap_count++;
+
+    while(i != 0) {
+        uint64_t parent = (i - 1) / 2;
+
+        if(wt->heap[parent].expires <= o.expires) {
+            break;
+        }
+
+        wt->heap[i] = wt->heap[parent];
+        i = parent;
+    }
+
+    wt->heap[i] = o;
+}
+
+static live_obj_t heap_pop(workload_thread_t *wt) {
+    live_obj_t top = wt->heap[0];
+    live_obj_t last = wt->heap[--wt->heap_count];
+    uint64_t i = 0;
+
+    while(true) {
+        uint64_t child = (i * 2) + 1;
+
+        if(child >= wt->heap_count) {
+            break;
+        }
+
+        if(child + 1 < wt->heap_count && wt->heap[child + 1].expires < wt->heap[child].expires) {
+            child++;
+        }
+
+        if(last.expires <= wt->heap[child].expires) {
+            break;
+        }
+
+        wt->heap[i] = wt->heap[child];
+        i = child;
+    }
+
+    if(wt->heap_count != 0) {
+        wt->heap[i] = last;
+    }
+
+    return top;
+}
+
+static size_t sample_size(workload_thread_t *wt) {
+    uint64_t sz = dist_sample(&spec.size, &wt->seed);
+
+    if(sz == 0) {
+        sz = 1;
+    } else if(sz > spec.max_size) {
+        sz = spec.max_size;
+    }
+
+    return sz;
+}
+
+static void free_obj(workload_thread_t *wt, live_obj_t *o) {
+    uint64_t start = now_ns();
+    free_mem(o->p);
+    wt->latency[OP_FREE][lat_bucket(now_ns() - start)]++;
+    wt->ops[OP_FREE]++;
+    __atomic_fetch_sub(&live_bytes, o->size, __ATOMIC_RELAXED);
+}
+
+/* Every tick frees the objects whose lifetime has ended
+ * and then performs an allocation or a realloc of a random
+ * live object according to the operation mix. Lifetimes
+ * are measured in ticks of the thread that allocated them */
+static void *workload(void *arg) {
+    workload_thread_t *wt = (workload_thread_t *) arg;
+    uint32_t mix = spec.alloc_weight + spec.realloc_weight;
+
+    wt->heap = (live_obj_t *) calloc(spec.max_live, sizeof(live_obj_t));
+
+    for(uint64_t tick = 0; tick < spec.ops; tick++) {
+        while(wt->heap_count != 0 && wt->heap[0].expires <= tick) {
+            live_obj_t o = heap_pop(wt);
+            free_obj(wt, &o);
+        }
+
+        if(wt->heap_count != 0 && (wl_rand(&wt->seed) % mix) < spec.realloc_weight) {
+            live_obj_t *o = &wt->heap[wl_rand(&wt->seed) % wt->heap_count];
+            size_t size = sample_size(wt);
+            uint64_t start = now_ns();
+            void *p = realloc_mem(o->p, size);
+            wt->latency[OP_REALLOC][lat_bucket(now_ns() - start)]++;
+            wt->ops[OP_REALLOC]++;
+
+            if(p == NULL) {
+                LOG_AND_ABORT("Failed to realloc %ld bytes", size);
+            }
+
+            ((uint8_t *) p)[0] = 0x41;
+            __atomic_fetch_add(&live_bytes, size - o->size, __ATOMIC_RELAXED);
+            o->p = p;
+            o->size = size;
+            continue;
+        }
+
+        /* The oldest object is freed early when the
+         * working set is at its configured limit */
+        if(wt->heap_count == spec.max_live) {
+            live_obj_t o = heap_pop(wt);
+            free_obj(wt, &o);
+        }
+
+        live_obj_t o;
+        o.size = sample_size(wt);
+        o.expires = tick + 1 + dist_sample(&spec.lifetime, &wt->seed);
+
+        uint64_t start = now_ns();
+        o.p = alloc_mem(o.size);
+        wt->latency[OP_ALLOC][lat_bucket(now_ns() - start)]++;
+        wt->ops[OP_ALLOC]++;
+
+        if(o.p == NULL) {
+            LOG_AND_ABORT("Failed to allocate %ld bytes", o.size);
+        }
+
+        ((uint8_t *) o.p)[0] = 0x41;
+        __atomic_fetch_add(&live_bytes, o.size, __ATOMIC_RELAXED);
+        heap_push(wt, o);
+    }
+
+    while(wt->heap_count != 0) {
+        live_obj_t o = heap_pop(wt);
+        free_obj(wt, &o);
+    }
+
+    free(wt->heap);
+    __atomic_fetch_sub(&threads_running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Usage: workload <spec file> */
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <workload spec>\n", argv[0]);
+        return ERR;
+    }
+
+    parse_spec(argv[1]);
+
+    static workload_thread_t wt[MAX_THREADS];
+    pthread_t t[MAX_THREADS];
+    uint64_t baseline_rss = rss_bytes();
+    uint64_t peak_live = 0, rss_at_peak = 0, samples = 0;
+    double ratio_sum = 0;
+
+    threads_running = spec.threads;
+    uint64_t start = now_ns();
+
+    for(uint32_t i = 0; i < spec.threads; i++) {
+        wt[i].id = i;
+        wt[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        pthread_create(&t[i], NULL, workload, &wt[i]);
+    }
+
+    /* Sample fragmentation while the workload runs. RSS
+     * is measured relative to the RSS before it started */
+    while(__atomic_load_n(&threads_running, __ATOMIC_ACQUIRE) != 0) {
+        struct timespec ts = {0, 10000000};
+        nanosleep(&ts, NULL);
+
+        uint64_t live = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+        uint64_t rss = rss_bytes();
+        rss = (rss > baseline_rss) ? rss - baseline_rss : 0;
+
+        if(live == 0) {
+            continue;
+        }
+
+        ratio_sum += (double) rss / (double) live;
+        samples++;
+
+        if(live > peak_live) {
+            peak_live = live;
+            rss_at_peak = rss;
+        }
+    }
+
+    uint64_t ops[OP_TYPES] = {0};
+    static uint64_t latency[OP_TYPES][LAT_BUCKETS];
+
+    for(uint32_t i = 0; i < spec.threads; i++) {
+        pthread_join(t[i], NULL);
+
+        for(int32_t o = 0; o < OP_TYPES; o++) {
+            ops[o] += wt[i].ops[o];
+
+            for(int32_t b = 0; b < LAT_BUCKETS; b++) {
+                latency[o][b] += wt[i].latency[o][b];
+            }
+        }
+    }
+
+    double elapsed = (double) (now_ns() - start) / 1000000000.0;
+    uint64_t total = ops[OP_ALLOC] + ops[OP_FREE] + ops[OP_REALLOC];
+    const char *names[OP_TYPES] = {"alloc", "free", "realloc"};
+
+    fprintf(stdout, "%s workload=%s threads=%d ops=%lu seconds=%f ops/sec=%.0f\n", ALLOCATOR_NAME,
+            argv[1], spec.threads, total, elapsed, (double) total / elapsed);
+
+    for(int32_t o = 0; o < OP_TYPES; o++) {
+        if(ops[o] == 0) {
+            continue;
+        }
+
+        fprintf(stdout, "%-8s count=%lu p50=%luns p90=%luns p99=%luns p99.9=%luns\n", names[o], ops[o],
+                lat_percentile(latency[o], ops[o], 0.50), lat_percentile(latency[o], ops[o], 0.90),
+                lat_percentile(latency[o], ops[o], 0.99), lat_percentile(latency[o], ops[o], 0.999));
+    }
+
+    fprintf(stdout, "fragmentation peak_live=%luKB rss_at_peak=%luKB rss/live at peak=%.2f mean rss/live=%.2f\n",
+            peak_live / 1024, rss_at_peak / 1024, peak_live ? (double) rss_at_peak / (double) peak_live : 0.0,
+            samples ? ratio_sum / samples : 0.0);
+
+    return OK;
+}
@@ -0,0 +1,10 @@
+# Parametric workload. ln(size) is normally distributed
+# around ln(256) and lifetimes are exponential
+threads = 2
+ops = 500000
+max_live = 16384
+max_size = 131072
+alloc = 80
+realloc = 20
+size = lognormal 5.5 1.0
+lifetime = exponential 2000
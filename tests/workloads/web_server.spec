@@ -0,0 +1,17 @@
+# Request handling service. Mostly small short lived
+# objects with a tail of long lived buffers
+threads = 4
+ops = 500000
+max_live = 65536
+max_size = 1048576
+
+# Operation mix in percent. Frees are driven by lifetimes
+alloc = 90
+realloc = 10
+
+# Sizes in bytes as value:weight buckets, values are
+# sampled uniformly between the previous bucket and this one
+size = hist 32:30 128:30 512:20 2048:12 16384:6 262144:2
+
+# Lifetimes in operations of the allocating thread
+lifetime = hist 16:60 1024:30 65536:9 1000000:1
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+# iso_alloc generate_target_config.py
+# Copyright 2023 - chris.rohlf@gmail.com
+#
+# Merges one or more profiles written by a HEAP_PROFILER build
+# of IsoAlloc and generates iso_alloc_target_config.h, a set of
+# default zones and cache sizes tuned to the profiled workload.
+# Build with TARGET_CONFIG enabled in the Makefile to use it.
+# See PROFILER.md for how each value is chosen.
+#
+# Usage:
+#   generate_target_config.py [-o iso_alloc_target_config.h] profile [profile ...]
+
+import sys
+
+# These mirror the limits in conf.h and iso_alloc_internal.h
+SZ_ALIGNMENT = 32
+MAX_DEFAULT_ZONE_SZ = 8192
+ZONE_USER_SIZE_MB = 4
+
+# Never generate more default zones than this, each one
+# costs ZONE_USER_SIZE of virtual memory at startup
+MAX_DEFAULT_ZONES = 16
+
+# Never start with more zones of a single size than this
+MAX_ZONES_PER_SIZE = 4
+
+
+def next_pow2(n):
+    p = SZ_ALIGNMENT
+
+    while p < n:
+        p <<= 1
+
+    return p
+
+
+class Profile:
+    def __init__(self):
+        self.counters = {}
+        # Size class -> most zones of that size seen in one profile,
+        # each size with zones is listed even if none filled up
+        self.zones = {}
+        # Size class -> times a zone of that size was over
+        # CHUNK_USAGE_THRESHOLD full when sampled
+        self.full = {}
+        # Size class -> estimated bytes allocated
+        self.bytes = {}
+        self.files = []
+
+    def read(self, path):
+        self.files.append(path)
+        zones = {}
+
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+
+                if line == "" or line.startswith("#") or line.startswith("0x"):
+                    continue
+
+                if line.startswith("alloc_backtrace="):
+                    fields = dict(kv.split("=", 1) for kv in line.split(","))
+                    upper = int(fields["upper_bound_size"])
+
+                    if upper <= MAX_DEFAULT_ZONE_SZ:
+                        c = next_pow2(upper)
+                        self.bytes[c] = self.bytes.get(c, 0) + int(fields.get("estimated_bytes", 0))
+
+                    continue
+
+                if "=" in line:
+                    key, value = line.split("=", 1)
+
+                    if value.isdigit():
+                        self.counters[key] = self.counters.get(key, 0) + int(value)
+
+                    continue
+
+                # _zone_profiler_map lines are chunk size,
+                # number of zones, number of times full
+                parts = line.split(",")
+
+                if len(parts) != 3 or not all(p.isdigit() for p in parts):
+                    continue
+
+                size, total, full = (int(p) for p in parts)
+
+                if size > MAX_DEFAULT_ZONE_SZ:
+                    continue
+
+                c = next_pow2(size)
+                zones[c] = zones.get(c, 0) + total
+                self.full[c] = self.full.get(c, 0) + full
+
+        for c, n in zones.items():
+            self.zones[c] = max(self.zones.get(c, 0), n)
+
+    def default_zones(self):
+        classes = set(self.zones) | set(self.full) | set(self.bytes)
+        counts = {}
+
+        for c in classes:
+            # Every size the workload created a zone for gets one,
+            # sizes that kept zones full start with as many zones
+            # as the workload ended up creating for them
+            n = 1
+
+            if self.full.get(c, 0) != 0:
+                n = min(max(self.zones.get(c, 1), 1), MAX_ZONES_PER_SIZE)
+
+            counts[c] = n
+
+        # Drop zones from the least used sizes until under the limit
+        def weight(c):
+            return (self.full.get(c, 0), self.bytes.get(c, 0), self.zones.get(c, 0))
+
+        while sum(counts.values()) > MAX_DEFAULT_ZONES:
+            c = min((c for c in counts if counts[c] > 1), key=weight, default=None)
+
+            if c is None:
+                c = min(counts, key=weight)
+                del counts[c]
+            else:
+                counts[c] -= 1
+
+        zones = []
+
+        for c in sorted(counts):
+            zones += [c] * counts[c]
+
+        return zones
+
+
+def main():
+    args = sys.argv[1:]
+    out = "iso_alloc_target_config.h"
+
+    if len(args) >= 2 and args[0] == "-o":
+        out = args[1]
+        args = args[2:]
+
+    if len(args) == 0:
+        print("Usage: %s [-o iso_alloc_target_config.h] profile [profile ...]" % sys.argv[0], file=sys.stderr)
+        return 1
+
+    profile = Profile()
+
+    for path in args:
+        profile.read(path)
+
+    zones = profile.default_zones()
+
+    if len(zones) == 0:
+        print("No small allocations were sampled in %s" % " ".join(args), file=sys.stderr)
+        return 1
+
+    # Requests smaller than SMALLEST_CHUNK_SZ are rounded up to
+    # it and must land in a default zone, so it's the size of the
+    # smallest one. Sizes below it were either never sampled or
+    # dropped to stay under MAX_DEFAULT_ZONES
+    smallest = zones[0]
+
+    # The SMALL_MEM_STARTUP fast path begins its search for
+    # requests of 512 bytes or more halfway through the default
+    # zones. It's only enabled when that never skips a zone
+    # that could have held the request
+    small_mem_startup = 1 if all(z < 512 for z in zones[:len(zones) >> 1]) else 0
+
+    # The MRU zone cache should hold a zone for each size
+    # the program commonly uses
+    zone_cache = 8
+
+    while zone_cache < len(set(zones)) and zone_cache < 32:
+        zone_cache <<= 1
+
+    # Programs that free most of what they allocate benefit
+    # from batching more frees, programs that mostly hold on
+    # to memory free rarely and need a smaller batch
+    allocated = profile.counters.get("allocated", 0)
+    freed = profile.counters.get("freed", 0)
+    ratio = (freed / allocated) if allocated else 0
+    quarantine = 128 if ratio >= 0.9 else (32 if ratio < 0.5 else 64)
+
+    with open(out, "w") as f:
+        f.write("/* iso_alloc_target_config.h - A secure memory allocator\n")
+        f.write(" * Generated by utils/generate_target_config.py from:\n")
+
+        for path in profile.files:
+            f.write(" *   %s\n" % path)
+
+        f.write(" * allocated=%d freed=%d */\n\n" % (allocated, freed))
+        f.write("#pragma once\n\n")
+        f.write("#undef SMALL_MEM_STARTUP\n")
+        f.write("#define SMALL_MEM_STARTUP %d\n\n" % small_mem_startup)
+        f.write("#define ZONE_CACHE_SZ %d\n" % zone_cache)
+        f.write("#define CHUNK_QUARANTINE_SZ %d\n\n" % quarantine)
+        f.write("/* ZONE_USER_SIZE * sizeof(default_zones) = ~%d mb */\n" % (len(zones) * ZONE_USER_SIZE_MB))
+        f.write("#define SMALLEST_CHUNK_SZ %d\n" % smallest)
+        f.write("const static uint64_t default_zones[] = {%s};\n" % ", ".join("%d" % z for z in zones))
+
+    print("Wrote %s with %d default zones" % (out, len(zones)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
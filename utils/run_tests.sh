@@ -4,7 +4,7 @@
 $(echo '' > test_output.txt)
 
 tests=("tests" "big_tests" "interfaces_test" "thread_tests" "pool_test"
-       "rand_freelist")
+       "rand_freelist" "sampled_free" "sampled_reuse")
 failure=0
 succeeded=0
 
@@ -31,7 +31,7 @@ done
 
 fail_tests=("double_free" "big_double_free" "heap_overflow" "heap_underflow"
             "leaks_test" "wild_free" "unaligned_free" "incorrect_chunk_size_multiple"
-            "big_canary_test" "zero_alloc" "sized_free")
+            "big_canary_test" "zero_alloc" "sized_free" "sampled_double_free")
 
 for t in "${fail_tests[@]}"; do
     echo -n "Running $t test"
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# iso_alloc symbolize_profile.py
+# Copyright 2023 - chris.rohlf@gmail.com
+#
+# Symbolizes a profile written by a HEAP_PROFILER build of
+# IsoAlloc. The profile only holds raw return addresses and
+# the executable mappings of the process that wrote it, this
+# script resolves them with addr2line. It must be run on the
+# machine that produced the profile, or one with the same
+# binaries at the same paths.
+#
+# Usage:
+#   symbolize_profile.py iso_alloc_profiler.data
+#       Prints the profile with a symbol after every address
+#   symbolize_profile.py --folded iso_alloc_profiler.data
+#       Prints the allocation stacks from the .folded file
+#       written next to the profile with symbols in place of
+#       addresses. The output can be passed to flamegraph.pl
+
+import subprocess
+import sys
+
+
+def read_mappings(lines):
+    mappings = []
+
+    for line in lines:
+        if not line.startswith("mapping="):
+            continue
+
+        fields = dict(f.split("=", 1) for f in line.strip().split(","))
+        start, end = fields["mapping"].split("-")
+        mappings.append((int(start, 16), int(end, 16), int(fields["base"], 16), fields["path"]))
+
+    return mappings
+
+
+def symbolize(addresses, mappings):
+    by_path = {}
+    symbols = {}
+
+    for addr in addresses:
+        for start, end, base, path in mappings:
+            if start <= addr < end:
+                # Return addresses point after the call
+                by_path.setdefault(path, []).append((addr, addr - base - 1))
+                break
+        else:
+            symbols[addr] = "[?]"
+
+    for path, addrs in by_path.items():
+        try:
+            out = subprocess.run(["addr2line", "-f", "-C", "-e", path] + ["0x%x" % a[1] for a in addrs],
+                                 capture_output=True, text=True, check=True).stdout.splitlines()
+        except (OSError, subprocess.CalledProcessError):
+            out = []
+
+        for i, (addr, _) in enumerate(addrs):
+            name = out[i * 2] if (i * 2) < len(out) else "??"
+
+            if name == "??":
+                name = "[?]"
+
+            symbols[addr] = "%s %s" % (name, path)
+
+    return symbols
+
+
+def main():
+    args = sys.argv[1:]
+    folded = "--folded" in args
+    args = [a for a in args if a != "--folded"]
+
+    if len(args) != 1:
+        print("Usage: %s [--folded] <profile>" % sys.argv[0], file=sys.stderr)
+        return 1
+
+    with open(args[0]) as f:
+        profile = f.readlines()
+
+    mappings = read_mappings(profile)
+
+    if folded:
+        with open(args[0] + ".folded") as f:
+            stacks = [l.rsplit(" ", 1) for l in f.read().splitlines() if l]
+
+        addresses = {int(a, 16) for s, _ in stacks for a in s.split(";")}
+        symbols = symbolize(addresses, mappings)
+
+        for s, weight in stacks:
+            # flamegraph.pl splits frames on ';'
+            frames = [symbols[int(a, 16)].split(" ")[0].replace(";", ":") for a in s.split(";")]
+            print("%s %s" % (";".join(frames), weight))
+
+        return 0
+
+    addresses = {int(l.strip(), 16) for l in profile if l.startswith("\t0x")}
+    symbols = symbolize(addresses, mappings)
+
+    for line in profile:
+        if line.startswith("\t0x"):
+            addr = line.strip()
+            print("\t%s -> %s" % (addr, symbols[int(addr, 16)]))
+        else:
+            print(line, end="")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())